@@ -0,0 +1,95 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCBatch.h"
+#include "ATCBatch_impl.h"
+
+#include <zlib.h>
+
+
+ATCBatchJob::ATCBatchJob() :
+
+type(ATC_BATCH_LOCK),
+priority(0),
+compression_level(Z_DEFAULT_COMPRESSION),
+
+src_buffer(nullptr),
+src_length(0),
+
+dst_buffer(nullptr),
+dst_entries(nullptr),
+dst_buffers(nullptr)
+
+{
+
+}
+
+ATCBatch::ATCBatch() :
+
+impl_(std::make_shared<ATCBatch_impl>())
+
+{
+
+}
+
+ATCBatch::~ATCBatch()
+{
+
+}
+
+size_t ATCBatch::submit(const ATCBatchJob& job)
+{
+	return impl_->submit(job);
+}
+
+void ATCBatch::wait()
+{
+	impl_->wait();
+}
+
+ATCResult ATCBatch::result(size_t id) const
+{
+	return impl_->result(id);
+}
+
+int ATCBatch::thread_count() const
+{
+	return impl_->thread_count();
+}
+
+bool ATCBatch::small_first() const
+{
+	return impl_->small_first();
+}
+
+void ATCBatch::set_thread_count(int thread_count)
+{
+	impl_->set_thread_count(thread_count);
+}
+
+void ATCBatch::set_small_first(bool small_first)
+{
+	impl_->set_small_first(small_first);
+}
@@ -0,0 +1,99 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ATCCommon.h"
+#include "ATCKey.h"
+
+using namespace std;
+
+class ATCBatch_impl;
+
+// ATCBatch で実行するロックかアンロックのジョブ
+// 入力と出力はファイルのパスか、メモリ上のバッファで指定する
+struct ATCBatchJob {
+
+	ATCBatchJob();
+
+	ATCBatchJobType type;
+	ATCKey key;					// ロックは ATC_KEY_ENCRYPTION、アンロックは ATC_KEY_DECRYPTION
+	int priority;				// 大きいほど先に実行する
+	int32_t compression_level;	// ロックの圧縮レベル
+
+	// ロック: entries[i] の中身を src_paths[i] のファイルか src_buffers[i] から読む
+	vector<ATCFileEntry> entries;
+	vector<string> src_paths;
+	vector<const char*> src_buffers;
+
+	// アンロック: アーカイブを src_path のファイルか src_buffer から読む
+	string src_path;
+	const char *src_buffer;
+	size_t src_length;
+
+	// ロック: アーカイブを dst_path のファイルか dst_buffer に書く
+	string dst_path;
+	string *dst_buffer;
+
+	// アンロック: エントリを dst_entries に、中身を dst_buffers に書く（nullptr なら書かない）
+	vector<ATCFileEntry> *dst_entries;
+	vector<string> *dst_buffers;
+
+	// ジョブが終わったときにワーカーのスレッドから呼ばれる
+	function<void (ATCResult result)> callback;
+
+};
+
+// 多数のアーカイブのロックとアンロックをまとめて実行するスレッドプール
+// ワーカーは ATCLocker / ATCUnlocker を使い回し、自分のジョブがなくなれば他のワーカーから盗む
+class ATCBatch
+{
+public:
+	ATCBatch();
+	~ATCBatch();
+
+	// ジョブを追加して、その番号を返す
+	size_t submit(const ATCBatchJob& job);
+	// 追加したジョブがすべて終わるまで待つ
+	void wait();
+	// ジョブの結果。待っているか実行中のジョブは ATC_ERR_PENDING
+	ATCResult result(size_t id) const;
+
+public:
+	int thread_count() const;
+	bool small_first() const;
+
+	void set_thread_count(int thread_count);
+	void set_small_first(bool small_first);
+
+private:
+	std::shared_ptr<ATCBatch_impl> impl_;
+
+};
@@ -0,0 +1,486 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCBatch_impl.h"
+#include "ATCMemoryBuffer.h"
+
+#include <algorithm>
+
+
+namespace {
+	// ヒープの比較。優先度が高いもの、小さいもの、先に追加したものから実行する
+	bool runsLater(const shared_ptr<ATCBatchTask>& a, const shared_ptr<ATCBatchTask>& b)
+	{
+		if (a->job.priority != b->job.priority)
+		{
+			return a->job.priority < b->job.priority;
+		}
+		if (a->size != b->size)
+		{
+			return a->size > b->size;
+		}
+		return a->id > b->id;
+	}
+}
+
+ATCBatch_impl::ATCBatch_impl() :
+
+thread_count_(1),
+small_first_(true),
+
+threaded_(false),
+next_worker_(0),
+unfinished_(0)
+
+#ifdef ATC_USE_THREADS
+,
+queued_(0),
+stopping_(false)
+#endif
+
+{
+	set_thread_count(0);
+}
+
+ATCBatch_impl::~ATCBatch_impl()
+{
+#ifdef ATC_USE_THREADS
+	// 残っているジョブを実行し終えてから止まる
+	{
+		lock_guard<mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	work_cond_.notify_all();
+
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		if (workers_[i]->worker_thread.joinable())
+		{
+			workers_[i]->worker_thread.join();
+		}
+	}
+#endif
+}
+
+size_t ATCBatch_impl::submit(const ATCBatchJob& job)
+{
+	shared_ptr<ATCBatchTask> task = make_shared<ATCBatchTask>();
+	task->job = job;
+	task->size = small_first_ ? jobSize(job) : 0;
+
+#ifdef ATC_USE_THREADS
+	size_t index;
+	{
+		// コールバックの中から次のジョブを追加することもある
+		lock_guard<mutex> lock(mutex_);
+
+		if (workers_.empty())
+		{
+			threaded_ = startWorkers();
+		}
+
+		task->id = results_.size();
+		results_.push_back(ATC_ERR_PENDING);
+		++unfinished_;
+
+		// ワーカーに順に配り、偏った分は暇なワーカーが盗む
+		index = next_worker_++ % workers_.size();
+	}
+
+	if (!threaded_)
+	{
+		// スレッドを作れない場合はこのスレッドで実行する
+		ATCResult result;
+		{
+			lock_guard<mutex> lock(workers_[0]->tasks_mutex);
+			result = runJob(workers_[0].get(), task->job);
+		}
+		finishTask(*task, result);
+		return task->id;
+	}
+
+	{
+		ATCBatchWorker& worker = *workers_[index];
+		lock_guard<mutex> lock(worker.tasks_mutex);
+		worker.tasks.push_back(task);
+		push_heap(worker.tasks.begin(), worker.tasks.end(), runsLater);
+	}
+	{
+		lock_guard<mutex> lock(mutex_);
+		++queued_;
+	}
+	work_cond_.notify_one();
+#else
+	// C++/CLI ではこのスレッドで実行する
+	if (workers_.empty())
+	{
+		workers_.push_back(make_shared<ATCBatchWorker>());
+	}
+
+	task->id = results_.size();
+	results_.push_back(ATC_ERR_PENDING);
+	++unfinished_;
+
+	finishTask(*task, runJob(workers_[0].get(), task->job));
+#endif
+
+	return task->id;
+}
+
+void ATCBatch_impl::wait()
+{
+#ifdef ATC_USE_THREADS
+	unique_lock<mutex> lock(mutex_);
+	while (unfinished_ > 0)
+	{
+		done_cond_.wait(lock);
+	}
+#endif
+}
+
+ATCResult ATCBatch_impl::result(size_t id) const
+{
+#ifdef ATC_USE_THREADS
+	lock_guard<mutex> lock(mutex_);
+#endif
+	if (id < results_.size())
+	{
+		return results_[id];
+	} else {
+		return ATC_ERR_INVARID_INDEX;
+	}
+}
+
+// mutex_ を取った状態で呼ぶ。一つでもスレッドを作れれば true
+bool ATCBatch_impl::startWorkers()
+{
+	workers_.resize(static_cast<size_t>(thread_count_));
+
+	bool started = false;
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		workers_[i] = make_shared<ATCBatchWorker>();
+	}
+
+#ifdef ATC_USE_THREADS
+	for (size_t i = 0; i < workers_.size(); ++i)
+	{
+		try
+		{
+			workers_[i]->worker_thread = thread(&ATCBatch_impl::runWorker, this, i);
+			started = true;
+		}
+		catch (...)
+		{
+			// このワーカーに配ったジョブは他のワーカーが盗む
+		}
+	}
+#endif
+
+	return started;
+}
+
+void ATCBatch_impl::runWorker(size_t index)
+{
+#ifdef ATC_USE_THREADS
+	ATCBatchWorker& worker = *workers_[index];
+
+	while (1)
+	{
+		shared_ptr<ATCBatchTask> task;
+		if (popTask(index, &task))
+		{
+			finishTask(*task, runJob(&worker, task->job));
+			continue;
+		}
+
+		unique_lock<mutex> lock(mutex_);
+		if (queued_ == 0)
+		{
+			if (stopping_)
+			{
+				break;
+			}
+			work_cond_.wait(lock);
+		}
+	}
+#endif
+}
+
+// 自分のキューから取り、空なら他のワーカーのキューから盗む
+bool ATCBatch_impl::popTask(size_t index, shared_ptr<ATCBatchTask> *task)
+{
+#ifdef ATC_USE_THREADS
+	for (size_t n = 0; n < workers_.size(); ++n)
+	{
+		ATCBatchWorker& victim = *workers_[(index + n) % workers_.size()];
+		lock_guard<mutex> lock(victim.tasks_mutex);
+
+		if (!victim.tasks.empty())
+		{
+			pop_heap(victim.tasks.begin(), victim.tasks.end(), runsLater);
+			*task = victim.tasks.back();
+			victim.tasks.pop_back();
+			--queued_;
+			return true;
+		}
+	}
+#endif
+	return false;
+}
+
+void ATCBatch_impl::finishTask(const ATCBatchTask& task, ATCResult result)
+{
+	// コールバックの中から result() で読めるように、先に記録する
+	{
+#ifdef ATC_USE_THREADS
+		lock_guard<mutex> lock(mutex_);
+#endif
+		results_[task.id] = result;
+	}
+
+	if (task.job.callback)
+	{
+		task.job.callback(result);
+	}
+
+#ifdef ATC_USE_THREADS
+	lock_guard<mutex> lock(mutex_);
+#endif
+	if (--unfinished_ == 0)
+	{
+#ifdef ATC_USE_THREADS
+		done_cond_.notify_all();
+#endif
+	}
+}
+
+ATCResult ATCBatch_impl::runJob(ATCBatchWorker *worker, const ATCBatchJob& job)
+{
+	switch (job.type)
+	{
+	case ATC_BATCH_LOCK:
+		return lock(worker, job);
+	case ATC_BATCH_UNLOCK:
+		return unlock(worker, job);
+	default:
+		return ATC_ERR_INVARID_INDEX;
+	}
+}
+
+ATCResult ATCBatch_impl::lock(ATCBatchWorker *worker, const ATCBatchJob& job)
+{
+	const vector<ATCFileEntry>& entries = job.entries;
+	const bool from_buffers = job.src_paths.empty();
+
+	if ((from_buffers ? job.src_buffers.size() : job.src_paths.size()) != entries.size())
+	{
+		return ATC_ERR_INVARID_FILE_ENTRY;
+	}
+
+	ATCLocker& locker = worker->locker;
+	locker.set_compression_level(job.compression_level);
+
+	// メモリからメモリへは一度に
+	if (job.dst_buffer && from_buffers)
+	{
+		return locker.lockToBuffer(job.dst_buffer, job.key, entries, entries.empty() ? nullptr : &job.src_buffers[0]);
+	}
+
+	ofstream file;
+	ATCStringBuffer buffer(job.dst_buffer);
+	ostream memory(&buffer);
+	ostream *dst = &memory;
+
+	if (job.dst_buffer)
+	{
+		job.dst_buffer->clear();
+	} else {
+		file.open(job.dst_path.c_str(), ios::binary);
+		if (!file)
+		{
+			return ATC_ERR_OSTREAM_FAILURE;
+		}
+		dst = &file;
+	}
+
+	ATCResult result = locker.open(dst, job.key);
+	for (size_t i = 0; i < entries.size() && result == ATC_OK; ++i)
+	{
+		result = locker.addFileEntry(entries[i]);
+	}
+	if (result == ATC_OK)
+	{
+		result = locker.writeEncryptedHeader(dst);
+	}
+
+	for (size_t i = 0; i < entries.size() && result == ATC_OK; ++i)
+	{
+		// ディレクトリは -1
+		if (entries[i].size <= 0)
+		{
+			continue;
+		}
+		const size_t length = static_cast<size_t>(entries[i].size);
+
+		if (from_buffers)
+		{
+			ATCInputBuffer input(job.src_buffers[i], length);
+			istream src(&input);
+			result = locker.writeFileData(dst, &src, length);
+		} else {
+			ifstream src(job.src_paths[i].c_str(), ios::binary);
+			result = src ? locker.writeFileData(dst, &src, length) : ATC_ERR_ISTREAM_FAILURE;
+		}
+	}
+
+	// 途中で失敗しても z_stream は次のジョブのために閉じておく
+	const ATCResult close_result = locker.close();
+	if (result == ATC_OK)
+	{
+		result = close_result;
+	}
+	if (result == ATC_OK && !dst->good())
+	{
+		result = ATC_ERR_OSTREAM_FAILURE;
+	}
+
+	return result;
+}
+
+ATCResult ATCBatch_impl::unlock(ATCBatchWorker *worker, const ATCBatchJob& job)
+{
+	ATCUnlocker& unlocker = worker->unlocker;
+
+	ifstream file;
+	istream *src = nullptr;
+	ATCResult result;
+
+	if (job.src_buffer)
+	{
+		result = unlocker.openBuffer(job.src_buffer, job.src_length, job.key);
+	} else {
+		file.open(job.src_path.c_str(), ios::binary);
+		if (!file)
+		{
+			return ATC_ERR_ISTREAM_FAILURE;
+		}
+		src = &file;
+		result = unlocker.open(src, job.key);
+	}
+
+	if (job.dst_entries)
+	{
+		job.dst_entries->clear();
+	}
+	if (job.dst_buffers)
+	{
+		job.dst_buffers->clear();
+	}
+
+	for (size_t i = 0; i < unlocker.getEntryLength() && result == ATC_OK; ++i)
+	{
+		ATCFileEntry entry;
+		unlocker.getEntry(&entry, i);
+
+		if (job.dst_entries)
+		{
+			job.dst_entries->push_back(entry);
+		}
+
+		if (job.dst_buffers)
+		{
+			job.dst_buffers->push_back(string());
+
+			if (entry.size > 0)
+			{
+				string& data = job.dst_buffers->back();
+				data.resize(static_cast<size_t>(entry.size));
+				result = unlocker.extractFileData(&data[0], src, data.size());
+			}
+		}
+	}
+
+	unlocker.close();
+	return result;
+}
+
+// 入力の大きさ
+int64_t ATCBatch_impl::jobSize(const ATCBatchJob& job)
+{
+	if (job.type == ATC_BATCH_UNLOCK)
+	{
+		if (job.src_buffer)
+		{
+			return static_cast<int64_t>(job.src_length);
+		}
+
+		ifstream file(job.src_path.c_str(), ios::binary | ios::ate);
+		return file ? static_cast<int64_t>(file.tellg()) : 0;
+	}
+
+	int64_t size = 0;
+	for (size_t i = 0; i < job.entries.size(); ++i)
+	{
+		if (job.entries[i].size > 0)
+		{
+			size += job.entries[i].size;
+		}
+	}
+	return size;
+}
+
+int ATCBatch_impl::thread_count() const
+{
+	return thread_count_;
+}
+
+bool ATCBatch_impl::small_first() const
+{
+	return small_first_;
+}
+
+void ATCBatch_impl::set_thread_count(int thread_count)
+{
+	// 最初の submit より前に設定する。0 以下ならプロセッサの数
+	if (thread_count <= 0)
+	{
+#ifdef ATC_USE_THREADS
+		thread_count = static_cast<int>(thread::hardware_concurrency());
+#endif
+		if (thread_count <= 0)
+		{
+			thread_count = 1;
+		}
+	}
+
+	thread_count_ = thread_count;
+}
+
+void ATCBatch_impl::set_small_first(bool small_first)
+{
+	// 同じ優先度のジョブを入力の小さいものから実行して、待ち時間の裾を短くする
+	small_first_ = small_first;
+}
@@ -0,0 +1,112 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "ATCCommon.h"
+#include "ATCBatch.h"
+#include "ATCLocker.h"
+#include "ATCUnlocker.h"
+
+#ifdef ATC_USE_THREADS
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// 実行を待っているジョブ
+struct ATCBatchTask {
+
+	size_t id;
+	int64_t size;		// 入力の大きさ（小さいものから実行する場合）
+	ATCBatchJob job;
+
+};
+
+// ワーカーごとのジョブのキューと、ジョブの間で使い回すロッカーとアンロッカー
+// z_stream やバッファはロッカーとアンロッカーの中で使い回される
+struct ATCBatchWorker {
+
+	vector<shared_ptr<ATCBatchTask> > tasks;	// 優先度のヒープ
+	ATCLocker locker;
+	ATCUnlocker unlocker;
+
+#ifdef ATC_USE_THREADS
+	mutex tasks_mutex;
+	thread worker_thread;
+#endif
+
+};
+
+class ATCBatch_impl
+{
+public:
+	ATCBatch_impl();
+	~ATCBatch_impl();
+
+	size_t submit(const ATCBatchJob& job);
+	void wait();
+	ATCResult result(size_t id) const;
+
+public:
+	int thread_count() const;
+	bool small_first() const;
+
+	void set_thread_count(int thread_count);
+	void set_small_first(bool small_first);
+
+private:
+	bool startWorkers();
+	void runWorker(size_t index);
+	bool popTask(size_t index, shared_ptr<ATCBatchTask> *task);
+	void finishTask(const ATCBatchTask& task, ATCResult result);
+	static ATCResult runJob(ATCBatchWorker *worker, const ATCBatchJob& job);
+	static ATCResult lock(ATCBatchWorker *worker, const ATCBatchJob& job);
+	static ATCResult unlock(ATCBatchWorker *worker, const ATCBatchJob& job);
+	static int64_t jobSize(const ATCBatchJob& job);
+
+private:
+	int thread_count_;
+	bool small_first_;
+
+	vector<shared_ptr<ATCBatchWorker> > workers_;
+	bool threaded_;		// ワーカーのスレッドが一つでも動いている
+	size_t next_worker_;
+
+	vector<ATCResult> results_;
+	size_t unfinished_;
+
+#ifdef ATC_USE_THREADS
+	mutable mutex mutex_;
+	condition_variable work_cond_;
+	condition_variable done_cond_;
+	atomic<size_t> queued_;
+	bool stopping_;
+#endif
+};
@@ -0,0 +1,148 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCChunkQueue.h"
+
+#ifdef ATC_USE_THREADS
+
+using namespace std;
+
+ATCChunkQueue::ATCChunkQueue(size_t depth, size_t chunk_size) :
+chunks_(depth > 0 ? depth : 1),
+head_(0),
+tail_(0),
+closed_(false),
+cancelled_(false),
+waiting_(0)
+{
+	for (size_t i = 0; i < chunks_.size(); ++i)
+	{
+		chunks_[i].data.resize(chunk_size);
+		chunks_[i].length = 0;
+	}
+}
+
+size_t ATCChunkQueue::chunk_size() const
+{
+	return chunks_[0].data.size();
+}
+
+ATCChunkQueue::Chunk *ATCChunkQueue::acquire()
+{
+	const size_t tail = tail_.load();
+	wait([&]() { return tail - head_.load() < chunks_.size() || cancelled_.load(); });
+
+	if (cancelled_.load())
+	{
+		return nullptr;
+	}
+	return &chunks_[tail % chunks_.size()];
+}
+
+void ATCChunkQueue::commit()
+{
+	tail_.store(tail_.load() + 1);
+	wake();
+}
+
+void ATCChunkQueue::close()
+{
+	closed_.store(true);
+	wake();
+}
+
+ATCChunkQueue::Chunk *ATCChunkQueue::front()
+{
+	const size_t head = head_.load();
+	wait([&]() { return tail_.load() != head || closed_.load() || cancelled_.load(); });
+
+	// close の前に commit したチャンクは残っていれば読む
+	if (cancelled_.load() || tail_.load() == head)
+	{
+		return nullptr;
+	}
+	return &chunks_[head % chunks_.size()];
+}
+
+void ATCChunkQueue::release()
+{
+	head_.store(head_.load() + 1);
+	wake();
+}
+
+bool ATCChunkQueue::empty() const
+{
+	return tail_.load() == head_.load();
+}
+
+void ATCChunkQueue::cancel()
+{
+	cancelled_.store(true);
+	wake();
+}
+
+void ATCChunkQueue::resume()
+{
+	closed_.store(false);
+	cancelled_.store(false);
+}
+
+void ATCChunkQueue::reset()
+{
+	head_.store(0);
+	tail_.store(0);
+	closed_.store(false);
+	cancelled_.store(false);
+}
+
+// 待つ側は waiting_ を増やしてから条件を見て、起こす側は位置を更新してから waiting_ を見る
+// どちらも seq_cst なので、少なくとも片方がもう片方の更新に気づく
+template <class Ready>
+void ATCChunkQueue::wait(Ready ready)
+{
+	if (ready())
+	{
+		return;
+	}
+
+	unique_lock<mutex> lock(mutex_);
+	waiting_.fetch_add(1);
+	while (!ready())
+	{
+		cond_.wait(lock);
+	}
+	waiting_.fetch_sub(1);
+}
+
+void ATCChunkQueue::wake()
+{
+	if (waiting_.load() != 0)
+	{
+		lock_guard<mutex> lock(mutex_);
+		cond_.notify_all();
+	}
+}
+
+#endif
@@ -0,0 +1,89 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include "ATCCommon.h"
+
+#ifdef ATC_USE_THREADS
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+// 一つのスレッドが書き込み、別の一つのスレッドが読み出す、チャンクのリング
+// チャンクは確保したまま使い回す。受け渡しは atomic の位置だけで行い、
+// 空か満杯で待つときだけミューテックスを使う
+class ATCChunkQueue
+{
+public:
+	struct Chunk
+	{
+		std::vector<char> data;
+		size_t length;
+	};
+
+	ATCChunkQueue(size_t depth, size_t chunk_size);
+
+	size_t chunk_size() const;
+
+	// 書き込む側。空いたチャンクを待って返す（中止されたら nullptr）
+	Chunk *acquire();
+	void commit();
+	// これ以上書き込まない
+	void close();
+
+	// 読み出す側。書き込まれたチャンクを待って返す（閉じられて空か、中止されたら nullptr）
+	Chunk *front();
+	void release();
+	bool empty() const;
+
+	// どちらの側からでも呼べる。待っている相手を起こす
+	void cancel();
+
+	// 書き込む側のスレッドが終わった後で、書き込まれたチャンクを残したまま閉じる前の状態に戻す
+	void resume();
+
+	// どちらのスレッドも使っていないときに、空の状態に戻す
+	void reset();
+
+private:
+	template <class Ready>
+	void wait(Ready ready);
+	void wake();
+
+	std::vector<Chunk> chunks_;
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+	std::atomic<bool> closed_;
+	std::atomic<bool> cancelled_;
+
+	std::atomic<int> waiting_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+};
+
+#endif
@@ -27,11 +27,17 @@ freely, subject to the following restrictions:
 
 #include <string>
 #include <cstdint>
+#include <functional>
 
 #include "ATCCommon.h"
 
 using namespace std;
 
+// std::thread is not available to C++/CLI, the work is done on the calling thread there
+#ifndef USE_CLI
+#define ATC_USE_THREADS
+#endif
+
 enum {
 
 	ATC_DATA_FILE_VERSION			= 105,
@@ -40,6 +46,25 @@ enum {
 	ATC_KEY_SIZE					= 32,
 	ATC_BUF_SIZE					= 32,
 	ATC_LARGE_BUF_SIZE				= 1024,
+	ATC_CHUNK_SIZE					= 64 * 1024,
+	ATC_PARALLEL_RANGE_SIZE			= 1024 * 1024,
+	ATC_LOCK_CHUNK_SIZE				= 256 * 1024,
+	ATC_DEFLATE_BLOCK_SIZE			= 128 * 1024,
+	ATC_DEFLATE_WINDOW_SIZE			= 32 * 1024,
+	ATC_COMPRESSION_SAMPLE_SIZE		= 16 * 1024,
+	ATC_COMPRESSION_MIN_SAMPLE_SIZE	= 512,
+	ATC_STORED_BLOCK_SIZE			= 65535,
+	ATC_SMALL_ARCHIVE_SIZE			= 64 * 1024,
+	ATC_PIPELINE_DEPTH				= 4,
+	ATC_LEGACY_KEY_CACHE_SIZE		= 8,
+	ATC_INDEX_SPAN					= 1024 * 1024,
+	ATC_INDEX_VERSION				= 1,
+	ATC_DIRECTORY_THREADS			= 8,
+	ATC_READAHEAD_FILES				= 16,
+	ATC_READAHEAD_SIZE				= 16 * 1024 * 1024,
+	ATC_WRITER_THREADS				= 4,
+	ATC_WRITER_CHUNK_SIZE			= 256 * 1024,
+	ATC_WRITER_QUEUE_SIZE			= 32 * 1024 * 1024,
 	ATC_LINE_BUF_SIZE				= 2048,
 
 	ATC_DEFAULT_PASSWORD_TRY_LIMIT	= 3,
@@ -67,7 +92,58 @@ enum ATCResult {
 	ATC_ERR_NO_PLAIN_HEADER,
 	ATC_ERR_INVARID_INDEX,
 
-	ATC_ERR_ZLIB_ERROR
+	ATC_ERR_ZLIB_ERROR,
+	ATC_ERR_WRONG_KEY_USAGE,
+	ATC_ERR_SINK_ABORTED,
+	ATC_ERR_BROKEN_INDEX,
+	ATC_ERR_ISTREAM_FAILURE,
+	ATC_ERR_PENDING
+
+};
+
+enum ATCKeyUsage {
+
+	ATC_KEY_ENCRYPTION,		// ATCLocker
+	ATC_KEY_DECRYPTION		// ATCUnlocker
+
+};
+
+enum ATCBatchJobType {
+
+	ATC_BATCH_LOCK,			// ATCLocker
+	ATC_BATCH_UNLOCK		// ATCUnlocker
+
+};
+
+// 展開したデータを受け取る関数。data は次の呼び出しまで有効で、false を返すと展開を中止する
+typedef function<bool (const char *data, size_t length)> ATCDataSink;
+
+// 適応圧縮でエントリごとに選んだ圧縮レベル
+struct ATCCompressionDecision {
+
+	int64_t size;		// エントリの大きさ
+	double  entropy;	// 先頭のサンプルのエントロピー（ビット/バイト）
+	int32_t level;
+	int32_t strategy;
+
+};
+
+// ATCLocker::lockDirectory のオプション
+struct ATCDirectoryOptions {
+
+	ATCDirectoryOptions() :
+		include_root(true),
+		include_hidden(true),
+		follow_symlinks(false),
+		stat_threads(ATC_DIRECTORY_THREADS),
+		readahead_files(ATC_READAHEAD_FILES)
+	{}
+
+	bool include_root;		// root 自身をディレクトリのエントリにする
+	bool include_hidden;	// . で始まる名前も含める
+	bool follow_symlinks;	// シンボリックリンクの先を含める（含めない場合は飛ばす）
+	int  stat_threads;		// stat を並列に行うスレッドの数
+	int  readahead_files;	// 圧縮している間に先読みしておくファイルの数
 
 };
 
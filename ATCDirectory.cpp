@@ -0,0 +1,600 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCDirectory.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <set>
+
+#ifdef WIN32
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ATCParallel.h"
+
+using namespace std;
+
+namespace {
+	const int32_t attribute_readonly = 0x01;
+	const int32_t attribute_hidden = 0x02;
+	const int32_t attribute_directory = 0x10;
+
+	// 1 スレッドあたりの最小の仕事の数。これより少ないとスレッドを作る方が遅い
+	const size_t min_items_per_thread = 64;
+
+	// ディレクトリを区別する (st_dev, st_ino)。WIN32 では使わない
+	typedef pair<uint64_t, uint64_t> FileIdentity;
+
+	struct ListedItem
+	{
+		string name;
+		ATCFileEntry entry;
+		FileIdentity identity;
+		bool valid;
+		size_t child;	// ディレクトリの場合の ListedDirectory の番号
+	};
+
+	struct ListedDirectory
+	{
+		string path;	// ファイルシステム上のパス
+		string prefix;	// アーカイブの中での名前の前に付ける部分（\ で終わる）
+		vector<ListedItem> items;
+	};
+
+	bool compareItems(const ListedItem& a, const ListedItem& b)
+	{
+		return a.name < b.name;
+	}
+
+	size_t countThreads(const ATCDirectoryOptions& options, size_t count)
+	{
+		size_t threads = (count + min_items_per_thread - 1) / min_items_per_thread;
+		threads = min(threads, static_cast<size_t>(max(options.stat_threads, 1)));
+		return max(threads, static_cast<size_t>(1));
+	}
+
+	void setName(ATCFileEntry *entry, const string& name)
+	{
+#ifdef WIN32
+		// _findfirst の名前は ANSI コードページ（日本語版なら Shift_JIS）
+		entry->name_sjis = name;
+		entry->name_utf8.clear();
+
+		int length = MultiByteToWideChar(CP_ACP, 0, name.c_str(), -1, NULL, 0);
+		if (length > 0)
+		{
+			vector<wchar_t> wide(length);
+			MultiByteToWideChar(CP_ACP, 0, name.c_str(), -1, &wide[0], length);
+			length = WideCharToMultiByte(CP_UTF8, 0, &wide[0], -1, NULL, 0, NULL, NULL);
+			if (length > 0)
+			{
+				vector<char> utf8(length);
+				WideCharToMultiByte(CP_UTF8, 0, &wide[0], -1, &utf8[0], length, NULL, NULL);
+				entry->name_utf8 = &utf8[0];
+			}
+		}
+#else
+		// POSIX のファイル名はそのまま両方に入れる
+		entry->name_sjis = name;
+		entry->name_utf8 = name;
+#endif
+	}
+
+	bool isHidden(const string& name)
+	{
+		return !name.empty() && name[0] == '.';
+	}
+
+#ifdef WIN32
+	// _findfirst は属性と時刻も返すので、名前の一覧と同時に埋める
+	void readNames(ListedDirectory *directory, const ATCDirectoryOptions& options)
+	{
+		_finddata64_t data;
+		intptr_t handle = _findfirst64((directory->path + "/*").c_str(), &data);
+		if (handle == -1)
+		{
+			return;
+		}
+
+		do
+		{
+			ListedItem item;
+			item.name = data.name;
+			if (item.name == "." || item.name == "..")
+			{
+				continue;
+			}
+			if (!options.include_hidden && ((data.attrib & _A_HIDDEN) || isHidden(item.name)))
+			{
+				continue;
+			}
+
+			item.valid = true;
+			item.child = 0;
+			item.entry.attribute = static_cast<int32_t>(data.attrib);
+			item.entry.size = (data.attrib & _A_SUBDIR) ? -1 : data.size;
+			item.entry.change_unix_time = static_cast<time_t>(data.time_write);
+			item.entry.create_unix_time = static_cast<time_t>(data.time_create);
+			directory->items.push_back(item);
+		}
+		while (_findnext64(handle, &data) == 0);
+
+		_findclose(handle);
+	}
+
+	void statItem(const string&, ListedItem *, const ATCDirectoryOptions&)
+	{
+	}
+
+	bool statRoot(const string& path, ATCFileEntry *entry, FileIdentity *)
+	{
+		struct __stat64 st;
+		if (_stat64(path.c_str(), &st) != 0)
+		{
+			return false;
+		}
+
+		bool directory = (st.st_mode & _S_IFDIR) != 0;
+		entry->attribute = directory ? attribute_directory : 0;
+		entry->size = directory ? -1 : st.st_size;
+		entry->change_unix_time = static_cast<time_t>(st.st_mtime);
+		entry->create_unix_time = static_cast<time_t>(st.st_ctime);
+		return true;
+	}
+#else
+	// readdir は名前だけを読み、stat は statItem でまとめて並列に行う
+	void readNames(ListedDirectory *directory, const ATCDirectoryOptions& options)
+	{
+		DIR *dir = opendir(directory->path.c_str());
+		if (!dir)
+		{
+			return;
+		}
+
+		while (dirent *ent = readdir(dir))
+		{
+			ListedItem item;
+			item.name = ent->d_name;
+			if (item.name == "." || item.name == "..")
+			{
+				continue;
+			}
+			if (!options.include_hidden && isHidden(item.name))
+			{
+				continue;
+			}
+
+			item.valid = false;
+			item.child = 0;
+			directory->items.push_back(item);
+		}
+
+		closedir(dir);
+	}
+
+	bool fillEntry(const struct stat& st, const string& name, ATCFileEntry *entry)
+	{
+		if (S_ISDIR(st.st_mode))
+		{
+			entry->attribute = attribute_directory;
+			entry->size = -1;
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			entry->attribute = 0;
+			entry->size = st.st_size;
+		}
+		else
+		{
+			// デバイスやソケットなどは入れない
+			return false;
+		}
+
+		if (!(st.st_mode & S_IWUSR))
+		{
+			entry->attribute |= attribute_readonly;
+		}
+		if (isHidden(name))
+		{
+			entry->attribute |= attribute_hidden;
+		}
+
+		entry->change_unix_time = st.st_mtime;
+#ifdef __APPLE__
+		entry->create_unix_time = st.st_birthtime;
+#else
+		// st_ctime は作成時刻ではないので、更新時刻を入れておく
+		entry->create_unix_time = st.st_mtime;
+#endif
+		return true;
+	}
+
+	void statItem(const string& directory, ListedItem *item, const ATCDirectoryOptions& options)
+	{
+		const string path = directory + "/" + item->name;
+		struct stat st;
+
+		int status = options.follow_symlinks ? stat(path.c_str(), &st) : lstat(path.c_str(), &st);
+		item->valid = status == 0 && fillEntry(st, item->name, &item->entry);
+		if (item->valid)
+		{
+			item->identity = FileIdentity(st.st_dev, st.st_ino);
+		}
+	}
+
+	bool statRoot(const string& path, ATCFileEntry *entry, FileIdentity *identity)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0 || !fillEntry(st, "", entry))
+		{
+			return false;
+		}
+
+		*identity = FileIdentity(st.st_dev, st.st_ino);
+		return true;
+	}
+#endif
+
+	// 区切り文字を除いた、パスの最後の名前
+	string baseName(const string& path)
+	{
+		size_t end = path.find_last_not_of("/\\");
+		if (end == string::npos)
+		{
+			return "";
+		}
+
+		size_t begin = path.find_last_of("/\\", end);
+		begin = (begin == string::npos) ? 0 : begin + 1;
+
+		string name = path.substr(begin, end + 1 - begin);
+		return (name == "." || name == "..") ? "" : name;
+	}
+
+	void appendItems(const vector<ListedDirectory>& directories, size_t index,
+		vector<ATCFileEntry> *entries, vector<string> *paths)
+	{
+		const ListedDirectory& directory = directories[index];
+
+		for (size_t i = 0; i < directory.items.size(); ++i)
+		{
+			const ListedItem& item = directory.items[i];
+			const bool is_directory = item.entry.size < 0;
+
+			entries->push_back(item.entry);
+			setName(&entries->back(), directory.prefix + item.name + (is_directory ? "\\" : ""));
+			paths->push_back(directory.path + "/" + item.name);
+
+			if (is_directory)
+			{
+				appendItems(directories, item.child, entries, paths);
+			}
+		}
+	}
+}
+
+// ディレクトリを深さごとに読み、同じ深さの stat はすべてまとめて並列に行う
+bool listDirectory(const string& root, const ATCDirectoryOptions& options,
+	vector<ATCFileEntry> *entries, vector<string> *paths)
+{
+	entries->clear();
+	paths->clear();
+
+	ATCFileEntry root_entry;
+	FileIdentity root_identity;
+	if (!statRoot(root, &root_entry, &root_identity))
+	{
+		return false;
+	}
+
+	const string root_name = baseName(root);
+
+	if (root_entry.size >= 0)
+	{
+		setName(&root_entry, root_name);
+		entries->push_back(root_entry);
+		paths->push_back(root);
+		return true;
+	}
+
+	vector<ListedDirectory> directories(1);
+	directories[0].path = root;
+
+	// シンボリックリンクをたどる場合に、同じディレクトリを二度読まない（循環を防ぐ）
+	set<FileIdentity> visited;
+	visited.insert(root_identity);
+
+	if (options.include_root && !root_name.empty())
+	{
+		directories[0].prefix = root_name + "\\";
+		setName(&root_entry, directories[0].prefix);
+		entries->push_back(root_entry);
+		paths->push_back(root);
+	}
+
+	for (size_t begin = 0; begin < directories.size(); )
+	{
+		const size_t end = directories.size();
+
+		const size_t read_threads = countThreads(options, (end - begin) * min_items_per_thread);
+		runParallel(read_threads, [&](size_t thread) {
+			for (size_t i = begin + thread; i < end; i += read_threads)
+			{
+				readNames(&directories[i], options);
+			}
+		});
+
+		vector<pair<size_t, size_t> > work;
+		for (size_t i = begin; i < end; ++i)
+		{
+			for (size_t j = 0; j < directories[i].items.size(); ++j)
+			{
+				work.push_back(make_pair(i, j));
+			}
+		}
+
+		const size_t stat_threads = countThreads(options, work.size());
+		runParallel(stat_threads, [&](size_t thread) {
+			for (size_t k = thread; k < work.size(); k += stat_threads)
+			{
+				ListedDirectory& directory = directories[work[k].first];
+				statItem(directory.path, &directory.items[work[k].second], options);
+			}
+		});
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			vector<ListedItem>& items = directories[i].items;
+			sort(items.begin(), items.end(), compareItems);
+
+			vector<ListedItem> valid_items;
+			valid_items.reserve(items.size());
+
+			for (size_t j = 0; j < items.size(); ++j)
+			{
+				if (!items[j].valid)
+				{
+					continue;
+				}
+#ifndef WIN32
+				if (items[j].entry.size < 0 && !visited.insert(items[j].identity).second)
+				{
+					continue;
+				}
+#endif
+				valid_items.push_back(items[j]);
+			}
+			items.swap(valid_items);
+
+			for (size_t j = 0; j < directories[i].items.size(); ++j)
+			{
+				if (directories[i].items[j].entry.size < 0)
+				{
+					ListedDirectory child;
+					child.path = directories[i].path + "/" + directories[i].items[j].name;
+					child.prefix = directories[i].prefix + directories[i].items[j].name + "\\";
+
+					directories[i].items[j].child = directories.size();
+					directories.push_back(child);
+				}
+			}
+		}
+
+		begin = end;
+	}
+
+	appendItems(directories, 0, entries, paths);
+	return true;
+}
+
+void prefetchFile(const string& path)
+{
+#if !defined(WIN32) && defined(POSIX_FADV_WILLNEED)
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return;
+	}
+
+	// 読み込みを始めさせるだけで、完了は待たない
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	::close(fd);
+#else
+	(void)path;
+#endif
+}
+
+namespace {
+#ifdef WIN32
+	const char native_separator = '\\';
+	const char* const native_separators = "\\/";
+#else
+	const char native_separator = '/';
+	const char* const native_separators = "/";
+#endif
+
+	// pos のバイトが 2 バイト文字の 1 バイト目か
+	// sjis なら Shift_JIS、そうでなければネイティブのパス（WIN32 では ANSI コードページ）として調べる
+	bool isLeadByte(const string& name, size_t pos, bool sjis)
+	{
+		const unsigned char c = static_cast<unsigned char>(name[pos]);
+		if (sjis)
+		{
+			return (c >= 0x81 && c <= 0x9F) || (c >= 0xE0 && c <= 0xFC);
+		}
+#ifdef WIN32
+		return IsDBCSLeadByte(c) != 0;
+#else
+		return false;
+#endif
+	}
+
+	// begin から後の最初の区切り文字の位置。2 バイト文字の 2 バイト目（表 = 95 5C など）は区切らない
+	size_t findSeparator(const string& name, size_t begin, const char *separators, bool sjis)
+	{
+		for (size_t i = begin; i < name.size(); ++i)
+		{
+			if (isLeadByte(name, i, sjis))
+			{
+				++i;
+			}
+			else if (strchr(separators, name[i]))
+			{
+				return i;
+			}
+		}
+		return string::npos;
+	}
+}
+
+bool nativePath(const string& root, const string& name, bool sjis, string *path, string *parent)
+{
+	string relative;
+	string parent_relative;
+	size_t begin = 0;
+
+	// 先頭が区切り文字なら絶対パス
+	if (name.empty() || name[0] == '\\' || name[0] == '/')
+	{
+		return false;
+	}
+
+	while (begin <= name.size())
+	{
+		size_t end = findSeparator(name, begin, "\\/", sjis);
+		if (end == string::npos)
+		{
+			end = name.size();
+		}
+
+		const string component = name.substr(begin, end - begin);
+		begin = end + 1;
+
+		if (component.empty() || component == ".")
+		{
+			continue;
+		}
+		if (component == "..")
+		{
+			return false;
+		}
+#ifdef WIN32
+		// ドライブ名と代替データストリーム
+		if (component.find(':') != string::npos)
+		{
+			return false;
+		}
+#endif
+
+		parent_relative = relative;
+		if (!relative.empty())
+		{
+			relative += native_separator;
+		}
+		relative += component;
+	}
+
+	if (relative.empty())
+	{
+		return false;
+	}
+
+	*path = root.empty() ? relative : root + native_separator + relative;
+	if (parent_relative.empty())
+	{
+		*parent = root;
+	} else {
+		*parent = root.empty() ? parent_relative : root + native_separator + parent_relative;
+	}
+	return true;
+}
+
+bool makeDirectories(const string& root, const string& path, set<string> *created)
+{
+	if (created->count(path))
+	{
+		return true;
+	}
+
+	// root 自身と、その下の区切り文字ごとに親を作る
+	size_t end = root.empty() ? findSeparator(path, 0, native_separators, false) : root.size();
+	while (true)
+	{
+		if (end == string::npos || end > path.size())
+		{
+			end = path.size();
+		}
+
+		const string directory = path.substr(0, end);
+		if (!directory.empty() && !created->count(directory))
+		{
+#ifdef WIN32
+			const int status = _mkdir(directory.c_str());
+#else
+			const int status = mkdir(directory.c_str(), 0777);
+#endif
+			if (status != 0 && errno != EEXIST)
+			{
+				return false;
+			}
+			created->insert(directory);
+		}
+
+		if (end >= path.size())
+		{
+			break;
+		}
+		end = findSeparator(path, end + 1, native_separators, false);
+	}
+
+	return true;
+}
+
+bool setChangeTime(const string& path, time_t change_time)
+{
+#ifdef WIN32
+	__utimbuf64 times;
+	times.actime = change_time;
+	times.modtime = change_time;
+	return _utime64(path.c_str(), &times) == 0;
+#else
+	timespec times[2];
+	times[0].tv_sec = times[1].tv_sec = change_time;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	return utimensat(AT_FDCWD, path.c_str(), times, 0) == 0;
+#endif
+}
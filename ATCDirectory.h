@@ -0,0 +1,54 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <ctime>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ATCCommon.h"
+
+using namespace std;
+
+// root 以下のファイルとディレクトリを、ディレクトリの直後にその中身が来る順に並べる
+// paths[i] は entries[i] のファイルシステム上のパス。root が無い場合は false を返す
+bool listDirectory(const string& root, const ATCDirectoryOptions& options,
+	vector<ATCFileEntry> *entries, vector<string> *paths);
+
+// これから読むファイルを OS に先読みさせる。対応していない環境では何もしない
+void prefetchFile(const string& path);
+
+// アーカイブの中の名前（\ 区切り）を root の下のパスにし、parent にはそれを置くディレクトリを返す
+// sjis なら name は Shift_JIS で、2 バイト目の 0x5C では区切らない
+// root の外を指す名前（.. や絶対パス）の場合は false を返す
+bool nativePath(const string& root, const string& name, bool sjis, string *path, string *parent);
+
+// root と、その下の path までのディレクトリを作る。作ったものは created に記録して二度は作らない
+bool makeDirectories(const string& root, const string& path, set<string> *created);
+
+// 更新時刻を設定する
+bool setChangeTime(const string& path, time_t change_time);
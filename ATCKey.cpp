@@ -0,0 +1,66 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCKey.h"
+
+#include <cstring>
+
+#include "RijndaelFixed.h"
+
+ATCKey::ATCKey() :
+
+usage_(ATC_KEY_DECRYPTION)
+
+{
+	memset(key_, 0, sizeof(key_));
+}
+
+ATCKey::ATCKey(const char key[ATC_KEY_SIZE], ATCKeyUsage usage) :
+
+usage_(usage)
+
+{
+	memcpy(key_, key, sizeof(key_));
+
+	std::shared_ptr<CRijndael256> rijndael = std::make_shared<CRijndael256>();
+	rijndael->MakeKey(key, (usage == ATC_KEY_ENCRYPTION) ?
+		CRijndael256::ENCRYPTION : CRijndael256::DECRYPTION);
+	rijndael_ = rijndael;
+}
+
+ATCKey::~ATCKey()
+{
+	memset(key_, 0, sizeof(key_));
+}
+
+bool ATCKey::empty() const
+{
+	return !rijndael_;
+}
+
+ATCKeyUsage ATCKey::usage() const
+{
+	return usage_;
+}
@@ -0,0 +1,56 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "ATCCommon.h"
+
+template <int KEY_SIZE, int BLOCK_SIZE> class CRijndaelFixed;
+
+// 展開済みの Rijndael キー
+// ロック用（暗号化）かアンロック用（復号）のどちらか一方向だけを展開する
+// 一度作れば変更されないので、複数の ATCLocker / ATCUnlocker から同時に使える
+class ATCKey
+{
+public:
+	ATCKey();
+	ATCKey(const char key[ATC_KEY_SIZE], ATCKeyUsage usage);
+	~ATCKey();
+
+	bool empty() const;
+	ATCKeyUsage usage() const;
+
+private:
+	friend class ATCLocker_impl;
+	friend class ATCUnlocker_impl;
+
+	// v1.x の書庫を開くときのためにキーの文字列も持っておく
+	char key_[ATC_KEY_SIZE];
+	ATCKeyUsage usage_;
+	std::shared_ptr<const CRijndaelFixed<ATC_KEY_SIZE, ATC_BUF_SIZE> > rijndael_;
+
+};
@@ -0,0 +1,122 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCLegacyKey.h"
+
+#include <cstring>
+#include <string>
+#include <list>
+#include <algorithm>
+
+#ifdef ATC_USE_THREADS
+#include <mutex>
+#endif
+
+#include "blowfish.h"
+
+#define PASS_FOOTER "_AttacheCase-M.Hibara"
+
+using namespace std;
+
+namespace {
+	list<ATCLegacyKey> cache;
+
+#ifdef ATC_USE_THREADS
+	mutex cache_mutex;
+#endif
+}
+
+ATCLegacyKey::ATCLegacyKey()
+{
+	memset(key_, 0, sizeof(key_));
+}
+
+ATCLegacyKey::ATCLegacyKey(const char key[ATC_KEY_SIZE])
+{
+	// 終端以降は 0 で埋めておく（キャッシュの比較用）
+	const char *str_end = find(&key[0], &key[ATC_KEY_SIZE - 1], '\0');
+	memset(key_, 0, sizeof(key_));
+	copy(&key[0], str_end, key_);
+
+	string key_str = string(&key[0], str_end) + PASS_FOOTER;
+
+	shared_ptr<Blowfish> blowfish = make_shared<Blowfish>();
+	blowfish->SetKey(key_str);
+	blowfish_ = blowfish;
+}
+
+ATCLegacyKey::~ATCLegacyKey()
+{
+	memset(key_, 0, sizeof(key_));
+}
+
+bool ATCLegacyKey::empty() const
+{
+	return !blowfish_;
+}
+
+ATCLegacyKey ATCLegacyKey::cached(const char key[ATC_KEY_SIZE])
+{
+	ATCLegacyKey normalized;
+	const char *str_end = find(&key[0], &key[ATC_KEY_SIZE - 1], '\0');
+	copy(&key[0], str_end, normalized.key_);
+
+	{
+#ifdef ATC_USE_THREADS
+		lock_guard<mutex> lock(cache_mutex);
+#endif
+		for (list<ATCLegacyKey>::iterator it = cache.begin(); it != cache.end(); ++it)
+		{
+			if (memcmp(it->key_, normalized.key_, ATC_KEY_SIZE) == 0)
+			{
+				// 先頭に移して返す
+				cache.splice(cache.begin(), cache, it);
+				return cache.front();
+			}
+		}
+	}
+
+	// キーの展開はロックの外で行う
+	ATCLegacyKey legacy_key(key);
+
+#ifdef ATC_USE_THREADS
+	lock_guard<mutex> lock(cache_mutex);
+#endif
+	cache.push_front(legacy_key);
+	if (cache.size() > ATC_LEGACY_KEY_CACHE_SIZE)
+	{
+		cache.pop_back();
+	}
+
+	return legacy_key;
+}
+
+void ATCLegacyKey::clearCache()
+{
+#ifdef ATC_USE_THREADS
+	lock_guard<mutex> lock(cache_mutex);
+#endif
+	cache.clear();
+}
@@ -0,0 +1,55 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "ATCCommon.h"
+
+class Blowfish;
+
+// v1.x（Blowfish）の書庫用のキー
+// 一度作れば変更されないので、複数の ATCUnlocker から同時に使える
+class ATCLegacyKey
+{
+public:
+	ATCLegacyKey();
+	explicit ATCLegacyKey(const char key[ATC_KEY_SIZE]);
+	~ATCLegacyKey();
+
+	bool empty() const;
+
+	// 最近使ったキーを ATC_LEGACY_KEY_CACHE_SIZE 個まで覚えておく
+	static ATCLegacyKey cached(const char key[ATC_KEY_SIZE]);
+	static void clearCache();
+
+private:
+	friend class ATCUnlocker_impl;
+
+	char key_[ATC_KEY_SIZE];
+	std::shared_ptr<const Blowfish> blowfish_;
+
+};
@@ -45,6 +45,11 @@ ATCResult ATCLocker::open(ostream *dst, const char key[ATC_KEY_SIZE])
 	return impl_->open(dst, key);
 }
 
+ATCResult ATCLocker::open(ostream *dst, const ATCKey& key)
+{
+	return impl_->open(dst, key);
+}
+
 ATCResult ATCLocker::close()
 {
 	return impl_->close();
@@ -65,6 +70,42 @@ ATCResult ATCLocker::writeFileData(ostream *dst, istream *src, size_t length)
 	return impl_->writeFileData(dst, src, length);
 }
 
+ATCResult ATCLocker::lockToBuffer(string *dst, const char key[ATC_KEY_SIZE],
+	const vector<ATCFileEntry>& entries, const char* const data[])
+{
+	return impl_->lockToBuffer(dst, key, entries, data);
+}
+
+ATCResult ATCLocker::lockToBuffer(string *dst, const ATCKey& key,
+	const vector<ATCFileEntry>& entries, const char* const data[])
+{
+	return impl_->lockToBuffer(dst, key, entries, data);
+}
+
+ATCResult ATCLocker::lockDirectory(ostream *dst, const char key[ATC_KEY_SIZE],
+	const string& root, const ATCDirectoryOptions& options)
+{
+	return impl_->lockDirectory(dst, key, root, options);
+}
+
+ATCResult ATCLocker::lockDirectory(ostream *dst, const ATCKey& key,
+	const string& root, const ATCDirectoryOptions& options)
+{
+	return impl_->lockDirectory(dst, key, root, options);
+}
+
+ATCResult ATCLocker::writeFileDataMulti(ATCLocker* const lockers[], ostream* const dsts[],
+	istream* const srcs[], const size_t lengths[], size_t count)
+{
+	vector<ATCLocker_impl*> impls(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		impls[i] = lockers[i]->impl_.get();
+	}
+
+	return ATCLocker_impl::writeFileDataMulti(impls.data(), dsts, srcs, lengths, count);
+}
+
 char ATCLocker::passwd_try_limit() const
 {
 	return impl_->passwd_try_limit();
@@ -80,6 +121,31 @@ int32_t ATCLocker::compression_level() const
 	return impl_->compression_level();
 }
 
+size_t ATCLocker::chunk_size() const
+{
+	return impl_->chunk_size();
+}
+
+int ATCLocker::thread_count() const
+{
+	return impl_->thread_count();
+}
+
+bool ATCLocker::adaptive_compression() const
+{
+	return impl_->adaptive_compression();
+}
+
+bool ATCLocker::pipelined() const
+{
+	return impl_->pipelined();
+}
+
+const vector<ATCCompressionDecision>& ATCLocker::compression_decisions() const
+{
+	return impl_->compression_decisions();
+}
+
 time_t ATCLocker::create_time() const
 {
 	return impl_->create_time();
@@ -100,6 +166,26 @@ void ATCLocker::set_compression_level(int32_t compression_level)
 	impl_->set_compression_level(compression_level);
 }
 
+void ATCLocker::set_chunk_size(size_t chunk_size)
+{
+	impl_->set_chunk_size(chunk_size);
+}
+
+void ATCLocker::set_thread_count(int thread_count)
+{
+	impl_->set_thread_count(thread_count);
+}
+
+void ATCLocker::set_adaptive_compression(bool adaptive_compression)
+{
+	impl_->set_adaptive_compression(adaptive_compression);
+}
+
+void ATCLocker::set_pipelined(bool pipelined)
+{
+	impl_->set_pipelined(pipelined);
+}
+
 void ATCLocker::set_create_time(const time_t create_time)
 {
 	impl_->set_create_time(create_time);
@@ -27,8 +27,10 @@ freely, subject to the following restrictions:
 
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 #include "ATCCommon.h"
+#include "ATCKey.h"
 
 using namespace std;
 
@@ -41,21 +43,48 @@ public:
 	~ATCLocker();
 
 	ATCResult open(ostream *dst, const char key[ATC_KEY_SIZE]);
+	ATCResult open(ostream *dst, const ATCKey& key);
 	ATCResult close();
 
 	ATCResult addFileEntry(const ATCFileEntry& entry);
 	ATCResult writeEncryptedHeader(ostream *dst);
 	ATCResult writeFileData(ostream *dst, istream *src, size_t length);
 
+	// Locks in-memory entries in one call, data[i] holds entries[i].size bytes
+	ATCResult lockToBuffer(string *dst, const char key[ATC_KEY_SIZE],
+		const vector<ATCFileEntry>& entries, const char* const data[]);
+	ATCResult lockToBuffer(string *dst, const ATCKey& key,
+		const vector<ATCFileEntry>& entries, const char* const data[]);
+
+	// Locks a file or a directory tree, building the entries from the file system
+	ATCResult lockDirectory(ostream *dst, const char key[ATC_KEY_SIZE],
+		const string& root, const ATCDirectoryOptions& options = ATCDirectoryOptions());
+	ATCResult lockDirectory(ostream *dst, const ATCKey& key,
+		const string& root, const ATCDirectoryOptions& options = ATCDirectoryOptions());
+
+	// Writes one entry to each of count archives, encrypting them in lockstep
+	static ATCResult writeFileDataMulti(ATCLocker* const lockers[], ostream* const dsts[],
+		istream* const srcs[], const size_t lengths[], size_t count);
+
 public:
 	char passwd_try_limit()	const;
 	bool self_destruction()	const;
 	int32_t compression_level() const;
+	size_t chunk_size() const;
+	int thread_count() const;
+	bool adaptive_compression() const;
+	bool pipelined() const;
+	const vector<ATCCompressionDecision>& compression_decisions() const;
 	time_t create_time() const;
 
 	void set_passwd_try_limit(char passwd_try_limit);
 	void set_self_destruction(bool self_destruction);
 	void set_compression_level(int32_t compression_level);
+	void set_chunk_size(size_t chunk_size);
+	void set_thread_count(int thread_count);
+	void set_adaptive_compression(bool adaptive_compression);
+	// Reads, deflates and encrypts on separate threads, the output does not change
+	void set_pipelined(bool pipelined);
 	void set_create_time(time_t create_time);
 
 private:
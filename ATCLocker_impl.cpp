@@ -31,191 +31,1209 @@ ATCLocker_impl::ATCLocker_impl() :
 passwd_try_limit_(ATC_DEFAULT_PASSWORD_TRY_LIMIT),
 self_destruction_(false),
 compression_level_(Z_DEFAULT_COMPRESSION),
+#ifdef USE_CLI
+chunk_size_(ATC_BUF_SIZE),
+#else
+chunk_size_(ATC_LOCK_CHUNK_SIZE),
+#endif
+thread_count_(1),
+adaptive_compression_(false),
+pipelined_(false),
+current_level_(Z_DEFAULT_COMPRESSION),
+current_strategy_(Z_DEFAULT_STRATEGY),
 
 total_length_(0),
 total_write_length_(0),
 
+z_ready_(false),
+
+stored_(false),
+stored_rest_(0),
+stored_final_(false),
+parallel_(false),
+deflaters_level_(Z_DEFAULT_COMPRESSION),
+adler_(0),
+
 finished_(false)
 
 {
-	time(&create_time_);
-}
+	time(&create_time_);
+}
+
+
+ATCLocker_impl::~ATCLocker_impl()
+{
+	close();
+
+	if (z_ready_)
+	{
+		deflateEnd(&z_);
+	}
+}
+
+ATCResult ATCLocker_impl::open(ostream *dst, const char key[ATC_KEY_SIZE])
+{
+	return open(dst, ATCKey(key, ATC_KEY_ENCRYPTION));
+}
+
+ATCResult ATCLocker_impl::open(ostream *dst, const ATCKey& key)
+{
+	if (key.empty() || key.usage() != ATC_KEY_ENCRYPTION)
+	{
+		return ATC_ERR_WRONG_KEY_USAGE;
+	}
+
+	// 同じロッカーで続けて別のアーカイブを作れるように
+	entries_.clear();
+
+	string header;
+	generatePlainHeader(&header);
+
+	dst->write(header.data(), header.size());
+
+	// 展開済みのキーを共有する
+	rijndael_ = key.rijndael_;
+
+	if (dst->good())
+	{
+		return ATC_OK;
+	} else {
+		return ATC_ERR_OSTREAM_FAILURE;
+	}
+}
+
+ATCResult ATCLocker_impl::close()
+{
+	return ATCLocker_impl::finish();
+}
+
+ATCResult ATCLocker_impl::addFileEntry(const ATCFileEntry& entry)
+{
+	if (entry.name_sjis.size() > 0 && entry.name_utf8.size())
+	{
+		entries_.push_back(entry);
+		return ATC_OK;
+	} else {
+		return ATC_ERR_INVARID_FILE_ENTRY;
+	}
+}
+
+namespace {
+	template <class T>
+	string convertToString(T src)
+	{
+		stringstream converter;
+		converter << src;
+		return converter.str();
+	}
+
+	void unix_to_ttime(time_t unix, int32_t *dt, int32_t *tm)
+	{
+		// 西洋紀元からUNIX紀元までの日数
+		static const int32_t days_between_ad_epoch_and_unix_epoch = 719162;
+		struct tm timeinfo;
+		
+		*dt = days_between_ad_epoch_and_unix_epoch + static_cast<int32_t>(unix) / (60 * 60 * 24) + 1;
+
+#ifdef WIN32
+			gmtime_s(&timeinfo, &unix);
+#else
+			gmtime_r(&unix, &timeinfo);
+#endif
+
+		*tm = timeinfo.tm_sec * 1000 + 
+			timeinfo.tm_min   * 1000 * 60 + 
+			timeinfo.tm_hour  * 1000 * 60 * 60;
+	}
+}
+
+ATCResult ATCLocker_impl::writeEncryptedHeader(ostream *dst)
+{
+	stringstream whole_header;
+	generateEncryptedHeader(&whole_header);
+
+	//暗号化部分のヘッダデータサイズを計算
+	const int32_t block_length = (whole_header.str().size() + ATC_BUF_SIZE - 1) / ATC_BUF_SIZE;
+	const int32_t encrypt_header_size = block_length * ATC_BUF_SIZE;
+
+	dst->write(reinterpret_cast<const char*>(&encrypt_header_size), sizeof(int32_t));
+
+	//初期化ベクトル（IV）を生成
+	fillrand(chain_buffer_, ATC_BUF_SIZE);
+	dst->write(chain_buffer_, ATC_BUF_SIZE);
+
+	char buffer[ATC_BUF_SIZE] = {0};
+
+	while (whole_header.read(buffer, ATC_BUF_SIZE).gcount() != 0)
+	{
+		encryptBuffer(buffer, chain_buffer_);
+
+		dst->write(buffer, ATC_BUF_SIZE);
+		for (int i = 0; i < ATC_BUF_SIZE; i++)
+		{
+			buffer[i] = 0;
+		}
+	}
+
+	//初期化ベクトル（IV）を生成
+	fillrand(chain_buffer_, ATC_BUF_SIZE);
+	dst->write(chain_buffer_, ATC_BUF_SIZE);
+
+	if (!initZlib())
+	{
+        return ATC_ERR_ZLIB_ERROR;
+    }
+
+	return ATC_OK;
+}
+
+ATCResult ATCLocker_impl::writeFileData(ostream *dst, istream *src, size_t length)
+{
+	// ストリームを閉じた後は末尾のサイズ 0 のエントリだけ。adler32 をもう一度書かない
+	if (finished_)
+	{
+		return (length == 0) ? ATC_OK : ATC_ERR_ZLIB_ERROR;
+	}
+
+	if (stored_)
+	{
+		return writeFileDataStored(dst, src, length);
+	}
+	else if (parallel_)
+	{
+		return writeFileDataParallel(dst, src, length);
+	}
+
+	size_t rest_length = length;
+
+	if (adaptive_compression_)
+	{
+		ATCResult result = chooseCompression(dst, src, &rest_length, length);
+		if (result != ATC_OK)
+		{
+			return result;
+		}
+	}
+
+#ifdef ATC_USE_THREADS
+	// 一つのチャンクに収まるエントリでは重ねられる処理がない
+	if (pipelined_ && rest_length > input_buffer_.size())
+	{
+		return writeFileDataPipelined(dst, src, rest_length);
+	}
+#endif
+
+	return writeFileDataSequential(dst, src, rest_length);
+}
+
+ATCResult ATCLocker_impl::writeFileDataSequential(ostream *dst, istream *src, size_t rest_length)
+{
+	while (1)
+	{
+		// chunk_size_ ずつ圧縮して、ブロック単位でまとめて暗号化・書き込み
+		ATCResult result = deflateChunk(src, &rest_length);
+		if (result != ATC_OK)
+		{
+			return result;
+		}
+
+		flushOutput(dst);
+
+		if (z_status_ == Z_STREAM_END)
+		{
+			return finish();
+		}
+		else if (z_status_ == Z_BUF_ERROR)
+		{
+			// このエントリは終わり
+			return ATC_OK;
+		}
+	}
+}
+
+ATCResult ATCLocker_impl::lockToBuffer(string *dst, const char key[ATC_KEY_SIZE],
+	const vector<ATCFileEntry>& entries, const char* const data[])
+{
+	return lockToBuffer(dst, ATCKey(key, ATC_KEY_ENCRYPTION), entries, data);
+}
+
+// メモリ上のエントリをまとめて暗号化し、dst に書き出す
+ATCResult ATCLocker_impl::lockToBuffer(string *dst, const ATCKey& key,
+	const vector<ATCFileEntry>& entries, const char* const data[])
+{
+	dst->clear();
+	ATCStringBuffer buffer(dst);
+	ostream out(&buffer);
+
+	ATCResult result = open(&out, key);
+	if (result != ATC_OK)
+	{
+		return result;
+	}
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if ((result = addFileEntry(entries[i])) != ATC_OK)
+		{
+			return result;
+		}
+	}
+
+	if ((result = writeEncryptedHeader(&out)) != ATC_OK)
+	{
+		return result;
+	}
+
+	// 小さいアーカイブは一度に圧縮して、まとめて暗号化する
+	if (!stored_ && !parallel_ && !adaptive_compression_ && total_length_ <= ATC_SMALL_ARCHIVE_SIZE)
+	{
+		return deflateToBuffer(dst, entries, data);
+	}
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].size > 0)
+		{
+			ATCInputBuffer input(data[i], static_cast<size_t>(entries[i].size));
+			istream src(&input);
+
+			if ((result = writeFileData(&out, &src, static_cast<size_t>(entries[i].size))) != ATC_OK)
+			{
+				return result;
+			}
+		}
+	}
+
+	return close();
+}
+
+ATCResult ATCLocker_impl::lockDirectory(ostream *dst, const char key[ATC_KEY_SIZE],
+	const string& root, const ATCDirectoryOptions& options)
+{
+	return lockDirectory(dst, ATCKey(key, ATC_KEY_ENCRYPTION), root, options);
+}
+
+// root 以下のファイルを読んでエントリを作り、順に暗号化して dst に書き出す
+ATCResult ATCLocker_impl::lockDirectory(ostream *dst, const ATCKey& key,
+	const string& root, const ATCDirectoryOptions& options)
+{
+	vector<ATCFileEntry> entries;
+	vector<string> paths;
+	if (!listDirectory(root, options, &entries, &paths))
+	{
+		return ATC_ERR_ISTREAM_FAILURE;
+	}
+
+	ATCResult result = open(dst, key);
+	if (result != ATC_OK)
+	{
+		return result;
+	}
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if ((result = addFileEntry(entries[i])) != ATC_OK)
+		{
+			return result;
+		}
+	}
+
+	if ((result = writeEncryptedHeader(dst)) != ATC_OK)
+	{
+		return result;
+	}
+
+	const size_t readahead_files = static_cast<size_t>(max(options.readahead_files, 0));
+	size_t prefetched = 0;
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].size <= 0)
+		{
+			continue;
+		}
+
+		// このファイルを圧縮している間に、後のファイルを OS に読ませておく
+		prefetched = max(prefetched, i + 1);
+		int64_t ahead = 0;
+		for (size_t j = i + 1; j < prefetched; ++j)
+		{
+			ahead += max(entries[j].size, static_cast<int64_t>(0));
+		}
+		while (prefetched < entries.size() && prefetched - i <= readahead_files && ahead < ATC_READAHEAD_SIZE)
+		{
+			if (entries[prefetched].size > 0)
+			{
+				prefetchFile(paths[prefetched]);
+				ahead += entries[prefetched].size;
+			}
+			++prefetched;
+		}
+
+		ifstream src(paths[i].c_str(), ios::binary);
+		if (!src)
+		{
+			return ATC_ERR_ISTREAM_FAILURE;
+		}
+
+		if ((result = writeFileData(dst, &src, static_cast<size_t>(entries[i].size))) != ATC_OK)
+		{
+			return result;
+		}
+	}
+
+	return close();
+}
+
+// 入力を直接 deflate して、出力を dst の末尾に書き、その場で暗号化する
+ATCResult ATCLocker_impl::deflateToBuffer(string *dst, const vector<ATCFileEntry>& entries, const char* const data[])
+{
+	if (total_length_ <= 0)
+	{
+		return close();
+	}
+
+	const size_t data_offset = dst->size();
+	size_t used = 0;
+	dst->resize(data_offset + deflateBound(&z_, static_cast<uLong>(total_length_)) + ATC_BUF_SIZE);
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		if (entries[i].size <= 0)
+		{
+			continue;
+		}
+
+		z_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data[i]));
+		z_.avail_in = static_cast<uInt>(entries[i].size);
+		total_write_length_ += entries[i].size;
+		z_flush_ = (total_write_length_ >= total_length_) ? Z_FINISH : Z_NO_FLUSH;
+
+		do
+		{
+			// deflateBound で足りなかった場合は広げる
+			if (dst->size() - data_offset - used < ATC_BUF_SIZE)
+			{
+				dst->resize(dst->size() + ATC_CHUNK_SIZE);
+			}
+
+			z_.next_out = reinterpret_cast<Bytef*>(&(*dst)[data_offset + used]);
+			z_.avail_out = static_cast<uInt>(dst->size() - data_offset - used - ATC_BUF_SIZE);
+			z_status_ = deflate(&z_, z_flush_);
+			used = reinterpret_cast<char*>(z_.next_out) - &(*dst)[data_offset];
+
+			if (z_status_ != Z_OK && z_status_ != Z_STREAM_END && z_status_ != Z_BUF_ERROR)
+			{
+				return ATC_ERR_ZLIB_ERROR;
+			}
+		} while (z_.avail_in != 0 || (z_flush_ == Z_FINISH && z_status_ != Z_STREAM_END));
+	}
+
+	// 最後のブロックをパディングで埋めて、まとめて暗号化する
+	char *output = &(*dst)[data_offset];
+	int32_t count;
+	if ((count = used % ATC_BUF_SIZE) != 0)
+	{
+		char padding_num = (char)(ATC_BUF_SIZE - count);
+		for (int i = count; i < ATC_BUF_SIZE; i++)
+		{
+			output[used++] = padding_num;
+		}
+	}
+
+	rijndael_->EncryptCBC(output, output, used, chain_buffer_);
+	dst->resize(data_offset + used);
+
+	return finish();
+}
+
+ATCResult ATCLocker_impl::writeFileDataMulti(ATCLocker_impl* const lockers[], ostream* const dsts[],
+	istream* const srcs[], const size_t lengths[], size_t count)
+{
+	// deflate を使わないロッカーは一つずつ書き込む
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (lockers[i]->stored_ || lockers[i]->parallel_)
+		{
+			for (size_t j = 0; j < count; ++j)
+			{
+				ATCResult result = lockers[j]->writeFileData(dsts[j], srcs[j], lengths[j]);
+				if (result != ATC_OK)
+				{
+					return result;
+				}
+			}
+			return ATC_OK;
+		}
+	}
+
+	vector<size_t> rest_lengths(lengths, lengths + count);
+	vector<bool> active(count, true);
+	size_t active_count = count;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (lockers[i]->adaptive_compression_)
+		{
+			ATCResult result = lockers[i]->chooseCompression(dsts[i], srcs[i], &rest_lengths[i], lengths[i]);
+			if (result != ATC_OK)
+			{
+				return result;
+			}
+		}
+	}
+
+	vector<const CRijndael256*> engines(count);
+	vector<const char*> in(count);
+	vector<char*> out(count), chains(count);
+	vector<size_t> block_lengths(count);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		ATCLocker_impl *locker = lockers[i];
+
+		engines[i] = locker->rijndael_.get();
+		in[i] = out[i] = &locker->output_buffer_[0];
+		chains[i] = locker->chain_buffer_;
+	}
+
+	while (active_count > 0)
+	{
+		// 各アーカイブを圧縮
+		for (size_t i = 0; i < count; ++i)
+		{
+			block_lengths[i] = 0;
+			if (!active[i])
+			{
+				continue;
+			}
+
+			ATCLocker_impl *locker = lockers[i];
+			ATCResult result = locker->deflateChunk(srcs[i], &rest_lengths[i]);
+			if (result != ATC_OK)
+			{
+				return result;
+			}
+
+			const size_t used = reinterpret_cast<char*>(locker->z_.next_out) - out[i];
+			block_lengths[i] = used / ATC_BUF_SIZE * ATC_BUF_SIZE;
+		}
+
+		// まとめて暗号化
+		CRijndael256::EncryptCBCLanes(engines.data(), in.data(), out.data(), chains.data(), block_lengths.data(), count);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!active[i])
+			{
+				continue;
+			}
+
+			ATCLocker_impl *locker = lockers[i];
+			dsts[i]->write(out[i], block_lengths[i]);
+
+			// 端数は次のブロックの先頭へ
+			const size_t used = reinterpret_cast<char*>(locker->z_.next_out) - out[i];
+			const size_t rest = used - block_lengths[i];
+			memmove(out[i], out[i] + block_lengths[i], rest);
+			locker->z_.next_out = reinterpret_cast<Bytef*>(out[i] + rest);
+			locker->z_.avail_out = static_cast<uInt>(locker->output_buffer_.size() - rest);
+
+			if (locker->z_status_ == Z_STREAM_END)
+			{
+				ATCResult result = locker->finish();
+				if (result != ATC_OK)
+				{
+					return result;
+				}
+				active[i] = false;
+				active_count--;
+			}
+			else if (locker->z_status_ == Z_BUF_ERROR)
+			{
+				// このエントリは終わり
+				active[i] = false;
+				active_count--;
+			}
+		}
+	}
+
+	return ATC_OK;
+}
+
+// output_buffer_ が一杯になるか、エントリかストリームが終わるまで圧縮する
+// ストリームの終わりでは最後のブロックをパディングで埋める
+ATCResult ATCLocker_impl::deflateChunk(istream *src, size_t *rest_length)
+{
+	while (z_.avail_out != 0)
+	{
+		if (z_.avail_in == 0)
+		{
+			size_t read_length = (*rest_length < input_buffer_.size()) ? *rest_length : input_buffer_.size();
+
+			z_.next_in = reinterpret_cast<Bytef*>(&input_buffer_[0]);
+			z_.avail_in = static_cast<uInt>(src->read(&input_buffer_[0], read_length).gcount());
+
+			*rest_length -= z_.avail_in;
+			total_write_length_ += z_.avail_in;
+
+			if (total_write_length_ >= total_length_)
+			{
+				z_flush_ = Z_FINISH;
+			}
+		}
+
+		z_status_ = deflate(&z_, z_flush_);
+
+		if (z_status_ == Z_STREAM_END)
+		{
+			const size_t used = reinterpret_cast<char*>(z_.next_out) - &output_buffer_[0];
+			int32_t count;
+			if ((count = used % ATC_BUF_SIZE) != 0)
+			{
+				char padding_num = (char)(ATC_BUF_SIZE - count);
+				for (int i = count; i < ATC_BUF_SIZE; i++)
+				{
+					*(z_.next_out++) = padding_num;
+				}
+			}
+			return ATC_OK;
+		}
+
+		if (z_status_ != Z_OK)
+		{
+			if (z_status_ == Z_BUF_ERROR)
+			{
+				return ATC_OK;
+			} else {
+				return ATC_ERR_ZLIB_ERROR;
+			}
+		}
+	}
+
+	return ATC_OK;
+}
+
+#ifdef ATC_USE_THREADS
+// 読み込み、圧縮、暗号化と書き込みをそれぞれ別のスレッドで行い、ディスクの待ち時間と計算を重ねる
+// 圧縮はこのスレッドで行う。deflate に渡す入力と出力の大きさは writeFileDataSequential と
+// 同じにしているので、出力も同じになる。チャンクの端数は output_buffer_ に戻して次のエントリへ渡す
+ATCResult ATCLocker_impl::writeFileDataPipelined(ostream *dst, istream *src, size_t rest_length)
+{
+	if (!read_queue_ || read_queue_->chunk_size() != input_buffer_.size())
+	{
+		read_queue_.reset(new ATCChunkQueue(ATC_PIPELINE_DEPTH, input_buffer_.size()));
+	}
+	if (!write_queue_ || write_queue_->chunk_size() != output_buffer_.size())
+	{
+		write_queue_.reset(new ATCChunkQueue(ATC_PIPELINE_DEPTH, output_buffer_.size()));
+	}
+
+	ATCChunkQueue& read_queue = *read_queue_;
+	ATCChunkQueue& write_queue = *write_queue_;
+	read_queue.reset();
+	write_queue.reset();
+
+	// 暗号化と書き込み
+	thread writer;
+	try
+	{
+		writer = thread([&]()
+		{
+			while (ATCChunkQueue::Chunk *chunk = write_queue.front())
+			{
+				rijndael_->EncryptCBC(&chunk->data[0], &chunk->data[0], chunk->length, chain_buffer_);
+				dst->write(&chunk->data[0], chunk->length);
+				write_queue.release();
+			}
+		});
+	}
+	catch (...)
+	{
+		// スレッドを作れない場合はこのスレッドで順に行う
+		return writeFileDataSequential(dst, src, rest_length);
+	}
+
+	// 読み込み（長さ 0 のチャンクがエントリの終わり）
+	thread reader;
+	try
+	{
+		reader = thread([&, rest_length]() mutable
+		{
+			while (ATCChunkQueue::Chunk *chunk = read_queue.acquire())
+			{
+				const size_t read_length = (rest_length < chunk->data.size()) ? rest_length : chunk->data.size();
+				chunk->length = static_cast<size_t>(src->read(&chunk->data[0], read_length).gcount());
+				rest_length -= chunk->length;
+
+				const bool end = (chunk->length == 0);
+				read_queue.commit();
+				if (end)
+				{
+					break;
+				}
+			}
+			read_queue.close();
+		});
+	}
+	catch (...)
+	{
+		write_queue.close();
+		writer.join();
+		return writeFileDataSequential(dst, src, rest_length);
+	}
+
+	// 前のエントリの端数から続ける
+	ATCChunkQueue::Chunk *output = write_queue.acquire();
+	size_t used = reinterpret_cast<char*>(z_.next_out) - &output_buffer_[0];
+	memcpy(&output->data[0], &output_buffer_[0], used);
+	z_.next_out = reinterpret_cast<Bytef*>(&output->data[0] + used);
+	z_.avail_out = static_cast<uInt>(output->data.size() - used);
+
+	ATCChunkQueue::Chunk *input = nullptr;
+	bool input_end = false;
+	ATCResult result = ATC_OK;
+
+	while (1)
+	{
+		// deflateChunk と同じ
+		while (z_.avail_out != 0)
+		{
+			if (z_.avail_in == 0 && !input_end)
+			{
+				if (input)
+				{
+					read_queue.release();
+				}
+				input = read_queue.front();
+
+				if (input && input->length > 0)
+				{
+					z_.next_in = reinterpret_cast<Bytef*>(&input->data[0]);
+					z_.avail_in = static_cast<uInt>(input->length);
+					total_write_length_ += input->length;
+				} else {
+					input_end = true;
+				}
+
+				if (total_write_length_ >= total_length_)
+				{
+					z_flush_ = Z_FINISH;
+				}
+			}
+
+			z_status_ = deflate(&z_, z_flush_);
+
+			if (z_status_ == Z_STREAM_END)
+			{
+				const size_t count = (reinterpret_cast<char*>(z_.next_out) - &output->data[0]) % ATC_BUF_SIZE;
+				if (count != 0)
+				{
+					char padding_num = (char)(ATC_BUF_SIZE - count);
+					for (size_t i = count; i < ATC_BUF_SIZE; i++)
+					{
+						*(z_.next_out++) = padding_num;
+					}
+				}
+				break;
+			}
+
+			if (z_status_ != Z_OK)
+			{
+				if (z_status_ != Z_BUF_ERROR)
+				{
+					result = ATC_ERR_ZLIB_ERROR;
+				}
+				break;
+			}
+		}
+
+		if (result != ATC_OK)
+		{
+			break;
+		}
+
+		// flushOutput と同じく、ブロック単位の部分を書き込みに回して端数は次へ移す
+		used = reinterpret_cast<char*>(z_.next_out) - &output->data[0];
+		const size_t block_length = used / ATC_BUF_SIZE * ATC_BUF_SIZE;
+		const size_t rest = used - block_length;
+
+		char fraction[ATC_BUF_SIZE];
+		memcpy(fraction, &output->data[block_length], rest);
+		output->length = block_length;
+		write_queue.commit();
+
+		if (z_status_ == Z_STREAM_END || z_status_ == Z_BUF_ERROR)
+		{
+			memcpy(&output_buffer_[0], fraction, rest);
+			z_.next_out = reinterpret_cast<Bytef*>(&output_buffer_[0] + rest);
+			z_.avail_out = static_cast<uInt>(output_buffer_.size() - rest);
+			break;
+		}
+
+		output = write_queue.acquire();
+		memcpy(&output->data[0], fraction, rest);
+		z_.next_out = reinterpret_cast<Bytef*>(&output->data[0] + rest);
+		z_.avail_out = static_cast<uInt>(output->data.size() - rest);
+	}
+
+	// Z_FINISH で終わった後に読み込みが残っていれば止める
+	read_queue.cancel();
+	reader.join();
+
+	if (result != ATC_OK)
+	{
+		write_queue.cancel();
+		writer.join();
+		return result;
+	}
+
+	write_queue.close();
+	writer.join();
+
+	if (z_status_ == Z_STREAM_END)
+	{
+		return finish();
+	}
+	return ATC_OK;
+}
+#endif
+
+namespace {
+	void deleteDeflater(z_stream *z)
+	{
+		deflateEnd(z);
+		delete z;
+	}
+}
+
+// pigz と同じ方法で複数スレッドで圧縮する
+// 入力を ATC_DEFLATE_BLOCK_SIZE ごとに分けて、直前の 32 KiB を辞書にしてそれぞれ raw deflate し、
+// Z_SYNC_FLUSH でバイト境界に揃えてつなげる。zlib のヘッダと adler32 はここで書くので、
+// 全体は一つの zlib ストリームになり、ATCUnlocker や AttacheCase でそのまま展開できる
+ATCResult ATCLocker_impl::writeFileDataParallel(ostream *dst, istream *src, size_t length)
+{
+	const size_t batch_size = static_cast<size_t>(thread_count_) * ATC_DEFLATE_BLOCK_SIZE;
+	size_t rest_length = length;
+
+	while (rest_length > 0)
+	{
+		const size_t used = pending_.size();
+		const size_t read_length = (rest_length < batch_size - used) ? rest_length : batch_size - used;
+
+		pending_.resize(used + read_length);
+		const size_t n = static_cast<size_t>(src->read(&pending_[used], read_length).gcount());
+		pending_.resize(used + n);
+
+		rest_length -= n;
+		total_write_length_ += n;
+
+		if (n == 0)
+		{
+			break;
+		}
+
+		// ストリームの最後のブロックは Z_FINISH で圧縮するので残しておく
+		if (pending_.size() == batch_size && total_write_length_ < total_length_)
+		{
+			ATCResult result = deflatePending(dst, false);
+			if (result != ATC_OK)
+			{
+				return result;
+			}
+		}
+	}
+
+	if (total_write_length_ >= total_length_)
+	{
+		ATCResult result = deflatePending(dst, true);
+		if (result != ATC_OK)
+		{
+			return result;
+		}
+		return finish();
+	}
+
+	return ATC_OK;
+}
+
+ATCResult ATCLocker_impl::deflatePending(ostream *dst, bool last)
+{
+	const size_t length = pending_.size();
+	const size_t block_count = (length > 0) ? (length + ATC_DEFLATE_BLOCK_SIZE - 1) / ATC_DEFLATE_BLOCK_SIZE : 1;
+
+	vector<vector<char> > outputs(block_count);
+	vector<uLong> adlers(block_count);
+	vector<int> statuses(block_count);
+
+	const Bytef *data = reinterpret_cast<const Bytef*>(pending_.data());
+	const vector<char>& dictionary = dictionary_;
+	const vector<shared_ptr<z_stream> >& deflaters = deflaters_;
+
+	runParallel(block_count, [&](size_t i)
+	{
+		const size_t begin = i * ATC_DEFLATE_BLOCK_SIZE;
+		const size_t block_length = (length - begin < ATC_DEFLATE_BLOCK_SIZE) ? length - begin : ATC_DEFLATE_BLOCK_SIZE;
+		const bool final_block = last && (i == block_count - 1);
+
+		// ブロックごとに初期化し直すより速い
+		z_stream& z = *deflaters[i];
+		statuses[i] = deflateReset(&z);
+		if (statuses[i] != Z_OK)
+		{
+			return;
+		}
+
+		// 直前の 32 KiB を辞書にする
+		if (i > 0)
+		{
+			statuses[i] = deflateSetDictionary(&z, data + begin - ATC_DEFLATE_WINDOW_SIZE, ATC_DEFLATE_WINDOW_SIZE);
+		}
+		else if (!dictionary.empty())
+		{
+			statuses[i] = deflateSetDictionary(&z, reinterpret_cast<const Bytef*>(dictionary.data()),
+				static_cast<uInt>(dictionary.size()));
+		}
+		if (statuses[i] != Z_OK)
+		{
+			return;
+		}
+
+		vector<char>& output = outputs[i];
+		output.resize(deflateBound(&z, static_cast<uLong>(block_length)) + 16);
+
+		z.next_in = const_cast<Bytef*>(data + begin);
+		z.avail_in = static_cast<uInt>(block_length);
+		z.next_out = reinterpret_cast<Bytef*>(&output[0]);
+		z.avail_out = static_cast<uInt>(output.size());
+
+		while (1)
+		{
+			statuses[i] = deflate(&z, final_block ? Z_FINISH : Z_SYNC_FLUSH);
+
+			if (statuses[i] == Z_STREAM_END || (statuses[i] == Z_OK && !final_block && z.avail_out != 0))
+			{
+				statuses[i] = Z_OK;
+				break;
+			}
+			if (statuses[i] != Z_OK)
+			{
+				break;
+			}
+
+			// 出力が足りない
+			const size_t used = output.size();
+			output.resize(used * 2);
+			z.next_out = reinterpret_cast<Bytef*>(&output[used]);
+			z.avail_out = static_cast<uInt>(used);
+		}
+
+		output.resize(z.total_out);
+		adlers[i] = adler32(adler32(0, Z_NULL, 0), data + begin, static_cast<uInt>(block_length));
+	});
+
+	for (size_t i = 0; i < block_count; ++i)
+	{
+		if (statuses[i] != Z_OK)
+		{
+			return ATC_ERR_ZLIB_ERROR;
+		}
+
+		const size_t begin = i * ATC_DEFLATE_BLOCK_SIZE;
+		const size_t block_length = (length - begin < ATC_DEFLATE_BLOCK_SIZE) ? length - begin : ATC_DEFLATE_BLOCK_SIZE;
+		adler_ = adler32_combine(adler_, adlers[i], static_cast<z_off_t>(block_length));
+
+		if (!outputs[i].empty())
+		{
+			writeOutput(dst, &outputs[i][0], outputs[i].size());
+		}
+	}
+
+	// 次の辞書
+	dictionary_.insert(dictionary_.end(), pending_.begin(), pending_.end());
+	if (dictionary_.size() > ATC_DEFLATE_WINDOW_SIZE)
+	{
+		dictionary_.erase(dictionary_.begin(), dictionary_.end() - ATC_DEFLATE_WINDOW_SIZE);
+	}
+	pending_.clear();
+
+	if (last)
+	{
+		writeTrailer(dst);
+	}
+
+	return ATC_OK;
+}
+
+// 無圧縮の zlib ストリームを直接書く
+// 入力は出力バッファに直接読み込み、stored ブロックのヘッダをはさむだけ
+ATCResult ATCLocker_impl::writeFileDataStored(ostream *dst, istream *src, size_t length)
+{
+	size_t rest_length = length;
 
+	while (rest_length > 0)
+	{
+		if (stored_rest_ == 0)
+		{
+			// ブロックの長さはストリームの残りから決まる
+			const int64_t stream_rest = total_length_ - total_write_length_;
+			const size_t block_length = (stream_rest < ATC_STORED_BLOCK_SIZE) ?
+				static_cast<size_t>(stream_rest > 0 ? stream_rest : 0) : ATC_STORED_BLOCK_SIZE;
+
+			stored_final_ = (static_cast<int64_t>(block_length) >= stream_rest);
+
+			const char header[] = {
+				static_cast<char>(stored_final_ ? 1 : 0),
+				static_cast<char>(block_length), static_cast<char>(block_length >> 8),
+				static_cast<char>(~block_length), static_cast<char>(~block_length >> 8)
+			};
+			writeOutput(dst, header, sizeof(header));
+
+			stored_rest_ = block_length;
+			if (stored_rest_ == 0)
+			{
+				// エントリの大きさが合計より多い
+				break;
+			}
+		}
 
-ATCLocker_impl::~ATCLocker_impl()
-{
-	close();
-}
+		size_t read_length = (rest_length < stored_rest_) ? rest_length : stored_rest_;
+		if (read_length > z_.avail_out)
+		{
+			read_length = z_.avail_out;
+		}
 
-ATCResult ATCLocker_impl::open(ostream *dst, const char key[ATC_KEY_SIZE])
-{
+		char *next_out = reinterpret_cast<char*>(z_.next_out);
+		const size_t n = static_cast<size_t>(src->read(next_out, read_length).gcount());
+		adler_ = adler32(adler_, z_.next_out, static_cast<uInt>(n));
 
-	string header;
-	generatePlainHeader(&header);
+		z_.next_out += n;
+		z_.avail_out -= static_cast<uInt>(n);
+		rest_length -= n;
+		stored_rest_ -= n;
+		total_write_length_ += n;
 
-	dst->write(header.data(), header.size());
+		if (z_.avail_out == 0)
+		{
+			writeOutput(dst, nullptr, 0);
+		}
 
-	rijndael_.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		if (n < read_length)
+		{
+			break;
+		}
+	}
 
-	if (dst->good())
+	if (total_write_length_ >= total_length_)
 	{
-		return ATC_OK;
-	} else {
-		return ATC_ERR_OSTREAM_FAILURE;
+		if (!stored_final_)
+		{
+			// 空のストリーム
+			static const char empty_block[] = { 1, 0, 0, (char)0xFF, (char)0xFF };
+			writeOutput(dst, empty_block, sizeof(empty_block));
+		}
+
+		writeTrailer(dst);
+		return finish();
 	}
-}
 
-ATCResult ATCLocker_impl::close()
-{
-	return ATCLocker_impl::finish();
+	return ATC_OK;
 }
 
-ATCResult ATCLocker_impl::addFileEntry(const ATCFileEntry& entry)
+// 圧縮済みのデータを output_buffer_ に溜めて、一杯になったら暗号化して書き込む
+void ATCLocker_impl::writeOutput(ostream *dst, const char *data, size_t length)
 {
-	if (entry.name_sjis.size() > 0 && entry.name_utf8.size())
+	char *output = &output_buffer_[0];
+
+	while (1)
 	{
-		entries_.push_back(entry);
-		return ATC_OK;
-	} else {
-		return ATC_ERR_INVARID_FILE_ENTRY;
+		if (z_.avail_out == 0)
+		{
+			rijndael_->EncryptCBC(output, output, output_buffer_.size(), chain_buffer_);
+			dst->write(output, output_buffer_.size());
+
+			z_.next_out = reinterpret_cast<Bytef*>(output);
+			z_.avail_out = static_cast<uInt>(output_buffer_.size());
+		}
+
+		if (length == 0)
+		{
+			break;
+		}
+
+		const size_t n = (length < z_.avail_out) ? length : z_.avail_out;
+		memcpy(z_.next_out, data, n);
+		z_.next_out += n;
+		z_.avail_out -= static_cast<uInt>(n);
+		data += n;
+		length -= n;
 	}
 }
 
-namespace {
-	template <class T>
-	string convertToString(T src)
+// adler32 を書き、最後のブロックをパディングで埋めて書き込む
+void ATCLocker_impl::writeTrailer(ostream *dst)
+{
+	// ビッグエンディアン
+	const char trailer[] = {
+		static_cast<char>(adler_ >> 24), static_cast<char>(adler_ >> 16),
+		static_cast<char>(adler_ >> 8), static_cast<char>(adler_)
+	};
+	writeOutput(dst, trailer, sizeof(trailer));
+
+	char *output = &output_buffer_[0];
+	size_t used = reinterpret_cast<char*>(z_.next_out) - output;
+	int32_t count;
+	if ((count = used % ATC_BUF_SIZE) != 0)
 	{
-		stringstream converter;
-		converter << src;
-		return converter.str();
+		char padding_num = (char)(ATC_BUF_SIZE - count);
+		for (int i = count; i < ATC_BUF_SIZE; i++)
+		{
+			output[used++] = padding_num;
+		}
 	}
 
-	void unix_to_ttime(time_t unix, int32_t *dt, int32_t *tm)
-	{
-		// 西洋紀元からUNIX紀元までの日数
-		static const int32_t days_between_ad_epoch_and_unix_epoch = 719162;
-		struct tm timeinfo;
-		
-		*dt = days_between_ad_epoch_and_unix_epoch + static_cast<int32_t>(unix) / (60 * 60 * 24) + 1;
-
-#ifdef WIN32
-			gmtime_s(&timeinfo, &unix);
-#else
-			timeinfo = *gmtime(&unix);
-#endif
+	rijndael_->EncryptCBC(output, output, used, chain_buffer_);
+	dst->write(output, used);
 
-		*tm = timeinfo.tm_sec * 1000 + 
-			timeinfo.tm_min   * 1000 * 60 + 
-			timeinfo.tm_hour  * 1000 * 60 * 60;
-	}
+	z_.next_out = reinterpret_cast<Bytef*>(output);
+	z_.avail_out = static_cast<uInt>(output_buffer_.size());
 }
 
-ATCResult ATCLocker_impl::writeEncryptedHeader(ostream *dst)
+// 出力バッファのうち暗号化のブロック単位の部分をまとめて暗号化して書き込み、端数は先頭へ移す
+void ATCLocker_impl::flushOutput(ostream *dst)
 {
-	stringstream whole_header;
-	generateEncryptedHeader(&whole_header);
+	char *output = &output_buffer_[0];
 
-	//暗号化部分のヘッダデータサイズを計算
-	const int32_t block_length = (whole_header.str().size() + ATC_BUF_SIZE - 1) / ATC_BUF_SIZE;
-	const int32_t encrypt_header_size = block_length * ATC_BUF_SIZE;
-
-	dst->write(reinterpret_cast<const char*>(&encrypt_header_size), sizeof(int32_t));
+	const size_t used = reinterpret_cast<char*>(z_.next_out) - output;
+	const size_t block_length = used / ATC_BUF_SIZE * ATC_BUF_SIZE;
 
-	//初期化ベクトル（IV）を生成
-	fillrand(chain_buffer_, ATC_BUF_SIZE);
-	dst->write(chain_buffer_, ATC_BUF_SIZE);
+	rijndael_->EncryptCBC(output, output, block_length, chain_buffer_);
+	dst->write(output, block_length);
 
-	char buffer[ATC_BUF_SIZE] = {0};
+	const size_t rest = used - block_length;
+	memmove(output, output + block_length, rest);
+	z_.next_out = reinterpret_cast<Bytef*>(output + rest);
+	z_.avail_out = static_cast<uInt>(output_buffer_.size() - rest);
+}
 
-	while (whole_header.read(buffer, ATC_BUF_SIZE).gcount() != 0)
+namespace {
+	// バイト単位のエントロピー（ビット/バイト）
+	double sampleEntropy(const char *data, size_t length)
 	{
-		encryptBuffer(buffer, chain_buffer_);
+		size_t counts[256] = {0};
+		for (size_t i = 0; i < length; ++i)
+		{
+			counts[static_cast<unsigned char>(data[i])]++;
+		}
 
-		dst->write(buffer, ATC_BUF_SIZE);
-		for (int i = 0; i < ATC_BUF_SIZE; i++)
+		double entropy = 0.0;
+		for (int i = 0; i < 256; ++i)
 		{
-			buffer[i] = 0;
+			if (counts[i] > 0)
+			{
+				const double p = static_cast<double>(counts[i]) / length;
+				entropy -= p * log(p);
+			}
 		}
-	}
 
-	//初期化ベクトル（IV）を生成
-	fillrand(chain_buffer_, ATC_BUF_SIZE);
-	dst->write(chain_buffer_, ATC_BUF_SIZE);
+		return entropy / log(2.0);
+	}
 
-	if (!initZlib())
+	// 同じバイトの連続が大半なら Z_RLE、0 に近い小さな値（差分を取った画像や音声など）が大半なら Z_FILTERED
+	int sampleStrategy(const char *data, size_t length)
 	{
-        return ATC_ERR_ZLIB_ERROR;
-    }
+		size_t repeats = 0;
+		size_t smalls = 0;
+		for (size_t i = 0; i < length; ++i)
+		{
+			const unsigned char c = static_cast<unsigned char>(data[i]);
+			if (i > 0 && data[i] == data[i - 1])
+			{
+				repeats++;
+			}
+			if (c < 16 || c >= 240)
+			{
+				smalls++;
+			}
+		}
 
-	return ATC_OK;
+		if (repeats * 8 >= length * 7)
+		{
+			return Z_RLE;
+		}
+		else if (smalls * 4 >= length * 3)
+		{
+			return Z_FILTERED;
+		}
+		return Z_DEFAULT_STRATEGY;
+	}
 }
 
-ATCResult ATCLocker_impl::writeFileData(ostream *dst, istream *src, size_t length)
+// エントリの先頭を読んで圧縮レベルと戦略を選ぶ（読んだ分はそのまま最初の入力になる）
+// JPEG や ZIP のように圧縮できないものは無圧縮、圧縮しにくいものは最速のレベルのハフマン符号だけにする
+ATCResult ATCLocker_impl::chooseCompression(ostream *dst, istream *src, size_t *rest_length, size_t length)
 {
-	int rest_length = length;
-    while (1)
+	size_t sample_length = (*rest_length < ATC_COMPRESSION_SAMPLE_SIZE) ? *rest_length : ATC_COMPRESSION_SAMPLE_SIZE;
+	if (sample_length > input_buffer_.size())
 	{
-        if (z_.avail_in == 0)
-		{
-			size_t read_length = (rest_length < ATC_BUF_SIZE) ? rest_length : ATC_BUF_SIZE;
-
-            z_.next_in = reinterpret_cast<Bytef*>(input_buffer_);
-			z_.avail_in = static_cast<uInt>(src->read(input_buffer_, read_length).gcount());
-			
-			rest_length -= z_.avail_in;
-			total_write_length_ += z_.avail_in;
-
-			if (total_write_length_ >= total_length_) 
-			{
-				z_flush_ = Z_FINISH;
-			}
-        }
+		sample_length = input_buffer_.size();
+	}
 
-		// TODO: コメントアウトするとなぜか正常に出力しない
-		// if(z_.avail_in == 0) break;
+	char *input = &input_buffer_[0];
+	sample_length = static_cast<size_t>(src->read(input, sample_length).gcount());
 
-        z_status_ = deflate(&z_, z_flush_);
+	ATCCompressionDecision decision;
+	decision.size = length;
+	decision.entropy = sampleEntropy(input, sample_length);
+	decision.level = compression_level_;
+	decision.strategy = Z_DEFAULT_STRATEGY;
 
-        if (z_status_ == Z_STREAM_END)
+	if (sample_length >= ATC_COMPRESSION_MIN_SAMPLE_SIZE || sample_length == length)
+	{
+		if (decision.entropy >= 7.8)
 		{
-			break;
+			decision.level = Z_NO_COMPRESSION;
 		}
-
-        if (z_status_ != Z_OK)
+		else if (decision.entropy >= 7.0)
 		{
-			if (z_status_ == Z_BUF_ERROR)
-			{
-				return ATC_OK;
-			} else {
-				return ATC_ERR_ZLIB_ERROR;
-			}
-        }
-
-        if (z_.avail_out == 0)
+			decision.level = Z_BEST_SPEED;
+			decision.strategy = Z_HUFFMAN_ONLY;
+		}
+		else
 		{
-			encryptBuffer(output_buffer_, chain_buffer_);
-			dst->write(output_buffer_, ATC_BUF_SIZE);
-
-			z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
-			z_.avail_out = ATC_BUF_SIZE;
-        }
-    }
+			decision.strategy = sampleStrategy(input, sample_length);
+		}
+	}
 
-    if (z_status_ == Z_STREAM_END)
+	// 前のエントリの入力は deflateParams の中で前の設定のまま圧縮される
+	if (decision.level != current_level_ || decision.strategy != current_strategy_)
 	{
-		int32_t count;
-		if ((count = ATC_BUF_SIZE - z_.avail_out) != 0)
+		int status;
+		while ((status = deflateParams(&z_, decision.level, decision.strategy)) == Z_BUF_ERROR)
 		{
-			char padding_num = (char)z_.avail_out;
-			for(int i = count; i < ATC_BUF_SIZE; i++)
-			{
-				output_buffer_[i] = padding_num;
-			}
-			encryptBuffer(output_buffer_, chain_buffer_);
-			dst->write(output_buffer_, ATC_BUF_SIZE);
+			flushOutput(dst);
 		}
 
-		return finish();
+		if (status != Z_OK)
+		{
+			return ATC_ERR_ZLIB_ERROR;
+		}
+
+		current_level_ = decision.level;
+		current_strategy_ = decision.strategy;
+	}
+
+	compression_decisions_.push_back(decision);
+
+	z_.next_in = reinterpret_cast<Bytef*>(input);
+	z_.avail_in = static_cast<uInt>(sample_length);
+
+	*rest_length -= sample_length;
+	total_write_length_ += sample_length;
+
+	if (total_write_length_ >= total_length_)
+	{
+		z_flush_ = Z_FINISH;
 	}
 
 	return ATC_OK;
@@ -223,20 +1241,102 @@ ATCResult ATCLocker_impl::writeFileData(ostream *dst, istream *src, size_t lengt
 
 bool ATCLocker_impl::initZlib()
 {
-    z_.zalloc = Z_NULL;
-    z_.zfree  = Z_NULL;
-    z_.opaque = Z_NULL;
+	// 前のアーカイブで使った z_stream があれば、確保し直さずにリセットして使う
+	if (z_ready_)
+	{
+		if (deflateReset(&z_) != Z_OK ||
+			deflateParams(&z_, compression_level_, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			return false;
+		}
+	} else {
+		setZlibPool(&z_);
 
-    if (deflateInit(&z_, compression_level_) != Z_OK)
+		if (deflateInit(&z_, compression_level_) != Z_OK)
+		{
+			return false;
+		}
+		z_ready_ = true;
+	}
+	finished_ = false;
+	z_status_ = Z_OK;
+	total_write_length_ = 0;
+
+	// 小さいアーカイブではバッファも全体の大きさまで小さくする
+	size_t buffer_size = chunk_size_;
+	const int64_t data_size = (total_length_ / ATC_BUF_SIZE + 1) * ATC_BUF_SIZE;
+	if (data_size < static_cast<int64_t>(buffer_size))
 	{
-        return false;
-    }
+		buffer_size = static_cast<size_t>(data_size);
+	}
+
+	input_buffer_.resize(buffer_size);
+	output_buffer_.resize(buffer_size);
 
     z_.avail_in = 0;
-    z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
-    z_.avail_out = ATC_BUF_SIZE;
+    z_.next_out = reinterpret_cast<Bytef*>(&output_buffer_[0]);
+    z_.avail_out = static_cast<uInt>(output_buffer_.size());
     z_flush_ = Z_NO_FLUSH;
 
+	current_level_ = compression_level_;
+	current_strategy_ = Z_DEFAULT_STRATEGY;
+	compression_decisions_.clear();
+
+#ifndef USE_CLI
+	// 無圧縮ならスレッドを使うより速い。適応圧縮ではエントリごとにレベルが変わるので使わない
+	stored_ = (compression_level_ == Z_NO_COMPRESSION && !adaptive_compression_);
+	stored_rest_ = 0;
+	stored_final_ = false;
+#endif
+#ifdef ATC_USE_THREADS
+	parallel_ = (thread_count_ > 1 && !stored_);
+#endif
+	if (stored_ || parallel_)
+	{
+		adler_ = adler32(0, Z_NULL, 0);
+	}
+
+	if (parallel_)
+	{
+		pending_.reserve(static_cast<size_t>(thread_count_) * ATC_DEFLATE_BLOCK_SIZE);
+
+		// スレッドごとの raw deflate（同じレベルならそのまま使う）
+		if (deflaters_level_ != compression_level_)
+		{
+			deflaters_.clear();
+			deflaters_level_ = compression_level_;
+		}
+		while (deflaters_.size() > static_cast<size_t>(thread_count_))
+		{
+			deflaters_.pop_back();
+		}
+		while (deflaters_.size() < static_cast<size_t>(thread_count_))
+		{
+			z_stream *z = new z_stream;
+			setZlibPool(z);
+
+			if (deflateInit2(z, compression_level_, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			{
+				delete z;
+				return false;
+			}
+			deflaters_.push_back(shared_ptr<z_stream>(z, deleteDeflater));
+		}
+	}
+
+	if (stored_ || parallel_)
+	{
+		// deflateInit と同じ zlib ヘッダ
+		const int32_t level = (compression_level_ == Z_DEFAULT_COMPRESSION) ? 6 : compression_level_;
+		const int level_flags = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+		int header = ((Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8) | (level_flags << 6);
+		header += 31 - (header % 31);
+
+		*(z_.next_out++) = static_cast<Bytef>(header >> 8);
+		*(z_.next_out++) = static_cast<Bytef>(header);
+		z_.avail_out -= 2;
+	}
+
 	return true;
 }
 
@@ -281,6 +1381,7 @@ void ATCLocker_impl::generateEncryptedHeader(stringstream *dst)
 	string utf8_header = "Passcode:AttacheCase\n\r\nLastDateTime:" + date_string + "\n\r\n";
 
 	int32_t count = 0;
+	total_length_ = 0;
 	for (vector<ATCFileEntry>::iterator it = entries_.begin(); it != entries_.end(); ++it)
 	{
 		sjis_header += "Fn_" + convertToString(count) + ":";
@@ -328,9 +1429,15 @@ ATCResult ATCLocker_impl::finish()
 	if (!finished_)
 	{
 		finished_ = true;
-		if (deflateEnd(&z_) != Z_OK)
+
+		// 途中で終わったストリームは再利用せずに解放する（deflateEnd がエラーを返す）
+		if (z_ready_ && z_status_ != Z_STREAM_END && z_.total_out != 0)
 		{
-			return ATC_ERR_ZLIB_ERROR;
+			z_ready_ = false;
+			if (deflateEnd(&z_) != Z_OK)
+			{
+				return ATC_ERR_ZLIB_ERROR;
+			}
 		}
 	}
 
@@ -367,7 +1474,7 @@ void ATCLocker_impl::getCurrentDateString(string *dst)
 #ifdef WIN32
 	localtime_s(&timeinfo, &create_time_);
 #else
-	timeinfo = *localtime(&create_time_);
+	localtime_r(&create_time_, &timeinfo);
 #endif
 
 	strftime(buffer, 80, "%Y/%m/%d %H:%M:%S", &timeinfo);
@@ -378,16 +1485,8 @@ void ATCLocker_impl::getCurrentDateString(string *dst)
 
 void ATCLocker_impl::encryptBuffer(char data_buffer[ATC_BUF_SIZE], char iv_buffer[ATC_BUF_SIZE])
 {
-	// xor
-	for (int i = 0; i < ATC_BUF_SIZE; i++ )
-	{
-		data_buffer[i] ^= iv_buffer[i];
-	}
-
-	// rijndael
-	rijndael_.EncryptBlock(data_buffer, data_buffer);
-
-	memcpy(iv_buffer, data_buffer, ATC_BUF_SIZE);
+	// xor, rijndael, iv の更新
+	rijndael_->EncryptCBC(data_buffer, data_buffer, ATC_BUF_SIZE, iv_buffer);
 }
 
 char ATCLocker_impl::passwd_try_limit() const
@@ -405,6 +1504,31 @@ int32_t ATCLocker_impl::compression_level() const
 	return compression_level_;
 }
 
+size_t ATCLocker_impl::chunk_size() const
+{
+	return chunk_size_;
+}
+
+int ATCLocker_impl::thread_count() const
+{
+	return thread_count_;
+}
+
+bool ATCLocker_impl::adaptive_compression() const
+{
+	return adaptive_compression_;
+}
+
+bool ATCLocker_impl::pipelined() const
+{
+	return pipelined_;
+}
+
+const vector<ATCCompressionDecision>& ATCLocker_impl::compression_decisions() const
+{
+	return compression_decisions_;
+}
+
 time_t ATCLocker_impl::create_time() const
 {
 	return create_time_;
@@ -425,6 +1549,45 @@ void ATCLocker_impl::set_compression_level(const int32_t compression_level)
 	compression_level_ = compression_level;
 }
 
+void ATCLocker_impl::set_chunk_size(const size_t chunk_size)
+{
+#ifndef USE_CLI
+	// writeEncryptedHeader より前に設定する
+	// 暗号化のブロック単位に切り上げる
+	const size_t blocks = (chunk_size + ATC_BUF_SIZE - 1) / ATC_BUF_SIZE;
+	chunk_size_ = (blocks > 0) ? blocks * ATC_BUF_SIZE : ATC_BUF_SIZE;
+#endif
+}
+
+void ATCLocker_impl::set_thread_count(int thread_count)
+{
+	// 0 以下ならプロセッサの数
+	if (thread_count <= 0)
+	{
+#ifdef ATC_USE_THREADS
+		thread_count = static_cast<int>(thread::hardware_concurrency());
+#endif
+		if (thread_count <= 0)
+		{
+			thread_count = 1;
+		}
+	}
+
+	thread_count_ = thread_count;
+}
+
+void ATCLocker_impl::set_adaptive_compression(bool adaptive_compression)
+{
+	// 複数スレッドで圧縮する場合は使われない
+	adaptive_compression_ = adaptive_compression;
+}
+
+void ATCLocker_impl::set_pipelined(bool pipelined)
+{
+	// 無圧縮と複数スレッドでの圧縮では使われない。C++/CLI では常に一つのスレッドで行う
+	pipelined_ = pipelined;
+}
+
 void ATCLocker_impl::set_create_time(const time_t create_time)
 {
 	create_time_ = create_time;
@@ -452,6 +1615,8 @@ ATCResult ATCLocker_impl::open(Stream ^dst, array<System::Byte, 1> ^key)
 	array<System::Byte, 1>^ key_buffer = gcnew array<System::Byte, 1>(ATC_KEY_SIZE);
 	key->CopyTo(key_buffer, 0);
 
+	entries_.clear();
+
 	string header;
 	generatePlainHeader(&header);
 
@@ -460,8 +1625,7 @@ ATCResult ATCLocker_impl::open(Stream ^dst, array<System::Byte, 1> ^key)
 	// キーをセット
 	{
 		pin_ptr<System::Byte> buffer_native = &key_buffer[0];
-		rijndael_.MakeKey(reinterpret_cast<const char*>(buffer_native),
-			CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		rijndael_ = ATCKey(reinterpret_cast<const char*>(buffer_native), ATC_KEY_ENCRYPTION).rijndael_;
 
 		buffer_native = nullptr;
 	}
@@ -525,14 +1689,14 @@ ATCResult ATCLocker_impl::writeFileData(Stream ^dst, Stream ^src, size_t length)
 		{
 			size_t read_length = (rest_length < ATC_BUF_SIZE) ? rest_length : ATC_BUF_SIZE;
 
-            z_.next_in = reinterpret_cast<Bytef*>(input_buffer_);
+            z_.next_in = reinterpret_cast<Bytef*>(&input_buffer_[0]);
 
 			array<System::Byte, 1>^ buffer = gcnew array<System::Byte, 1>(ATC_BUF_SIZE);
 			z_.avail_in = src->Read(buffer, 0, buffer->Length);
 
 			{
 				pin_ptr<System::Byte> buffer_native = &buffer[0];
-				memcpy(input_buffer_, buffer_native, ATC_BUF_SIZE);
+				memcpy(&input_buffer_[0], buffer_native, ATC_BUF_SIZE);
 
 				buffer_native = nullptr;
 			}
@@ -568,10 +1732,10 @@ ATCResult ATCLocker_impl::writeFileData(Stream ^dst, Stream ^src, size_t length)
 
         if (z_.avail_out == 0)
 		{
-			encryptBuffer(output_buffer_, chain_buffer_);
-			writeToStream(dst, output_buffer_, ATC_BUF_SIZE);
+			encryptBuffer(&output_buffer_[0], chain_buffer_);
+			writeToStream(dst, &output_buffer_[0], ATC_BUF_SIZE);
 
-			z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
+			z_.next_out = reinterpret_cast<Bytef*>(&output_buffer_[0]);
 			z_.avail_out = ATC_BUF_SIZE;
         }
     }
@@ -587,8 +1751,8 @@ ATCResult ATCLocker_impl::writeFileData(Stream ^dst, Stream ^src, size_t length)
 				output_buffer_[i] = padding_num;
 			}
 
-			encryptBuffer(output_buffer_, chain_buffer_);
-			writeToStream(dst, output_buffer_, ATC_BUF_SIZE);
+			encryptBuffer(&output_buffer_[0], chain_buffer_);
+			writeToStream(dst, &output_buffer_[0], ATC_BUF_SIZE);
 
 		}
 
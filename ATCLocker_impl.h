@@ -29,13 +29,21 @@ freely, subject to the following restrictions:
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <memory>
+#include <cmath>
 
 #include <zlib.h>
 
-#include "Rijndael.h"
+#include "RijndaelFixed.h"
+#include "ATCParallel.h"
+#include "ATCChunkQueue.h"
+#include "ATCZlibPool.h"
+#include "ATCMemoryBuffer.h"
+#include "ATCDirectory.h"
 #include "isaac.h"
 
 #include "ATCCommon.h"
+#include "ATCKey.h"
 
 #ifdef USE_CLI
 	#using<system.dll>
@@ -55,12 +63,26 @@ public:
 	~ATCLocker_impl();
 
 	ATCResult open(ostream *dst, const char key[ATC_KEY_SIZE]);
+	ATCResult open(ostream *dst, const ATCKey& key);
 	ATCResult close();
 
 	ATCResult addFileEntry(const ATCFileEntry& entry);
 	ATCResult writeEncryptedHeader(ostream *dst);
 	ATCResult writeFileData(ostream *dst, istream *src, size_t length);
 
+	ATCResult lockToBuffer(string *dst, const char key[ATC_KEY_SIZE],
+		const vector<ATCFileEntry>& entries, const char* const data[]);
+	ATCResult lockToBuffer(string *dst, const ATCKey& key,
+		const vector<ATCFileEntry>& entries, const char* const data[]);
+
+	ATCResult lockDirectory(ostream *dst, const char key[ATC_KEY_SIZE],
+		const string& root, const ATCDirectoryOptions& options);
+	ATCResult lockDirectory(ostream *dst, const ATCKey& key,
+		const string& root, const ATCDirectoryOptions& options);
+
+	static ATCResult writeFileDataMulti(ATCLocker_impl* const lockers[], ostream* const dsts[],
+		istream* const srcs[], const size_t lengths[], size_t count);
+
 #ifdef USE_CLI
 	ATCResult open(Stream ^dst, array<System::Byte, 1> ^key);
 	ATCResult writeEncryptedHeader(Stream ^dst);
@@ -71,11 +93,20 @@ public:
 	char passwd_try_limit() const;
 	bool self_destruction() const;
 	int32_t compression_level() const;
+	size_t chunk_size() const;
+	int thread_count() const;
+	bool adaptive_compression() const;
+	bool pipelined() const;
+	const vector<ATCCompressionDecision>& compression_decisions() const;
 	time_t create_time() const;
 
 	void set_passwd_try_limit(char passwd_try_limit);
 	void set_self_destruction(bool self_destruction);
 	void set_compression_level(int32_t compression_level);
+	void set_chunk_size(size_t chunk_size);
+	void set_thread_count(int thread_count);
+	void set_adaptive_compression(bool adaptive_compression);
+	void set_pipelined(bool pipelined);
 	void set_create_time(time_t create_time);
 
 private:
@@ -83,6 +114,19 @@ private:
 	void getCurrentDateString(string *dst);
 	void encryptBuffer(char data_buffer[ATC_BUF_SIZE], char iv_buffer[ATC_BUF_SIZE]);
 	bool initZlib();
+	ATCResult deflateChunk(istream *src, size_t *rest_length);
+	void flushOutput(ostream *dst);
+	ATCResult chooseCompression(ostream *dst, istream *src, size_t *rest_length, size_t length);
+	ATCResult writeFileDataSequential(ostream *dst, istream *src, size_t rest_length);
+	ATCResult writeFileDataParallel(ostream *dst, istream *src, size_t length);
+#ifdef ATC_USE_THREADS
+	ATCResult writeFileDataPipelined(ostream *dst, istream *src, size_t rest_length);
+#endif
+	ATCResult deflatePending(ostream *dst, bool last);
+	ATCResult writeFileDataStored(ostream *dst, istream *src, size_t length);
+	ATCResult deflateToBuffer(string *dst, const vector<ATCFileEntry>& entries, const char* const data[]);
+	void writeOutput(ostream *dst, const char *data, size_t length);
+	void writeTrailer(ostream *dst);
 	void generatePlainHeader(string *dst);
 	void generateEncryptedHeader(stringstream *dst);
 	ATCResult finish();
@@ -91,19 +135,46 @@ private:
 	char passwd_try_limit_;
 	bool self_destruction_;
 	int32_t compression_level_;
+	size_t chunk_size_;
+	int thread_count_;
+	bool adaptive_compression_;
+	bool pipelined_;
+	int32_t current_level_;
+	int32_t current_strategy_;
+	vector<ATCCompressionDecision> compression_decisions_;
 
 	int64_t total_length_;
 	int64_t total_write_length_;
 
-	CRijndael rijndael_;
+	shared_ptr<const CRijndael256> rijndael_;
 	char chain_buffer_[ATC_BUF_SIZE];
 
 	z_stream z_;
+	bool z_ready_;
 	int32_t z_flush_, z_status_;
-	char input_buffer_[ATC_BUF_SIZE];
-	char output_buffer_[ATC_BUF_SIZE];
+	vector<char> input_buffer_;
+	vector<char> output_buffer_;
+
+	// 無圧縮の場合は zlib を使わずに stored ブロックを書く
+	bool stored_;
+	size_t stored_rest_;
+	bool stored_final_;
+
+	// 複数スレッドで圧縮する場合の、まだ圧縮していない入力と直前の 32 KiB
+	bool parallel_;
+	vector<char> pending_;
+	vector<char> dictionary_;
+	vector<shared_ptr<z_stream> > deflaters_;
+	int32_t deflaters_level_;
+	uLong adler_;
 	string tmp_buffer_;
 
+#ifdef ATC_USE_THREADS
+	// 読み込み、圧縮、暗号化と書き込みを別々のスレッドで行う場合の、スレッドの間のキュー
+	shared_ptr<ATCChunkQueue> read_queue_;
+	shared_ptr<ATCChunkQueue> write_queue_;
+#endif
+
 	bool finished_;
 	time_t create_time_;
 
@@ -0,0 +1,104 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <cstring>
+#include <streambuf>
+#include <string>
+
+// メモリ上のデータを読む istream 用のバッファ（シーク可能、コピーしない）
+class ATCInputBuffer : public std::streambuf
+{
+public:
+	ATCInputBuffer(const void *data, size_t length)
+	{
+		char *begin = const_cast<char*>(static_cast<const char*>(data));
+		setg(begin, begin, begin + length);
+	}
+
+	// 現在の位置から最大 length バイトを直接参照して読み進める
+	const char *take(size_t length, size_t *taken)
+	{
+		const size_t rest = static_cast<size_t>(egptr() - gptr());
+		const char *data = gptr();
+		*taken = (length < rest) ? length : rest;
+		setg(eback(), gptr() + *taken, egptr());
+		return data;
+	}
+
+protected:
+	virtual std::streamsize xsgetn(char *s, std::streamsize n)
+	{
+		size_t taken;
+		const char *data = take(static_cast<size_t>(n), &taken);
+		memcpy(s, data, taken);
+		return static_cast<std::streamsize>(taken);
+	}
+
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+	{
+		const off_type base = (dir == std::ios_base::beg) ? 0 :
+			(dir == std::ios_base::cur) ? gptr() - eback() : egptr() - eback();
+		return seekpos(pos_type(base + off), which);
+	}
+
+	virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which)
+	{
+		const off_type offset = pos;
+		if (!(which & std::ios_base::in) || offset < 0 || offset > egptr() - eback())
+		{
+			return pos_type(off_type(-1));
+		}
+		setg(eback(), eback() + offset, egptr());
+		return pos;
+	}
+};
+
+// string の末尾に書き足す ostream 用のバッファ
+class ATCStringBuffer : public std::streambuf
+{
+public:
+	explicit ATCStringBuffer(std::string *dst) : dst_(dst) {}
+
+protected:
+	virtual std::streamsize xsputn(const char *s, std::streamsize n)
+	{
+		dst_->append(s, static_cast<size_t>(n));
+		return n;
+	}
+
+	virtual int_type overflow(int_type c)
+	{
+		if (c != traits_type::eof())
+		{
+			dst_->push_back(traits_type::to_char_type(c));
+		}
+		return traits_type::not_eof(c);
+	}
+
+private:
+	std::string *dst_;
+};
@@ -0,0 +1,69 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <vector>
+
+#include "ATCCommon.h"
+
+#ifdef ATC_USE_THREADS
+#include <thread>
+#endif
+
+// function(0) ～ function(count - 1) を別々のスレッドで実行し、すべての終了を待つ
+template <class Function>
+void runParallel(size_t count, Function function)
+{
+#ifdef ATC_USE_THREADS
+	std::vector<std::thread> threads;
+	threads.reserve(count);
+
+	for (size_t i = 1; i < count; ++i)
+	{
+		try
+		{
+			threads.push_back(std::thread(function, i));
+		}
+		catch (...)
+		{
+			// スレッドを作れない場合はこのスレッドで実行
+			function(i);
+		}
+	}
+
+	function(0);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		function(i);
+	}
+#endif
+}
@@ -45,6 +45,26 @@ ATCResult ATCUnlocker::open(istream *src, const char key[ATC_KEY_SIZE])
 	return impl_->open(src, key);
 }
 
+ATCResult ATCUnlocker::open(istream *src, const ATCLegacyKey& key)
+{
+	return impl_->open(src, key);
+}
+
+ATCResult ATCUnlocker::open(istream *src, const ATCKey& key)
+{
+	return impl_->open(src, key);
+}
+
+ATCResult ATCUnlocker::openBuffer(const void *data, size_t length, const char key[ATC_KEY_SIZE])
+{
+	return impl_->openBuffer(data, length, key);
+}
+
+ATCResult ATCUnlocker::openBuffer(const void *data, size_t length, const ATCKey& key)
+{
+	return impl_->openBuffer(data, length, key);
+}
+
 ATCResult ATCUnlocker::close()
 {
 	return impl_->close();
@@ -65,6 +85,46 @@ ATCResult ATCUnlocker::extractFileData(ostream *dst, istream *src, size_t length
 	return impl_->extractFileData(dst, src, length);
 }
 
+ATCResult ATCUnlocker::extractFileData(const ATCDataSink& sink, istream *src, size_t length)
+{
+	return impl_->extractFileData(sink, src, length);
+}
+
+ATCResult ATCUnlocker::extractFileData(char *dst, istream *src, size_t length)
+{
+	return impl_->extractFileData(dst, src, length);
+}
+
+ATCResult ATCUnlocker::skipFileData(istream *src, size_t length)
+{
+	return impl_->skipFileData(src, length);
+}
+
+ATCResult ATCUnlocker::skipToEntry(istream *src, size_t index)
+{
+	return impl_->skipToEntry(src, index);
+}
+
+ATCResult ATCUnlocker::extractToDirectory(istream *src, const string& root)
+{
+	return impl_->extractToDirectory(src, root);
+}
+
+ATCResult ATCUnlocker::buildIndex(istream *src, ostream *index, size_t span)
+{
+	return impl_->buildIndex(src, index, span);
+}
+
+ATCResult ATCUnlocker::loadIndex(istream *src, istream *index)
+{
+	return impl_->loadIndex(src, index);
+}
+
+ATCResult ATCUnlocker::seekToEntry(istream *src, size_t index)
+{
+	return impl_->seekToEntry(src, index);
+}
+
 int32_t ATCUnlocker::data_version() const
 {
 	return impl_->data_version();
@@ -89,3 +149,33 @@ bool ATCUnlocker::self_destruction() const
 {
 	return impl_->self_destruction();
 }
+
+int ATCUnlocker::thread_count() const
+{
+	return impl_->thread_count();
+}
+
+bool ATCUnlocker::read_ahead() const
+{
+	return impl_->read_ahead();
+}
+
+int ATCUnlocker::writer_count() const
+{
+	return impl_->writer_count();
+}
+
+void ATCUnlocker::set_thread_count(int thread_count)
+{
+	impl_->set_thread_count(thread_count);
+}
+
+void ATCUnlocker::set_read_ahead(bool read_ahead)
+{
+	impl_->set_read_ahead(read_ahead);
+}
+
+void ATCUnlocker::set_writer_count(int writer_count)
+{
+	impl_->set_writer_count(writer_count);
+}
@@ -29,6 +29,8 @@ freely, subject to the following restrictions:
 #include <memory>
 
 #include "ATCCommon.h"
+#include "ATCLegacyKey.h"
+#include "ATCKey.h"
 
 using namespace std;
 
@@ -41,11 +43,27 @@ public:
 	~ATCUnlocker();
 
 	ATCResult open(istream *src, const char key[ATC_KEY_SIZE] = nullptr);
+	ATCResult open(istream *src, const ATCLegacyKey& key);
+	ATCResult open(istream *src, const ATCKey& key);
+
+	// Opens an archive held in memory; pass nullptr as src to read from it afterwards
+	ATCResult openBuffer(const void *data, size_t length, const char key[ATC_KEY_SIZE]);
+	ATCResult openBuffer(const void *data, size_t length, const ATCKey& key);
 	ATCResult close();
 
 	size_t getEntryLength() const;
 	ATCResult getEntry(ATCFileEntry *entry, size_t index);
 	ATCResult extractFileData(ostream *dst, istream *src, size_t length);
+	ATCResult extractFileData(const ATCDataSink& sink, istream *src, size_t length);
+	ATCResult extractFileData(char *dst, istream *src, size_t length);
+	ATCResult skipFileData(istream *src, size_t length);
+	ATCResult skipToEntry(istream *src, size_t index);
+	// Extracts every entry under root right after open, files are written on writer threads
+	ATCResult extractToDirectory(istream *src, const string& root);
+
+	ATCResult buildIndex(istream *src, ostream *index, size_t span = ATC_INDEX_SPAN);
+	ATCResult loadIndex(istream *src, istream *index);
+	ATCResult seekToEntry(istream *src, size_t index);
 
 public:
 	int32_t data_version() const;
@@ -53,6 +71,14 @@ public:
 	int32_t algorism_type() const;
 	char passwd_try_limit() const;
 	bool self_destruction() const;
+	int thread_count() const;
+	bool read_ahead() const;
+	int writer_count() const;
+
+	void set_thread_count(int thread_count);
+	// Reads and decrypts ahead of inflate on a worker thread, src must stay valid until close()
+	void set_read_ahead(bool read_ahead);
+	void set_writer_count(int writer_count);
 
 private:
 	std::shared_ptr<ATCUnlocker_impl> impl_;
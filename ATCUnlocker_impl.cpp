@@ -24,6 +24,7 @@ freely, subject to the following restrictions:
 */
 
 #include "ATCUnlocker_impl.h"
+#include "ATCParallel.h"
 
 
 ATCUnlocker_impl::ATCUnlocker_impl() :
@@ -37,7 +38,20 @@ passwd_try_limit_(ATC_DEFAULT_PASSWORD_TRY_LIMIT),
 self_destruction_(false),
 
 total_length_(0),
-total_read_length_(0)
+total_read_length_(0),
+data_offset_(0),
+
+thread_count_(1),
+writer_count_(ATC_WRITER_THREADS),
+read_ahead_(false),
+#ifdef ATC_USE_THREADS
+read_ahead_src_(nullptr),
+read_ahead_chunk_(false),
+#endif
+
+z_ready_(false),
+output_offset_(0),
+extracted_length_(0)
 
 {
 }
@@ -45,10 +59,60 @@ total_read_length_(0)
 
 ATCUnlocker_impl::~ATCUnlocker_impl()
 {
+	stopReadAhead(true);
 
+	if (z_ready_)
+	{
+		inflateEnd(&z_);
+	}
 }
 
 ATCResult ATCUnlocker_impl::open(istream *src, const char key[ATC_KEY_SIZE])
+{
+	return openStream(src, key, nullptr, nullptr);
+}
+
+ATCResult ATCUnlocker_impl::open(istream *src, const ATCLegacyKey& key)
+{
+	if (key.empty())
+	{
+		return openStream(src, nullptr, nullptr, nullptr);
+	}
+
+	return openStream(src, key.key_, key.blowfish_, nullptr);
+}
+
+ATCResult ATCUnlocker_impl::open(istream *src, const ATCKey& key)
+{
+	if (key.empty())
+	{
+		return openStream(src, nullptr, nullptr, nullptr);
+	}
+	else if (key.usage() != ATC_KEY_DECRYPTION)
+	{
+		return ATC_ERR_WRONG_KEY_USAGE;
+	}
+
+	return openStream(src, key.key_, nullptr, key.rijndael_);
+}
+
+ATCResult ATCUnlocker_impl::openBuffer(const void *data, size_t length, const char key[ATC_KEY_SIZE])
+{
+	memory_buffer_ = make_shared<ATCInputBuffer>(data, length);
+	memory_stream_ = make_shared<istream>(memory_buffer_.get());
+	return open(memory_stream_.get(), key);
+}
+
+ATCResult ATCUnlocker_impl::openBuffer(const void *data, size_t length, const ATCKey& key)
+{
+	memory_buffer_ = make_shared<ATCInputBuffer>(data, length);
+	memory_stream_ = make_shared<istream>(memory_buffer_.get());
+	return open(memory_stream_.get(), key);
+}
+
+// blowfish, rijndael が空の場合は key から展開する
+ATCResult ATCUnlocker_impl::openStream(istream *src, const char key[ATC_KEY_SIZE],
+	const shared_ptr<const Blowfish>& blowfish, const shared_ptr<const CRijndael256>& rijndael)
 {
 	char token[16];
 	static const char token_string[] = "_AttacheCaseData";
@@ -57,6 +121,15 @@ ATCResult ATCUnlocker_impl::open(istream *src, const char key[ATC_KEY_SIZE])
 	char plain_header_info[4] = {0, 0, 0, 0};
 	int32_t encrypted_header_size = 0;
 
+	stopReadAhead(true);
+
+	// 前に openBuffer で開いたバッファはもう使わない
+	if (src != memory_stream_.get())
+	{
+		memory_stream_.reset();
+		memory_buffer_.reset();
+	}
+
 	src->seekg(0, ios::beg);
 	src->read(plain_header_info, sizeof(plain_header_info));
 	src->read(token, sizeof(token));
@@ -117,247 +190,1110 @@ ATCResult ATCUnlocker_impl::open(istream *src, const char key[ATC_KEY_SIZE])
 	}
 	else if (data_version_ <= 103)
 	{
-		const char *str_end = find(&key[0], &key[ATC_KEY_SIZE - 1], '\0');
-		string key_str = string(&key[0], str_end) + PASS_FOOTER;
+		// 展開済みのキーがあればそれを共有する
+		blowfish_ = blowfish ? blowfish : ATCLegacyKey(key).blowfish_;
+
+		encrypted_header_size = *reinterpret_cast<int32_t*>(plain_header_info);
+	}
+	else
+	{
+		// 104 ～
+		// Rijndaelで暗号化されている
+
+		src->read(reinterpret_cast<char*>(&algorism_type_), sizeof(algorism_type_));
+		src->read(reinterpret_cast<char*>(&encrypted_header_size), sizeof(encrypted_header_size));
+
+		// データサブバージョンチェック（ver.2.70～）
+		if (plain_header_info[0] >= 6)
+		{
+			passwd_try_limit_ = plain_header_info[2];
+			self_destruction_ = (plain_header_info[3] == 0) ? false : true;
+
+			// 有効範囲（1～10）かチェック
+			if (passwd_try_limit_ < ATC_MIN_PASSWORD_TRY_LIMIT ||
+					passwd_try_limit_ > ATC_MAX_PASSWORD_TRY_LIMIT)
+			{
+				passwd_try_limit_ = ATC_DEFAULT_PASSWORD_TRY_LIMIT;
+			}
+		}
+		else
+		{
+			passwd_try_limit_ = ATC_DEFAULT_PASSWORD_TRY_LIMIT;
+			self_destruction_ = false;
+		}
+
+		// IVの読み込み
+		src->read(chain_buffer_, ATC_BUF_SIZE);
+
+		// キーをセット（展開済みのキーがあればそれを共有する）
+		rijndael_ = rijndael ? rijndael : ATCKey(key, ATC_KEY_DECRYPTION).rijndael_;
+	}
+	
+	stringstream pms;
+	streamsize len = 0;
+	while (len < encrypted_header_size)
+	{
+		char source_buffer[ATC_BUF_SIZE] = {0};
+		len += src->read(source_buffer, ATC_BUF_SIZE).gcount();
+
+		if (data_version_ <= 103)
+		{
+			decryptBufferBlowfish(source_buffer);
+		} else {
+			decryptBufferRijndael(source_buffer, chain_buffer_);
+		}
+
+		// 最初のブロックで復号に成功したかどうかチェック
+		if (len == ATC_BUF_SIZE)
+		{
+			if (string(source_buffer, ATC_BUF_SIZE).find("Passcode") == string::npos)
+			{
+				src->clear();
+				src->seekg(0, ios::beg);
+				return ATC_ERR_WRONG_KEY;
+			}
+		}
+
+		pms.write(source_buffer, ATC_BUF_SIZE);
+	}
+
+	// ヘッダのファイルエントリを解析
+	if(!parseHeaderEntries(&pms))
+	{
+		return ATC_ERR_BROKEN_HEADER;
+	}
+
+	ifstream::pos_type cursor = src->tellg();
+	src->seekg(0, ios::end);
+	ifstream::pos_type file_length = src->tellg();
+	src->seekg(cursor);
+
+	// ファイル（データ本体）サイズを取得する
+	total_length_ = file_length - cursor - ATC_BUF_SIZE;
+
+	if (data_version_ > 103)
+	{
+		// IVの読み出し
+		src->read(chain_buffer_, ATC_BUF_SIZE);
+	}
+
+	data_offset_ = src->tellg();
+	index_points_.clear();
+
+	if (!initZlib())
+	{
+		return ATC_ERR_ZLIB_ERROR;
+	}
+
+	return ATC_OK;
+}
+
+ATCResult ATCUnlocker_impl::close()
+{
+	// 先読みしているスレッドは止める
+	// z_stream は次に開くアーカイブのために取っておき、デストラクタで解放する
+	stopReadAhead(true);
+	return ATC_OK;
+}
+
+ATCResult ATCUnlocker_impl::getEntry(ATCFileEntry *entry, size_t index)
+{
+	if (index < entries_.size())
+	{
+		*entry = entries_.at(index);
+		return ATC_OK;
+	} else {
+		return ATC_ERR_INVARID_INDEX;
+	}
+}
+
+ATCResult ATCUnlocker_impl::extractFileData(ostream *dst, istream *src, size_t length)
+{
+	return extractFileData([dst](const char *data, size_t data_length) {
+		dst->write(data, data_length);
+		return true;
+	}, src, length);
+}
+
+// 展開したデータを output_buffer_ から直接 sink に渡す
+ATCResult ATCUnlocker_impl::extractFileData(const ATCDataSink& sink, istream *src, size_t length)
+{
+	size_t rest_length = length;
+
+	while (rest_length > 0)
+	{
+		// 展開済みのデータ（前のエントリからの持ち越しを含む）を先に書き出す
+		const size_t count = reinterpret_cast<char*>(z_.next_out) - output_buffer_ - output_offset_;
+		if (count > 0)
+		{
+			const size_t write_length = (count < rest_length) ? count : rest_length;
+			const char *data = output_buffer_ + output_offset_;
+			output_offset_ += write_length;
+			rest_length -= write_length;
+			extracted_length_ += write_length;
+
+			if (!sink(data, write_length))
+			{
+				return ATC_ERR_SINK_ABORTED;
+			}
+			continue;
+		}
+
+		if (z_status_ == Z_STREAM_END)
+		{
+			break;
+		}
+
+		if (z_.avail_in == 0)
+		{
+			readDataChunk(src);
+		}
+
+		const ATCResult result = inflateOutput();
+		if (result != ATC_OK)
+		{
+			return result;
+		}
+	}
+
+	return ATC_OK;
+}
+
+// 呼び出し側のバッファに直接展開する
+ATCResult ATCUnlocker_impl::extractFileData(char *dst, istream *src, size_t length)
+{
+	// 前のエントリからの持ち越しをコピー
+	const size_t count = reinterpret_cast<char*>(z_.next_out) - output_buffer_ - output_offset_;
+	const size_t copy_length = (count < length) ? count : length;
+	memcpy(dst, output_buffer_ + output_offset_, copy_length);
+	output_offset_ += copy_length;
+	extracted_length_ += copy_length;
+
+	if (copy_length == length)
+	{
+		return ATC_OK;
+	}
+
+	char *const dst_end = dst + length;
+	z_.next_out = reinterpret_cast<Bytef*>(dst + copy_length);
+
+	ATCResult result = ATC_OK;
+	while (reinterpret_cast<char*>(z_.next_out) < dst_end && z_status_ != Z_STREAM_END)
+	{
+		char *const next_out = reinterpret_cast<char*>(z_.next_out);
+
+		if (z_.avail_in == 0)
+		{
+			readDataChunk(src);
+		}
+
+		// avail_out は uInt なので大きなバッファは分けて展開する
+		const size_t rest_length = dst_end - reinterpret_cast<char*>(z_.next_out);
+		z_.avail_out = static_cast<uInt>((rest_length < ATC_PARALLEL_RANGE_SIZE) ? rest_length : ATC_PARALLEL_RANGE_SIZE);
+
+		z_status_ = inflate(&z_, Z_NO_FLUSH);
+		extracted_length_ += reinterpret_cast<char*>(z_.next_out) - next_out;
+
+		if (z_status_ == Z_OK || z_status_ == Z_STREAM_END)
+		{
+			continue;
+		}
+
+		if (data_version_ <= 103 && z_status_ == Z_DATA_ERROR)
+		{
+			// v1.x は他の経路と同じく壊れた所から先も出力したことにする。中身は 0 で埋める
+			const size_t pad_length = dst_end - reinterpret_cast<char*>(z_.next_out);
+			memset(z_.next_out, 0, pad_length);
+			z_.next_out = reinterpret_cast<Bytef*>(dst_end);
+			extracted_length_ += pad_length;
+		} else {
+			// 書庫が途中で切れている（Z_BUF_ERROR）か壊れている
+			result = ATC_ERR_ZLIB_ERROR;
+		}
+		break;
+	}
+
+	// length に届く前にストリームが終わった
+	if (result == ATC_OK && reinterpret_cast<char*>(z_.next_out) < dst_end)
+	{
+		result = ATC_ERR_ZLIB_ERROR;
+	}
+
+	// エントリの終わりまで展開したので output_buffer_ は空
+	z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
+	z_.avail_out = ATC_CHUNK_SIZE;
+	output_offset_ = 0;
+
+	return result;
+}
+
+// 展開したデータを捨てる。output_buffer_ を作業領域にしてそのまま上書きする
+ATCResult ATCUnlocker_impl::skipFileData(istream *src, size_t length)
+{
+	return extractFileData([](const char *, size_t) {
+		return true;
+	}, src, length);
+}
+
+// index 番目のエントリの先頭まで読み飛ばす
+ATCResult ATCUnlocker_impl::skipToEntry(istream *src, size_t index)
+{
+	if (index >= entries_.size())
+	{
+		return ATC_ERR_INVARID_INDEX;
+	}
+
+	int64_t offset = 0;
+	for (size_t i = 0; i < index; ++i)
+	{
+		offset += entries_[i].size;
+	}
+
+	// ストリームは戻れない
+	if (offset < extracted_length_)
+	{
+		return ATC_ERR_INVARID_INDEX;
+	}
+
+	return skipFileData(src, static_cast<size_t>(offset - extracted_length_));
+}
+
+// すべてのエントリを root の下に展開する。ディレクトリを先に作り、ファイルは書き込み用のスレッドに渡す
+ATCResult ATCUnlocker_impl::extractToDirectory(istream *src, const string& root)
+{
+	// ストリームは戻れないので、最初のエントリから
+	if (extracted_length_ != 0)
+	{
+		return ATC_ERR_INVARID_INDEX;
+	}
+
+	vector<string> paths(entries_.size());
+	vector<string> parents(entries_.size());
+	set<string> created;
+
+	for (size_t i = 0; i < entries_.size(); ++i)
+	{
+		const ATCFileEntry& entry = entries_[i];
+#ifdef WIN32
+		const bool sjis = true;
+#else
+		// v1.x のアーカイブには Shift_JIS の名前しかない
+		const bool sjis = entry.name_utf8.empty();
+#endif
+		if (!nativePath(root, sjis ? entry.name_sjis : entry.name_utf8, sjis, &paths[i], &parents[i]))
+		{
+			return ATC_ERR_INVARID_FILE_ENTRY;
+		}
+	}
+
+	for (size_t i = 0; i < entries_.size(); ++i)
+	{
+		if (!makeDirectories(root, (entries_[i].size < 0) ? paths[i] : parents[i], &created))
+		{
+			return ATC_ERR_OSTREAM_FAILURE;
+		}
+	}
+
+	ATCWriterPool pool(static_cast<size_t>(writer_count_));
+
+	for (size_t i = 0; i < entries_.size() && !pool.failed(); ++i)
+	{
+		if (entries_[i].size < 0)
+		{
+			continue;
+		}
+
+		size_t rest_length = static_cast<size_t>(entries_[i].size);
+		bool first = true;
+
+		// 小さいファイルは一度に、大きいファイルは ATC_WRITER_CHUNK_SIZE ごとに渡す
+		do
+		{
+			const size_t length = (rest_length < ATC_WRITER_CHUNK_SIZE) ? rest_length : ATC_WRITER_CHUNK_SIZE;
+
+			ATCWriteTask task;
+			pool.acquire(&task.data, length);
+			if (length > 0)
+			{
+				const ATCResult result = extractFileData(&task.data[0], src, length);
+				if (result != ATC_OK)
+				{
+					pool.finish();
+					return result;
+				}
+			}
+
+			rest_length -= length;
+			task.path = paths[i];
+			task.size = entries_[i].size;
+			task.change_time = entries_[i].change_unix_time;
+			task.first = first;
+			task.last = (rest_length == 0);
+			pool.submit(&task);
+
+			first = false;
+		}
+		while (rest_length > 0);
+	}
+
+	if (!pool.finish())
+	{
+		return ATC_ERR_OSTREAM_FAILURE;
+	}
+
+	// ディレクトリの時刻は、中のファイルを作り終わってから戻す
+	for (size_t i = entries_.size(); i > 0; --i)
+	{
+		if (entries_[i - 1].size < 0)
+		{
+			setChangeTime(paths[i - 1], entries_[i - 1].change_unix_time);
+		}
+	}
+
+	return ATC_OK;
+}
+
+// 一度全体を展開して span ごとにチェックポイントを記録し、暗号化して index に書き出す
+ATCResult ATCUnlocker_impl::buildIndex(istream *src, ostream *index, size_t span)
+{
+	char nonce[ATC_BUF_SIZE];
+	if (!readIndexNonce(src, nonce))
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	ATCResult result = restorePoint(src, nullptr);
+	if (result != ATC_OK)
+	{
+		return result;
+	}
+
+	vector<ATCIndexPoint> points;
+	int64_t last_offset = 0;
+
+	while (z_status_ != Z_STREAM_END)
+	{
+		if (z_.avail_in == 0)
+		{
+			readDataChunk(src);
+		}
+
+		// 展開したデータは捨てる。Z_BLOCK でブロックの境界ごとに戻ってくる
+		z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
+		z_.avail_out = ATC_CHUNK_SIZE;
+		z_status_ = inflate(&z_, Z_BLOCK);
+		extracted_length_ += ATC_CHUNK_SIZE - z_.avail_out;
+
+		if (z_status_ != Z_OK && z_status_ != Z_STREAM_END)
+		{
+			if (z_status_ == Z_BUF_ERROR ||
+				(data_version_ <= 103 && z_status_ == Z_DATA_ERROR))
+			{
+				// 壊れた部分より先にはチェックポイントを置かない
+				break;
+			}
+			return ATC_ERR_ZLIB_ERROR;
+		}
+
+		// 最後ではないブロックの先頭
+		if ((z_.data_type & 128) && !(z_.data_type & 64) &&
+			extracted_length_ - last_offset >= static_cast<int64_t>(span))
+		{
+			ATCIndexPoint point;
+			point.output_offset = extracted_length_;
+			point.input_offset = z_.total_in;
+			point.bits = z_.data_type & 7;
+			point.window.resize(ATC_DEFLATE_WINDOW_SIZE);
+
+			uInt window_length = ATC_DEFLATE_WINDOW_SIZE;
+			if (inflateGetDictionary(&z_, reinterpret_cast<Bytef*>(&point.window[0]), &window_length) != Z_OK)
+			{
+				return ATC_ERR_ZLIB_ERROR;
+			}
+			point.window.resize(window_length);
+
+			points.push_back(point);
+			last_offset = extracted_length_;
+		}
+	}
+
+	// 書式: 識別子、バージョン、データ本体のサイズ、チェックポイント。暗号化した後に MAC を付ける
+	stringstream pms;
+	pms.write("ATCIndex", 8);
+
+	const int32_t version = ATC_INDEX_VERSION;
+	const int32_t count = static_cast<int32_t>(points.size());
+	pms.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	pms.write(reinterpret_cast<const char*>(&total_length_), sizeof(total_length_));
+	pms.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		const ATCIndexPoint& point = points[i];
+		const int32_t window_length = static_cast<int32_t>(point.window.size());
+		pms.write(reinterpret_cast<const char*>(&point.output_offset), sizeof(point.output_offset));
+		pms.write(reinterpret_cast<const char*>(&point.input_offset), sizeof(point.input_offset));
+		pms.write(reinterpret_cast<const char*>(&point.bits), sizeof(point.bits));
+		pms.write(reinterpret_cast<const char*>(&window_length), sizeof(window_length));
+		pms.write(&point.window[0], window_length);
+	}
+
+	string data = pms.str();
+	cryptIndex(&data[0], data.size(), nonce);
+
+	char mac[ATC_BUF_SIZE];
+	macIndex(data.data(), data.size(), nonce, mac);
+	data.append(mac, ATC_BUF_SIZE);
+
+	index->write(data.data(), data.size());
+
+	index_points_.swap(points);
+
+	// 最初のエントリから読めるように戻す
+	return restorePoint(src, nullptr);
+}
+
+// buildIndex で書き出したインデックスを読み込む
+ATCResult ATCUnlocker_impl::loadIndex(istream *src, istream *index)
+{
+	char nonce[ATC_BUF_SIZE];
+	if (!readIndexNonce(src, nonce))
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	stringstream buffer;
+	buffer << index->rdbuf();
+	string data = buffer.str();
+
+	const size_t header_size = 8 + sizeof(int32_t) + sizeof(int64_t) + sizeof(int32_t);
+	if (data.size() < header_size + ATC_BUF_SIZE)
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	// 改ざんも鍵やアーカイブの違いも MAC で分かる。比べる時間は一致したバイト数によらない
+	const size_t body_size = data.size() - ATC_BUF_SIZE;
+	char mac[ATC_BUF_SIZE];
+	macIndex(data.data(), body_size, nonce, mac);
+
+	char diff = 0;
+	for (int i = 0; i < ATC_BUF_SIZE; ++i)
+	{
+		diff |= mac[i] ^ data[body_size + i];
+	}
+	if (diff != 0)
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	cryptIndex(&data[0], body_size, nonce);
+	if (data.compare(0, 8, "ATCIndex") != 0)
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	const char *cursor = data.data() + 8;
+	const char *const end = data.data() + body_size;
+
+	int32_t version, count;
+	int64_t total_length;
+	memcpy(&version, cursor, sizeof(version)); cursor += sizeof(version);
+	memcpy(&total_length, cursor, sizeof(total_length)); cursor += sizeof(total_length);
+	memcpy(&count, cursor, sizeof(count)); cursor += sizeof(count);
+
+	if (version != ATC_INDEX_VERSION || total_length != total_length_ || count < 0)
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	vector<ATCIndexPoint> points(count);
+	const size_t point_size = sizeof(int64_t) * 2 + sizeof(int32_t) * 2;
+	for (int32_t i = 0; i < count; ++i)
+	{
+		ATCIndexPoint& point = points[i];
+		int32_t window_length;
+
+		if (static_cast<size_t>(end - cursor) < point_size)
+		{
+			return ATC_ERR_BROKEN_INDEX;
+		}
+		memcpy(&point.output_offset, cursor, sizeof(point.output_offset)); cursor += sizeof(point.output_offset);
+		memcpy(&point.input_offset, cursor, sizeof(point.input_offset)); cursor += sizeof(point.input_offset);
+		memcpy(&point.bits, cursor, sizeof(point.bits)); cursor += sizeof(point.bits);
+		memcpy(&window_length, cursor, sizeof(window_length)); cursor += sizeof(window_length);
+
+		if (window_length < 0 || window_length > ATC_DEFLATE_WINDOW_SIZE || end - cursor < window_length ||
+			point.bits < 0 || point.bits > 7 || point.input_offset <= 0 ||
+			(i > 0 && point.output_offset <= points[i - 1].output_offset))
+		{
+			return ATC_ERR_BROKEN_INDEX;
+		}
+		point.window.assign(cursor, cursor + window_length);
+		cursor += window_length;
+	}
+
+	index_points_.swap(points);
+	return ATC_OK;
+}
+
+// index 番目のエントリの先頭へ移動する。チェックポイントがあればそこから展開する
+ATCResult ATCUnlocker_impl::seekToEntry(istream *src, size_t index)
+{
+	if (index >= entries_.size())
+	{
+		return ATC_ERR_INVARID_INDEX;
+	}
+
+	int64_t offset = 0;
+	for (size_t i = 0; i < index; ++i)
+	{
+		offset += entries_[i].size;
+	}
+
+	// offset より手前で一番近いチェックポイント
+	const ATCIndexPoint *point = nullptr;
+	for (size_t i = 0; i < index_points_.size() && index_points_[i].output_offset <= offset; ++i)
+	{
+		point = &index_points_[i];
+	}
+
+	const int64_t point_offset = point ? point->output_offset : 0;
+	if (offset < extracted_length_ || point_offset > extracted_length_)
+	{
+		const ATCResult result = restorePoint(src, point);
+		if (result != ATC_OK)
+		{
+			return result;
+		}
+	}
+
+	return skipFileData(src, static_cast<size_t>(offset - extracted_length_));
+}
+
+// point（nullptr ならデータ本体の先頭）から展開を再開する
+ATCResult ATCUnlocker_impl::restorePoint(istream *src, const ATCIndexPoint *point)
+{
+	if (!(src = source(src)))
+	{
+		return ATC_ERR_INVARID_INDEX;
+	}
+
+	stopReadAhead(true);
+
+	const int64_t input_offset = point ? point->input_offset : 0;
+	const int32_t bits = point ? point->bits : 0;
+
+	// 未使用のビットが残っているバイトを含む暗号ブロックから読む
+	const int64_t block_offset = (input_offset - (bits ? 1 : 0)) / ATC_BUF_SIZE * ATC_BUF_SIZE;
+
+	src->clear();
+	if (data_version_ > 103)
+	{
+		// CBC の IV は直前の暗号文ブロック（先頭ならアーカイブの IV）
+		src->seekg(static_cast<streamoff>(data_offset_ + block_offset - ATC_BUF_SIZE), ios::beg);
+		src->read(chain_buffer_, ATC_BUF_SIZE);
+	} else {
+		src->seekg(static_cast<streamoff>(data_offset_ + block_offset), ios::beg);
+	}
+
+	// チェックポイントからは zlib ヘッダのない raw deflate として展開する
+	if (inflateReset2(&z_, point ? -MAX_WBITS : MAX_WBITS) != Z_OK)
+	{
+		return ATC_ERR_ZLIB_ERROR;
+	}
+
+	total_read_length_ = block_offset;
+	z_.avail_in = 0;
+	readDataChunk(src);
+
+	const size_t skip_length = static_cast<size_t>(input_offset - block_offset);
+	if (skip_length > z_.avail_in)
+	{
+		return ATC_ERR_BROKEN_INDEX;
+	}
+
+	if (bits)
+	{
+		const int value = static_cast<unsigned char>(z_.next_in[skip_length - 1]) >> (8 - bits);
+		if (inflatePrime(&z_, bits, value) != Z_OK)
+		{
+			return ATC_ERR_ZLIB_ERROR;
+		}
+	}
+	z_.next_in += skip_length;
+	z_.avail_in -= static_cast<uInt>(skip_length);
+
+	if (point && !point->window.empty() &&
+		inflateSetDictionary(&z_, reinterpret_cast<const Bytef*>(&point->window[0]), static_cast<uInt>(point->window.size())) != Z_OK)
+	{
+		return ATC_ERR_ZLIB_ERROR;
+	}
+
+	z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
+	z_.avail_out = ATC_CHUNK_SIZE;
+	z_status_ = Z_OK;
+	output_offset_ = 0;
+	extracted_length_ = point ? point->output_offset : 0;
+
+	return ATC_OK;
+}
+
+// インデックスの鍵ストリームの種。データ本体の最初の暗号文ブロックでアーカイブと結び付ける
+bool ATCUnlocker_impl::readIndexNonce(istream *src, char nonce[ATC_BUF_SIZE])
+{
+	static const char tag[ATC_BUF_SIZE + 1] = "AttacheCase checkpoint index ...";
+
+	if (!(src = source(src)))
+	{
+		return false;
+	}
+
+	// 先読みしたチャンクは残して、src の位置だけ借りる
+	stopReadAhead(false);
+
+	const istream::pos_type cursor = src->tellg();
+	src->clear();
+	src->seekg(static_cast<streamoff>(data_offset_), ios::beg);
+	const bool result = (src->read(nonce, ATC_BUF_SIZE).gcount() == ATC_BUF_SIZE);
+	src->clear();
+	src->seekg(cursor);
+
+	for (int i = 0; i < ATC_BUF_SIZE; ++i)
+	{
+		nonce[i] ^= tag[i];
+	}
+
+	return result;
+}
+
+// インデックスを CTR モードで暗号化・復号する
+// 復号用に展開した鍵しかないこともあるので、ブロック暗号は復号方向だけを使う
+void ATCUnlocker_impl::cryptIndex(char *data, size_t length, const char nonce[ATC_BUF_SIZE]) const
+{
+	char counter[ATC_BUF_SIZE];
+	char stream[ATC_BUF_SIZE];
+
+	for (uint64_t block = 0; length > 0; ++block)
+	{
+		memcpy(counter, nonce, ATC_BUF_SIZE);
+		for (int i = 0; i < 8; ++i)
+		{
+			counter[ATC_BUF_SIZE - 1 - i] ^= static_cast<char>(block >> (i * 8));
+		}
+
+		if (data_version_ <= 103)
+		{
+			blowfish_->Decrypt(stream, counter, ATC_BUF_SIZE);
+		} else {
+			rijndael_->DecryptBlock(counter, stream);
+		}
+
+		const size_t n = (length < ATC_BUF_SIZE) ? length : ATC_BUF_SIZE;
+		for (size_t i = 0; i < n; ++i)
+		{
+			data[i] ^= stream[i];
+		}
+		data += n;
+		length -= n;
+	}
+}
+
+// 暗号化したインデックスの CBC-MAC。鍵はアーカイブの鍵から導いた別の鍵で、
+// 先頭に nonce と長さのブロックを置くので、長さの違うインデックスや別のアーカイブのものとは一致しない
+void ATCUnlocker_impl::macIndex(const char *data, size_t length, const char nonce[ATC_BUF_SIZE], char mac[ATC_BUF_SIZE]) const
+{
+	static const char label[ATC_BUF_SIZE + 1] = "AttacheCase index MAC subkey ...";
+
+	char subkey[ATC_BUF_SIZE];
+	Blowfish blowfish;
+	CRijndael256 rijndael;
+
+	if (data_version_ <= 103)
+	{
+		blowfish_->Decrypt(subkey, label, ATC_BUF_SIZE);
+		blowfish.SetKey(subkey, ATC_BUF_SIZE);
+	} else {
+		rijndael_->DecryptBlock(label, subkey);
+		rijndael.MakeKey(subkey, CRijndael256::ENCRYPTION);
+	}
+
+	memset(mac, 0, ATC_BUF_SIZE);
+
+	const auto update = [&](const char block[ATC_BUF_SIZE]) {
+		if (data_version_ <= 103)
+		{
+			// 64 ビットのブロックごとにつなぐ
+			const char *chain = mac + ATC_BUF_SIZE - 8;
+			for (int i = 0; i < ATC_BUF_SIZE; i += 8)
+			{
+				char input[8];
+				for (int j = 0; j < 8; ++j)
+				{
+					input[j] = chain[j] ^ block[i + j];
+				}
+				blowfish.Encrypt(mac + i, input, 8);
+				chain = mac + i;
+			}
+		} else {
+			char input[ATC_BUF_SIZE];
+			for (int i = 0; i < ATC_BUF_SIZE; ++i)
+			{
+				input[i] = mac[i] ^ block[i];
+			}
+			rijndael.EncryptBlock(input, mac);
+		}
+	};
+
+	char block[ATC_BUF_SIZE] = {0};
+	const uint64_t length64 = length;
+	memcpy(block, &length64, sizeof(length64));
+
+	update(nonce);
+	update(block);
+
+	// 最後のブロックは 0 で埋める
+	for (size_t offset = 0; offset < length; offset += ATC_BUF_SIZE)
+	{
+		const size_t n = (length - offset < ATC_BUF_SIZE) ? length - offset : ATC_BUF_SIZE;
+		memset(block, 0, ATC_BUF_SIZE);
+		memcpy(block, data + offset, n);
+		update(block);
+	}
+}
+
+// 暗号化されたデータを読んで復号し、inflate の入力にする
+void ATCUnlocker_impl::readDataChunk(istream *src)
+{
+	// 複数スレッドで復号する場合はスレッド数分の範囲をまとめて読む
+	const streamsize buffer_size = (thread_count_ > 1) ?
+		static_cast<streamsize>(thread_count_) * ATC_PARALLEL_RANGE_SIZE : ATC_CHUNK_SIZE;
+
+#ifdef ATC_USE_THREADS
+	// 先読みをやめた後も、キューに残っているチャンクは先に使う
+	if ((read_ahead_ || read_ahead_thread_.joinable() || (read_ahead_queue_ && !read_ahead_queue_->empty())) &&
+		readAheadChunk(src, buffer_size))
+	{
+		return;
+	}
+#endif
+
+	char *buffer = input_buffer_;
+	if (thread_count_ > 1)
+	{
+		parallel_buffer_.resize(static_cast<size_t>(buffer_size));
+		buffer = &parallel_buffer_[0];
+	}
+
+	z_.next_in = reinterpret_cast<Bytef*>(buffer);
+	z_.avail_in = fetchDataChunk(src, buffer, buffer_size);
+}
+
+// src から buffer_size まで読んで buffer に復号し、inflate に渡す長さを返す
+uInt ATCUnlocker_impl::fetchDataChunk(istream *src, char *buffer, streamsize buffer_size)
+{
+	// openBuffer のデータは istream を通さずに直接復号する
+	if (!src && memory_buffer_)
+	{
+		size_t read_length;
+		const char *data = memory_buffer_->take(static_cast<size_t>(nextChunkLength(buffer_size)), &read_length);
+		return decryptDataChunk(buffer, static_cast<streamsize>(read_length), data);
+	}
 
-		blowfish_.SetKey(key_str);
+	const streamsize read_length = (src = source(src)) ? src->read(buffer, nextChunkLength(buffer_size)).gcount() : 0;
+	return decryptDataChunk(buffer, read_length);
+}
 
-		encrypted_header_size = *reinterpret_cast<int32_t*>(plain_header_info);
+#ifdef ATC_USE_THREADS
+// 先読みのスレッドが復号したチャンクを inflate の入力にする
+// 読み込みと復号は inflate と重なり、チャンクの区切りは readDataChunk と同じになる
+// スレッドを作れないか先読みをやめて、キューも空なら false を返す
+bool ATCUnlocker_impl::readAheadChunk(istream *src, streamsize buffer_size)
+{
+	// 前のチャンクは inflate が使い終わっている
+	if (read_ahead_chunk_)
+	{
+		read_ahead_queue_->release();
+		read_ahead_chunk_ = false;
 	}
-	else
+
+	// 別のストリームから読む場合は先読みした分を捨てる
+	if (source(src) != source(read_ahead_src_))
 	{
-		// 104 ～
-		// Rijndaelで暗号化されている
+		stopReadAhead(true);
+	}
 
-		src->read(reinterpret_cast<char*>(&algorism_type_), sizeof(algorism_type_));
-		src->read(reinterpret_cast<char*>(&encrypted_header_size), sizeof(encrypted_header_size));
+	if (!read_ahead_thread_.joinable() && read_ahead_)
+	{
+		startReadAhead(src, buffer_size);
+	}
 
-		// データサブバージョンチェック（ver.2.70～）
-		if (plain_header_info[0] >= 6)
+	while (1)
+	{
+		if (!read_ahead_thread_.joinable() && (!read_ahead_queue_ || read_ahead_queue_->empty()))
 		{
-			passwd_try_limit_ = plain_header_info[2];
-			self_destruction_ = (plain_header_info[3] == 0) ? false : true;
-
-			// 有効範囲（1～10）かチェック
-			if (passwd_try_limit_ < ATC_MIN_PASSWORD_TRY_LIMIT ||
-					passwd_try_limit_ > ATC_MAX_PASSWORD_TRY_LIMIT)
-			{
-				passwd_try_limit_ = ATC_DEFAULT_PASSWORD_TRY_LIMIT;
-			}
+			return false;
 		}
-		else
+
+		ATCChunkQueue::Chunk *chunk = read_ahead_queue_->front();
+		if (chunk)
 		{
-			passwd_try_limit_ = ATC_DEFAULT_PASSWORD_TRY_LIMIT;
-			self_destruction_ = false;
+			z_.next_in = reinterpret_cast<Bytef*>(&chunk->data[0]);
+			z_.avail_in = static_cast<uInt>(chunk->length);
+			read_ahead_chunk_ = true;
+			return true;
 		}
 
-		// IVの読み込み
-		src->read(chain_buffer_, ATC_BUF_SIZE);
-
-		// キーをセット
-		rijndael_.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		// データ本体の終わりまで読んだ。壊れたデータで続きを読む場合はもう一度始める
+		stopReadAhead(false);
+		if (read_ahead_)
+		{
+			startReadAhead(src, buffer_size);
+		}
 	}
-	
-	stringstream pms;
-	streamsize len = 0;
-	while (len < encrypted_header_size)
-	{
-		char source_buffer[ATC_BUF_SIZE] = {0};
-		len += src->read(source_buffer, ATC_BUF_SIZE).gcount();
+}
 
-		if (data_version_ <= 103)
+bool ATCUnlocker_impl::startReadAhead(istream *src, streamsize buffer_size)
+{
+	if (!read_ahead_queue_ || read_ahead_queue_->chunk_size() != static_cast<size_t>(buffer_size))
+	{
+		if (read_ahead_queue_ && !read_ahead_queue_->empty())
 		{
-			decryptBufferBlowfish(source_buffer);
-		} else {
-			decryptBufferRijndael(source_buffer, chain_buffer_);
+			// 大きさの違うチャンクが残っている
+			return false;
 		}
+		read_ahead_queue_.reset(new ATCChunkQueue(ATC_PIPELINE_DEPTH, static_cast<size_t>(buffer_size)));
+	}
 
-		// 最初のブロックで復号に成功したかどうかチェック
-		if (len == ATC_BUF_SIZE)
+	read_ahead_src_ = src;
+	ATCChunkQueue& queue = *read_ahead_queue_;
+
+	try
+	{
+		// total_read_length_、chain_buffer_ と src はスレッドが終わるまでスレッドのもの
+		read_ahead_thread_ = thread([this, src, &queue]()
 		{
-			if (string(source_buffer, ATC_BUF_SIZE).find("Passcode") == string::npos)
+			do
 			{
-				src->clear();
-				src->seekg(0, ios::beg);
-				return ATC_ERR_WRONG_KEY;
+				ATCChunkQueue::Chunk *chunk = queue.acquire();
+				if (!chunk)
+				{
+					break;
+				}
+				chunk->length = fetchDataChunk(src, &chunk->data[0], static_cast<streamsize>(chunk->data.size()));
+				queue.commit();
 			}
-		}
+			while (total_read_length_ < total_length_);
 
-		pms.write(source_buffer, ATC_BUF_SIZE);
+			queue.close();
+		});
 	}
-
-	// ヘッダのファイルエントリを解析
-	if(!parseHeaderEntries(&pms))
+	catch (...)
 	{
-		return ATC_ERR_BROKEN_HEADER;
+		return false;
 	}
 
-	ifstream::pos_type cursor = src->tellg();
-	src->seekg(0, ios::end);
-	ifstream::pos_type file_length = src->tellg();
-	src->seekg(cursor);
-
-	// ファイル（データ本体）サイズを取得する
-	total_length_ = file_length - cursor - ATC_BUF_SIZE;
+	return true;
+}
+#endif
 
-	if (data_version_ > 103)
+// 先読みのスレッドを止める。discard なら先読みしたチャンクも捨てる
+void ATCUnlocker_impl::stopReadAhead(bool discard)
+{
+#ifdef ATC_USE_THREADS
+	if (read_ahead_thread_.joinable())
 	{
-		// IVの読み出し
-		src->read(chain_buffer_, ATC_BUF_SIZE);
+		read_ahead_queue_->cancel();
+		read_ahead_thread_.join();
 	}
 
-	if (!initZlib())
+	if (read_ahead_queue_)
 	{
-		return ATC_ERR_ZLIB_ERROR;
+		if (discard)
+		{
+			read_ahead_queue_->reset();
+			read_ahead_chunk_ = false;
+			read_ahead_src_ = nullptr;
+		} else {
+			read_ahead_queue_->resume();
+		}
 	}
+#endif
+}
 
-	return ATC_OK;
+// src が nullptr なら openBuffer で開いたバッファから読む
+istream *ATCUnlocker_impl::source(istream *src) const
+{
+	return src ? src : memory_stream_.get();
 }
 
-ATCResult ATCUnlocker_impl::close()
+// output_buffer_ を書き出し終えていれば先頭に戻し、続きを展開する
+ATCResult ATCUnlocker_impl::inflateOutput()
 {
-	if (inflateEnd(&z_) != Z_OK)
+	if (output_offset_ == static_cast<size_t>(reinterpret_cast<char*>(z_.next_out) - output_buffer_))
 	{
-		return ATC_ERR_ZLIB_ERROR;
-	} else {
-		return ATC_OK;
+		z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
+		z_.avail_out = ATC_CHUNK_SIZE;
+		output_offset_ = 0;
 	}
+
+	return inflateData();
 }
 
-ATCResult ATCUnlocker_impl::getEntry(ATCFileEntry *entry, size_t index)
+// z_.next_out に展開する
+ATCResult ATCUnlocker_impl::inflateData()
 {
-	if (index < entries_.size())
+	z_status_ = inflate(&z_, Z_NO_FLUSH);
+
+	if (z_status_ != Z_OK && z_status_ != Z_STREAM_END)
 	{
-		*entry = entries_.at(index);
-		return ATC_OK;
-	} else {
-		return ATC_ERR_INVARID_INDEX;
+		if (z_status_ == Z_BUF_ERROR ||
+			(data_version_ <= 103 && z_status_ == Z_DATA_ERROR))
+		{
+			// バッファの残りもそのまま出力する
+			z_.next_out += z_.avail_out;
+			z_.avail_out = 0;
+		} else {
+			return ATC_ERR_ZLIB_ERROR;
+		}
 	}
+
+	return ATC_OK;
 }
 
-ATCResult ATCUnlocker_impl::extractFileData(ostream *dst, istream *src, size_t length)
+void ATCUnlocker_impl::decryptBufferRijndael(char data_buffer[ATC_BUF_SIZE], char iv_buffer[ATC_BUF_SIZE])
 {
-	while (z_status_ != Z_STREAM_END)
-	{
-		if (z_.avail_in == 0)
-		{
-			z_.next_in = reinterpret_cast<Bytef*>(input_buffer_);
-			
-			const streamsize read_length = src->read(input_buffer_, ATC_BUF_SIZE).gcount();
-			total_read_length_ += read_length;
+	// 復号処理、xor、iv の更新
+	rijndael_->DecryptCBC(data_buffer, data_buffer, ATC_BUF_SIZE, iv_buffer);
+}
 
-			if (data_version_ <= 103)
-			{
-				decryptBufferBlowfish(input_buffer_);
-			} else {
-				decryptBufferRijndael(input_buffer_, chain_buffer_);
-			}
+streamsize ATCUnlocker_impl::nextChunkLength(streamsize max_length) const
+{
+	// データ本体の残りをブロック単位で読む（最大 max_length）
+	const int64_t rest_length = total_length_ - total_read_length_;
 
-			z_.avail_in = static_cast<uInt>(read_length);
+	if (rest_length <= 0)
+	{
+		return ATC_BUF_SIZE;
+	}
+	else if (rest_length >= max_length)
+	{
+		return max_length;
+	}
 
-			// 最終ブロック
-			if (total_read_length_ >= total_length_)
-			{
-				char padding_num = input_buffer_[ATC_BUF_SIZE - 1];
+	return static_cast<streamsize>((rest_length + ATC_BUF_SIZE - 1) / ATC_BUF_SIZE * ATC_BUF_SIZE);
+}
 
-				if (padding_num > -1)
-				{
-					size_t i = 0;
-					for (i = 0; i < ATC_BUF_SIZE; ++i)
-					{
-						if (input_buffer_[ATC_BUF_SIZE - 1 - i] !=  padding_num)
-						{
-							break;
-						}
-					}
-
-					if (padding_num == i)
-					{
-						z_.avail_in = ATC_BUF_SIZE - i;
-					}
-				}
-			}
-		}
+// source があればそこから buffer に復号する（なければ buffer をその場で復号する）
+// 最後のブロックのパディングを除いた長さを返す
+uInt ATCUnlocker_impl::decryptDataChunk(char *buffer, streamsize read_length, const char *source)
+{
+	total_read_length_ += read_length;
 
-		z_status_ = inflate(&z_, Z_NO_FLUSH);
+	const size_t block_length = static_cast<size_t>(read_length + ATC_BUF_SIZE - 1) / ATC_BUF_SIZE * ATC_BUF_SIZE;
 
-		if (z_status_ == Z_STREAM_END)
+	if (source && (data_version_ <= 103 || thread_count_ > 1 || static_cast<size_t>(read_length) != block_length))
+	{
+		memcpy(buffer, source, static_cast<size_t>(read_length));
+		source = nullptr;
+	}
+
+	if (block_length > 0)
+	{
+		if (source)
 		{
-			break;
+			rijndael_->DecryptCBC(source, buffer, block_length, chain_buffer_);
 		}
-
-		if (z_status_ != Z_OK)
+		else if (data_version_ <= 103)
 		{
-			if (z_status_ == Z_BUF_ERROR)
-			{
-				z_.avail_out = 0;
-			} else 
-			if (data_version_ <= 103 && z_status_ == Z_DATA_ERROR)
-			{
-				z_.avail_out = 0;
-			} else {
-				return ATC_ERR_ZLIB_ERROR;
-			}
+			decryptBlowfish(buffer, block_length);
 		}
-
-		if (z_.avail_out == 0)
+		else if (thread_count_ > 1 && block_length > ATC_PARALLEL_RANGE_SIZE)
 		{
-			tmp_buffer_ += string(output_buffer_, ATC_LARGE_BUF_SIZE);
+			decryptRijndaelParallel(buffer, block_length);
+		} else {
+			rijndael_->DecryptCBC(buffer, buffer, block_length, chain_buffer_);
+		}
+	}
+
+	uInt length = static_cast<uInt>(read_length);
+
+	// 最終ブロック
+	if (total_read_length_ >= total_length_ && block_length > 0)
+	{
+		const char *last_block = buffer + block_length - ATC_BUF_SIZE;
+		char padding_num = last_block[ATC_BUF_SIZE - 1];
 
-			z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
-			z_.avail_out = ATC_LARGE_BUF_SIZE;
+		if (padding_num > -1)
+		{
+			size_t i = 0;
+			for (i = 0; i < ATC_BUF_SIZE; ++i)
+			{
+				if (last_block[ATC_BUF_SIZE - 1 - i] !=  padding_num)
+				{
+					break;
+				}
+			}
 
-			// 要求サイズを超えていた場合
-			if (tmp_buffer_.size() >= length)
+			if (padding_num == i)
 			{
-				break;
+				length = static_cast<uInt>(block_length - i);
 			}
 		}
 	}
 
-	if (z_status_ == Z_STREAM_END)
+	return length;
+}
+
+void ATCUnlocker_impl::decryptRijndaelParallel(char *buffer, size_t block_length)
+{
+	const size_t range_count = (block_length + ATC_PARALLEL_RANGE_SIZE - 1) / ATC_PARALLEL_RANGE_SIZE;
+
+	// 各範囲の IV は直前の範囲の最後の暗号文ブロック（復号で上書きされる前によけておく）
+	vector<char> chains(range_count * ATC_BUF_SIZE);
+	memcpy(&chains[0], chain_buffer_, ATC_BUF_SIZE);
+	for (size_t i = 1; i < range_count; ++i)
 	{
-		/* 残りを吐き出す */
-		size_t count = 0;
-		if ((count = ATC_LARGE_BUF_SIZE - z_.avail_out) != 0)
-		{
-			tmp_buffer_ += string(output_buffer_, count);
-		}
+		memcpy(&chains[i * ATC_BUF_SIZE], buffer + i * ATC_PARALLEL_RANGE_SIZE - ATC_BUF_SIZE, ATC_BUF_SIZE);
 	}
+	memcpy(chain_buffer_, buffer + block_length - ATC_BUF_SIZE, ATC_BUF_SIZE);
 
-	const size_t tmp_buffer_size = tmp_buffer_.size();
-	const size_t out_length = (tmp_buffer_size >= length) ? length : tmp_buffer_size;
-
-	dst->write(tmp_buffer_.data(), out_length);
-	tmp_buffer_.erase(0, out_length);
+	const CRijndael256& rijndael = *rijndael_;
+	char *chains_data = &chains[0];
 
-	return ATC_OK;
+	runParallel(range_count, [&rijndael, buffer, block_length, chains_data](size_t i)
+	{
+		const size_t begin = i * ATC_PARALLEL_RANGE_SIZE;
+		const size_t length = std::min<size_t>(ATC_PARALLEL_RANGE_SIZE, block_length - begin);
+		rijndael.DecryptCBC(buffer + begin, buffer + begin, length, chains_data + i * ATC_BUF_SIZE);
+	});
 }
 
-void ATCUnlocker_impl::decryptBufferRijndael(char data_buffer[ATC_BUF_SIZE], char iv_buffer[ATC_BUF_SIZE])
+void ATCUnlocker_impl::decryptBlowfish(char *buffer, size_t block_length)
 {
-	char temp_buffer[ATC_BUF_SIZE] = {0};
-
-	// あとのxorのためによけておく
-	memcpy(temp_buffer, data_buffer, ATC_BUF_SIZE);
+	// ECB なので範囲ごとに別々のスレッドで復号できる
+	const size_t range_count = (thread_count_ > 1) ?
+		(block_length + ATC_PARALLEL_RANGE_SIZE - 1) / ATC_PARALLEL_RANGE_SIZE : 1;
 
-	// 復号処理
-	rijndael_.DecryptBlock(data_buffer, data_buffer);
-
-	// xor
-	for (int c = 0; c < ATC_BUF_SIZE; c++)
+	if (range_count <= 1)
 	{
-		data_buffer[c] ^= iv_buffer[c];
+		blowfish_->Decrypt(buffer, buffer, block_length);
+		return;
 	}
 
-	memcpy(iv_buffer, temp_buffer, ATC_BUF_SIZE);
+	const Blowfish& blowfish = *blowfish_;
+
+	runParallel(range_count, [&blowfish, buffer, block_length](size_t i)
+	{
+		const size_t begin = i * ATC_PARALLEL_RANGE_SIZE;
+		const size_t length = std::min<size_t>(ATC_PARALLEL_RANGE_SIZE, block_length - begin);
+		blowfish.Decrypt(buffer + begin, buffer + begin, length);
+	});
 }
 
 void ATCUnlocker_impl::decryptBufferBlowfish(char data_buffer[ATC_BUF_SIZE])
 {
-    char data_buffer_tmp[ATC_BUF_SIZE];
-    blowfish_.Decrypt(data_buffer_tmp, data_buffer, ATC_BUF_SIZE);
-    memcpy(data_buffer, data_buffer_tmp, ATC_BUF_SIZE);
+	blowfish_->Decrypt(data_buffer, data_buffer, ATC_BUF_SIZE);
 }
 
 namespace {
@@ -443,14 +1379,22 @@ bool ATCUnlocker_impl::parseFileEntry(ATCFileEntry *entry, const std::string& ts
 
 bool ATCUnlocker_impl::initZlib()
 {
-	// zlib準備
-	z_.zalloc = Z_NULL;
-	z_.zfree = Z_NULL;
-	z_.opaque = Z_NULL;
-
-	if (inflateInit(&z_) != Z_OK)
+	// zlib準備（前のアーカイブで使った z_stream があればリセットして使う）
+	if (z_ready_)
 	{
-		return false;
+		// チェックポイントから raw deflate として展開していた場合もあるので、zlib 形式に戻す
+		if (inflateReset2(&z_, MAX_WBITS) != Z_OK)
+		{
+			return false;
+		}
+	} else {
+		setZlibPool(&z_);
+
+		if (inflateInit(&z_) != Z_OK)
+		{
+			return false;
+		}
+		z_ready_ = true;
 	}
 
 	// 通常は deflate() の第2引数は Z_NO_FLUSH にして呼び出す
@@ -458,8 +1402,11 @@ bool ATCUnlocker_impl::initZlib()
 
 	z_.avail_in  = 0;
 	z_.next_in   = Z_NULL;
+	total_read_length_ = 0;
 	z_.next_out  = reinterpret_cast<Bytef*>(output_buffer_);
-	z_.avail_out = ATC_LARGE_BUF_SIZE;
+	z_.avail_out = ATC_CHUNK_SIZE;
+	output_offset_ = 0;
+	extracted_length_ = 0;
 	z_status_    = Z_OK;
 
 	return true;
@@ -468,6 +1415,7 @@ bool ATCUnlocker_impl::initZlib()
 bool ATCUnlocker_impl::parseHeaderEntries(stringstream *pms)
 {
 	pms->seekg(0, ios::beg);
+	entries_.clear();
 
 	vector<string> DataList;
 	while (!pms->eof())
@@ -556,6 +1504,50 @@ bool ATCUnlocker_impl::self_destruction() const
 	return self_destruction_;
 }
 
+int ATCUnlocker_impl::thread_count() const
+{
+	return thread_count_;
+}
+
+bool ATCUnlocker_impl::read_ahead() const
+{
+	return read_ahead_;
+}
+
+int ATCUnlocker_impl::writer_count() const
+{
+	return writer_count_;
+}
+
+void ATCUnlocker_impl::set_thread_count(int thread_count)
+{
+	// 0 以下ならプロセッサの数
+	if (thread_count <= 0)
+	{
+#ifdef ATC_USE_THREADS
+		thread_count = static_cast<int>(thread::hardware_concurrency());
+#endif
+		if (thread_count <= 0)
+		{
+			thread_count = 1;
+		}
+	}
+
+	thread_count_ = thread_count;
+}
+
+void ATCUnlocker_impl::set_read_ahead(bool read_ahead)
+{
+	// C++/CLI では常にこのスレッドで読む
+	read_ahead_ = read_ahead;
+}
+
+void ATCUnlocker_impl::set_writer_count(int writer_count)
+{
+	// C++/CLI では常にこのスレッドで書く
+	writer_count_ = (writer_count > 0) ? writer_count : 1;
+}
+
 
 #ifdef USE_CLI
 
@@ -661,13 +1653,8 @@ ATCResult ATCUnlocker_impl::open(Stream ^src, array<System::Byte, 1> ^key)
 	else if (data_version_ <= 103)
 	{
 		pin_ptr<System::Byte> key_native = &key_buffer[0];
-		const char *str_end = find(reinterpret_cast<char*>(&key_native[0]),
-			reinterpret_cast<char*>(&key_native[ATC_KEY_SIZE - 1]), '\0');
-
-		string key_str = string(reinterpret_cast<char*>(&key_native[0]), str_end) + PASS_FOOTER;
+		blowfish_ = ATCLegacyKey(reinterpret_cast<char*>(&key_native[0])).blowfish_;
 		key_native = nullptr;
-
-		blowfish_.SetKey(reinterpret_cast<const unsigned char*>(key_str.data()), key_str.size());
 		
 		pin_ptr<System::Byte> plain_header_info_native = &plain_header_info[0];
 		encrypted_header_size = *reinterpret_cast<int32_t*>(plain_header_info_native);
@@ -705,8 +1692,7 @@ ATCResult ATCUnlocker_impl::open(Stream ^src, array<System::Byte, 1> ^key)
 		// キーをセット
 		{
 			pin_ptr<System::Byte> buffer_native = &key_buffer[0];
-			rijndael_.MakeKey(reinterpret_cast<const char*>(buffer_native),
-				CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+			rijndael_ = ATCKey(reinterpret_cast<const char*>(buffer_native), ATC_KEY_DECRYPTION).rijndael_;
 
 			buffer_native = nullptr;
 		}
@@ -773,119 +1759,59 @@ ATCResult ATCUnlocker_impl::open(Stream ^src, array<System::Byte, 1> ^key)
 
 ATCResult ATCUnlocker_impl::extractFileData(Stream ^dst, Stream ^src, size_t length)
 {
-	while (z_status_ != Z_STREAM_END)
+	size_t rest_length = length;
+
+	while (rest_length > 0)
 	{
-		if (z_.avail_in == 0)
+		// 展開済みのデータ（前のエントリからの持ち越しを含む）を先に書き出す
+		const size_t count = reinterpret_cast<char*>(z_.next_out) - output_buffer_ - output_offset_;
+		if (count > 0)
 		{
-			z_.next_in = reinterpret_cast<Bytef*>(input_buffer_);
-			
-			array<System::Byte, 1>^ buffer = gcnew array<System::Byte, 1>(ATC_BUF_SIZE);
-			const streamsize read_length = src->Read(buffer, 0, buffer->Length);
-
-			{
-				pin_ptr<System::Byte> buffer_native = &buffer[0];
-				memcpy(input_buffer_, buffer_native, ATC_BUF_SIZE);
-
-				buffer_native = nullptr;
-			}
+			const size_t write_length = (count < rest_length) ? count : rest_length;
 
-			total_read_length_ += read_length;
-
-
-			if (data_version_ <= 103)
-			{
-				decryptBufferBlowfish(input_buffer_);
-			} else {
-				decryptBufferRijndael(input_buffer_, chain_buffer_);
-			}
+			array<System::Byte, 1>^ buffer = gcnew array<System::Byte, 1>(static_cast<int>(write_length));
+			pin_ptr<System::Byte> buffer_native = &buffer[0];
 
-			z_.avail_in = static_cast<uInt>(read_length);
+			memcpy(buffer_native, output_buffer_ + output_offset_, write_length);
 
-			// 最終ブロック
-			if (total_read_length_ >= total_length_)
-			{
-				char padding_num = input_buffer_[ATC_BUF_SIZE - 1];
+			dst->Write(buffer, 0, static_cast<int>(write_length));
+			buffer_native = nullptr;
 
-				if (padding_num > -1)
-				{
-					size_t i = 0;
-					for (i = 0; i < ATC_BUF_SIZE; ++i)
-					{
-						if (input_buffer_[ATC_BUF_SIZE - 1 - i] !=  padding_num)
-						{
-							break;
-						}
-					}
-
-					if (padding_num == i)
-					{
-						z_.avail_in = ATC_BUF_SIZE - i;
-					}
-				}
-			}
+			output_offset_ += write_length;
+			rest_length -= write_length;
+			extracted_length_ += write_length;
+			continue;
 		}
 
-		z_status_ = inflate(&z_, Z_NO_FLUSH);
-
 		if (z_status_ == Z_STREAM_END)
 		{
 			break;
 		}
 
-		if (z_status_ != Z_OK)
-		{
-			if (z_status_ == Z_BUF_ERROR)
-			{
-				z_.avail_out = 0;
-			} else 
-			if (data_version_ <= 103 && z_status_ == Z_DATA_ERROR)
-			{
-				z_.avail_out = 0;
-			} else {
-				return ATC_ERR_ZLIB_ERROR;
-			}
-		}
-
-		if (z_.avail_out == 0)
+		if (z_.avail_in == 0)
 		{
-			tmp_buffer_ += string(output_buffer_, ATC_LARGE_BUF_SIZE);
-
-			z_.next_out = reinterpret_cast<Bytef*>(output_buffer_);
-			z_.avail_out = ATC_LARGE_BUF_SIZE;
+			array<System::Byte, 1>^ buffer = gcnew array<System::Byte, 1>(static_cast<int>(nextChunkLength(ATC_CHUNK_SIZE)));
+			const streamsize read_length = src->Read(buffer, 0, buffer->Length);
 
-			// 要求サイズを超えていた場合
-			if (tmp_buffer_.size() >= length)
+			if (read_length > 0)
 			{
-				break;
+				pin_ptr<System::Byte> buffer_native = &buffer[0];
+				memcpy(input_buffer_, buffer_native, static_cast<size_t>(read_length));
+
+				buffer_native = nullptr;
 			}
+
+			z_.next_in = reinterpret_cast<Bytef*>(input_buffer_);
+			z_.avail_in = decryptDataChunk(input_buffer_, read_length);
 		}
-	}
 
-	if (z_status_ == Z_STREAM_END)
-	{
-		/* 残りを吐き出す */
-		size_t count = 0;
-		if ((count = ATC_LARGE_BUF_SIZE - z_.avail_out) != 0)
+		const ATCResult result = inflateOutput();
+		if (result != ATC_OK)
 		{
-			tmp_buffer_ += string(output_buffer_, count);
+			return result;
 		}
 	}
 
-	const size_t tmp_buffer_size = tmp_buffer_.size();
-	const size_t out_length = (tmp_buffer_size >= length) ? length : tmp_buffer_size;
-
-	{
-		array<System::Byte, 1>^ buffer = gcnew array<System::Byte, 1>(out_length);
-		pin_ptr<System::Byte> buffer_native = &buffer[0];
-
-		memcpy(buffer_native, tmp_buffer_.data(), out_length);
-
-		dst->Write(buffer, 0, out_length);
-		buffer_native = nullptr;
-	}
-	
-	tmp_buffer_.erase(0, out_length);
-
 	return ATC_OK;
 }
 
@@ -32,12 +32,21 @@ freely, subject to the following restrictions:
 
 #include <zlib.h>
 
-#include "Rijndael.h"
+#include "RijndaelFixed.h"
 #include "blowfish.h"
+#include "ATCZlibPool.h"
+#include "ATCMemoryBuffer.h"
+#include "ATCChunkQueue.h"
+#include "ATCDirectory.h"
+#include "ATCWriterPool.h"
 
 #include "ATCCommon.h"
 #include "ATCUnlocker.h"
 
+#ifdef ATC_USE_THREADS
+#include <thread>
+#endif
+
 #ifdef USE_CLI
 	#using<system.dll>
 	using namespace System;
@@ -45,7 +54,16 @@ freely, subject to the following restrictions:
 	using namespace System::Text;
 #endif
 
-#define PASS_FOOTER "_AttacheCase-M.Hibara"
+
+// 展開を途中から再開するためのチェックポイント（zlib の examples/zran.c と同じ方式）
+struct ATCIndexPoint {
+
+	int64_t output_offset;	// 展開後のデータの位置
+	int64_t input_offset;	// 圧縮データ（暗号文）の位置
+	int32_t bits;			// input_offset の直前のバイトで未使用のビット数
+	vector<char> window;	// 直前の 32 KiB
+
+};
 
 class ATCUnlocker_impl
 {
@@ -54,11 +72,24 @@ public:
 	~ATCUnlocker_impl();
 
 	ATCResult open(istream *src, const char key[ATC_KEY_SIZE] = nullptr);
+	ATCResult open(istream *src, const ATCLegacyKey& key);
+	ATCResult open(istream *src, const ATCKey& key);
+	ATCResult openBuffer(const void *data, size_t length, const char key[ATC_KEY_SIZE]);
+	ATCResult openBuffer(const void *data, size_t length, const ATCKey& key);
 	ATCResult close();
 
 	size_t getEntryLength() const;
 	ATCResult getEntry(ATCFileEntry *entry, size_t index);
 	ATCResult extractFileData(ostream *dst, istream *src, size_t length);
+	ATCResult extractFileData(const ATCDataSink& sink, istream *src, size_t length);
+	ATCResult extractFileData(char *dst, istream *src, size_t length);
+	ATCResult skipFileData(istream *src, size_t length);
+	ATCResult skipToEntry(istream *src, size_t index);
+	ATCResult extractToDirectory(istream *src, const string& root);
+
+	ATCResult buildIndex(istream *src, ostream *index, size_t span = ATC_INDEX_SPAN);
+	ATCResult loadIndex(istream *src, istream *index);
+	ATCResult seekToEntry(istream *src, size_t index);
 
 #ifdef USE_CLI
 	ATCResult open(Stream ^src, array<System::Byte, 1> ^key = nullptr);
@@ -71,12 +102,39 @@ public:
 	int32_t algorism_type() const;
 	char passwd_try_limit() const;
 	bool self_destruction() const;
+	int thread_count() const;
+	bool read_ahead() const;
+	int writer_count() const;
+
+	void set_thread_count(int thread_count);
+	void set_read_ahead(bool read_ahead);
+	void set_writer_count(int writer_count);
 
 private:
+	ATCResult openStream(istream *src, const char key[ATC_KEY_SIZE],
+		const shared_ptr<const Blowfish>& blowfish, const shared_ptr<const CRijndael256>& rijndael);
 	void decryptBufferRijndael(char data_buffer[ATC_BUF_SIZE], char iv_buffer[ATC_BUF_SIZE]);
 	void decryptBufferBlowfish(char data_buffer[ATC_BUF_SIZE]);
+	streamsize nextChunkLength(streamsize max_length) const;
+	uInt fetchDataChunk(istream *src, char *buffer, streamsize buffer_size);
+	uInt decryptDataChunk(char *buffer, streamsize read_length, const char *source = nullptr);
+	void decryptRijndaelParallel(char *buffer, size_t block_length);
+	void decryptBlowfish(char *buffer, size_t block_length);
 	bool parseFileEntry(ATCFileEntry *entry, const std::string& tsv_sjis, const std::string& tsv_utf8 = "");
 	bool initZlib();
+	void readDataChunk(istream *src);
+#ifdef ATC_USE_THREADS
+	bool readAheadChunk(istream *src, streamsize buffer_size);
+	bool startReadAhead(istream *src, streamsize buffer_size);
+#endif
+	void stopReadAhead(bool discard);
+	ATCResult inflateOutput();
+	ATCResult inflateData();
+	ATCResult restorePoint(istream *src, const ATCIndexPoint *point);
+	istream *source(istream *src) const;
+	bool readIndexNonce(istream *src, char nonce[ATC_BUF_SIZE]);
+	void cryptIndex(char *data, size_t length, const char nonce[ATC_BUF_SIZE]) const;
+	void macIndex(const char *data, size_t length, const char nonce[ATC_BUF_SIZE], char mac[ATC_BUF_SIZE]) const;
 	bool parseHeaderEntries(stringstream *pms);
 
 private:
@@ -89,17 +147,39 @@ private:
 	
 	int64_t total_length_;
 	int64_t total_read_length_;
+	int64_t data_offset_;
+
+	int thread_count_;
+	vector<char> parallel_buffer_;
+	int writer_count_;
+
+	// 別のスレッドで先に読んで復号しておく場合のチャンクのキュー
+	bool read_ahead_;
+#ifdef ATC_USE_THREADS
+	thread read_ahead_thread_;
+	shared_ptr<ATCChunkQueue> read_ahead_queue_;
+	istream *read_ahead_src_;
+	bool read_ahead_chunk_;		// inflate の入力にしているチャンクがある
+#endif
 
-	CRijndael rijndael_;
+	shared_ptr<const CRijndael256> rijndael_;
 	char chain_buffer_[ATC_BUF_SIZE];
 
-	Blowfish blowfish_;
+	shared_ptr<const Blowfish> blowfish_;
 
 	z_stream z_;
+	bool z_ready_;
 	int32_t z_flush_, z_status_;
-	char input_buffer_[ATC_BUF_SIZE];
-	char output_buffer_[ATC_LARGE_BUF_SIZE];
-	string tmp_buffer_;
+	char input_buffer_[ATC_CHUNK_SIZE];
+	char output_buffer_[ATC_CHUNK_SIZE];
+	size_t output_offset_;
+	int64_t extracted_length_;
+
+	vector<ATCIndexPoint> index_points_;
+
+	// openBuffer で開いたアーカイブ
+	shared_ptr<ATCInputBuffer> memory_buffer_;
+	shared_ptr<istream> memory_stream_;
 
 	vector<ATCFileEntry> entries_;
 };
@@ -0,0 +1,400 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCWriterPool.h"
+
+#include <cerrno>
+
+#ifdef WIN32
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/utime.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+struct ATCWriterPool::Writer
+{
+	deque<ATCWriteTask> tasks;
+	size_t pending_length;		// このスレッドの書き込み待ちのデータ
+
+#ifdef WIN32
+	FILE *file;
+#else
+	int fd;
+#endif
+	bool file_failed;			// 今のファイルの作成か書き込みに失敗した
+
+#ifdef ATC_USE_THREADS
+	bool waiting;
+	condition_variable cond;
+	thread worker;
+#endif
+};
+
+namespace {
+	// 使い回すバッファの最大数
+	const size_t max_free_buffers = 64;
+
+	// 小さいファイルはこの数だけ溜まってから書き込むスレッドを起こす（ファイルごとに切り替えない）
+	const size_t min_tasks_per_wakeup = 16;
+}
+
+ATCWriterPool::ATCWriterPool(size_t thread_count) :
+current_(nullptr),
+pending_length_(0),
+threaded_(false),
+failed_(false),
+stopping_(false),
+space_waiting_(false)
+{
+#ifdef ATC_USE_THREADS
+	for (size_t i = 0; i < thread_count; ++i)
+	{
+		Writer *writer = new Writer();
+		writer->pending_length = 0;
+		writer->file_failed = false;
+		writer->waiting = false;
+#ifdef WIN32
+		writer->file = nullptr;
+#else
+		writer->fd = -1;
+#endif
+
+		try
+		{
+			writer->worker = thread(&ATCWriterPool::run, this, writer);
+		}
+		catch (...)
+		{
+			delete writer;
+			break;
+		}
+		writers_.push_back(writer);
+	}
+#else
+	(void)thread_count;
+#endif
+
+	threaded_ = !writers_.empty();
+
+	// スレッドを作れない場合は submit の中で書く
+	if (!threaded_)
+	{
+		Writer *writer = new Writer();
+		writer->pending_length = 0;
+		writer->file_failed = false;
+#ifdef WIN32
+		writer->file = nullptr;
+#else
+		writer->fd = -1;
+#endif
+		writers_.push_back(writer);
+	}
+}
+
+ATCWriterPool::~ATCWriterPool()
+{
+	finish();
+
+	for (size_t i = 0; i < writers_.size(); ++i)
+	{
+		delete writers_[i];
+	}
+}
+
+void ATCWriterPool::acquire(vector<char> *buffer, size_t length)
+{
+#ifdef ATC_USE_THREADS
+	unique_lock<mutex> lock(mutex_);
+
+	while (threaded_ && pending_length_ > ATC_WRITER_QUEUE_SIZE && !failed_)
+	{
+		for (size_t i = 0; i < writers_.size(); ++i)
+		{
+			if (writers_[i]->waiting && !writers_[i]->tasks.empty())
+			{
+				writers_[i]->cond.notify_one();
+			}
+		}
+
+		space_waiting_ = true;
+		space_cond_.wait(lock);
+		space_waiting_ = false;
+	}
+
+	if (!free_buffers_.empty())
+	{
+		buffer->swap(free_buffers_.back());
+		free_buffers_.pop_back();
+	}
+#else
+	if (!free_buffers_.empty())
+	{
+		buffer->swap(free_buffers_.back());
+		free_buffers_.pop_back();
+	}
+#endif
+
+	buffer->resize(length);
+}
+
+void ATCWriterPool::submit(ATCWriteTask *task)
+{
+	const bool last = task->last;
+
+#ifdef ATC_USE_THREADS
+	if (threaded_)
+	{
+		lock_guard<mutex> lock(mutex_);
+
+		// 新しいファイルは書き込み待ちが一番少ないスレッドに渡す
+		if (task->first || !current_)
+		{
+			current_ = writers_[0];
+			for (size_t i = 1; i < writers_.size(); ++i)
+			{
+				if (writers_[i]->pending_length < current_->pending_length)
+				{
+					current_ = writers_[i];
+				}
+			}
+		}
+
+		Writer *writer = current_;
+		pending_length_ += task->data.size();
+		writer->pending_length += task->data.size();
+		writer->tasks.push_back(ATCWriteTask());
+		swap(writer->tasks.back(), *task);
+		if (writer->waiting && (writer->tasks.size() >= min_tasks_per_wakeup
+			|| writer->pending_length >= ATC_WRITER_CHUNK_SIZE))
+		{
+			writer->cond.notify_one();
+		}
+
+		if (last)
+		{
+			current_ = nullptr;
+		}
+		return;
+	}
+#endif
+
+	if (!execute(writers_[0], task))
+	{
+		failed_ = true;
+	}
+	recycle(&task->data);
+	(void)last;
+}
+
+bool ATCWriterPool::finish()
+{
+#ifdef ATC_USE_THREADS
+	{
+		lock_guard<mutex> lock(mutex_);
+		stopping_ = true;
+		for (size_t i = 0; i < writers_.size(); ++i)
+		{
+			writers_[i]->cond.notify_one();
+		}
+	}
+
+	for (size_t i = 0; i < writers_.size(); ++i)
+	{
+		if (writers_[i]->worker.joinable())
+		{
+			writers_[i]->worker.join();
+		}
+	}
+#endif
+
+	// 途中で中止されたファイルを閉じる
+	for (size_t i = 0; i < writers_.size(); ++i)
+	{
+#ifdef WIN32
+		if (writers_[i]->file)
+		{
+			fclose(writers_[i]->file);
+			writers_[i]->file = nullptr;
+		}
+#else
+		if (writers_[i]->fd >= 0)
+		{
+			::close(writers_[i]->fd);
+			writers_[i]->fd = -1;
+		}
+#endif
+	}
+
+	return !failed();
+}
+
+bool ATCWriterPool::failed() const
+{
+#ifdef ATC_USE_THREADS
+	lock_guard<mutex> lock(mutex_);
+#endif
+	return failed_;
+}
+
+#ifdef ATC_USE_THREADS
+void ATCWriterPool::run(Writer *writer)
+{
+	unique_lock<mutex> lock(mutex_);
+
+	for (;;)
+	{
+		while (writer->tasks.empty() && !stopping_)
+		{
+			writer->waiting = true;
+			writer->cond.wait(lock);
+			writer->waiting = false;
+		}
+		if (writer->tasks.empty())
+		{
+			break;
+		}
+
+		ATCWriteTask task;
+		swap(task, writer->tasks.front());
+		writer->tasks.pop_front();
+
+		lock.unlock();
+		const bool succeeded = execute(writer, &task);
+		lock.lock();
+
+		if (!succeeded)
+		{
+			failed_ = true;
+		}
+		pending_length_ -= task.data.size();
+		writer->pending_length -= task.data.size();
+		recycle(&task.data);
+		if (space_waiting_)
+		{
+			space_cond_.notify_one();
+		}
+	}
+}
+#else
+void ATCWriterPool::run(Writer *)
+{
+}
+#endif
+
+// ファイルを作り、書き、閉じる。ロックを持たずに呼ぶ
+bool ATCWriterPool::execute(Writer *writer, ATCWriteTask *task)
+{
+	if (task->first)
+	{
+		writer->file_failed = false;
+
+#ifdef WIN32
+		writer->file = fopen(task->path.c_str(), "wb");
+		writer->file_failed = !writer->file;
+#else
+		writer->fd = open(task->path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		writer->file_failed = writer->fd < 0;
+
+#ifdef __linux__
+		// 何回かに分けて書くファイルは、先に領域を確保して断片化を防ぐ
+		// 対応していないファイルシステムでは何もしない
+		if (writer->fd >= 0 && !task->last)
+		{
+			fallocate(writer->fd, 0, 0, static_cast<off_t>(task->size));
+		}
+#endif
+#endif
+	}
+
+	if (!writer->file_failed && !task->data.empty())
+	{
+#ifdef WIN32
+		writer->file_failed = fwrite(&task->data[0], 1, task->data.size(), writer->file) != task->data.size();
+#else
+		const char *data = &task->data[0];
+		size_t rest_length = task->data.size();
+		while (rest_length > 0)
+		{
+			const ssize_t written = write(writer->fd, data, rest_length);
+			if (written < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (written <= 0)
+			{
+				writer->file_failed = true;
+				break;
+			}
+			data += written;
+			rest_length -= static_cast<size_t>(written);
+		}
+#endif
+	}
+
+	if (task->last)
+	{
+#ifdef WIN32
+		if (writer->file)
+		{
+			writer->file_failed = (fclose(writer->file) != 0) || writer->file_failed;
+			writer->file = nullptr;
+
+			__utimbuf64 times;
+			times.actime = task->change_time;
+			times.modtime = task->change_time;
+			_utime64(task->path.c_str(), &times);
+		}
+#else
+		if (writer->fd >= 0)
+		{
+			timespec times[2];
+			times[0].tv_sec = times[1].tv_sec = task->change_time;
+			times[0].tv_nsec = times[1].tv_nsec = 0;
+			futimens(writer->fd, times);
+
+			writer->file_failed = (::close(writer->fd) != 0) || writer->file_failed;
+			writer->fd = -1;
+		}
+#endif
+	}
+
+	return !writer->file_failed;
+}
+
+// 呼び出し側がロックを持っている
+void ATCWriterPool::recycle(vector<char> *buffer)
+{
+	if (free_buffers_.size() < max_free_buffers && buffer->capacity() > 0)
+	{
+		free_buffers_.push_back(vector<char>());
+		free_buffers_.back().swap(*buffer);
+	}
+}
@@ -0,0 +1,89 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "ATCCommon.h"
+
+#ifdef ATC_USE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+// 書き込むファイルの一部。first で作成し、last で時刻を設定して閉じる
+struct ATCWriteTask
+{
+	std::string path;
+	int64_t size;
+	time_t change_time;
+	bool first;
+	bool last;
+	std::vector<char> data;
+};
+
+// 展開したデータを複数のスレッドでファイルに書く。一つのファイルは一つのスレッドが順に書く
+// 呼び出し側が待つのは、書き込み待ちのデータが ATC_WRITER_QUEUE_SIZE を超えた場合だけ
+class ATCWriterPool
+{
+public:
+	explicit ATCWriterPool(size_t thread_count);
+	~ATCWriterPool();
+
+	// 書き込み済みのバッファを使い回して、length バイトのバッファを返す
+	void acquire(std::vector<char> *buffer, size_t length);
+	// task を書き込むスレッドに渡す。task->data は空になる
+	void submit(ATCWriteTask *task);
+	// すべての書き込みを待ってスレッドを終わらせる。失敗した書き込みがあれば false
+	bool finish();
+	bool failed() const;
+
+private:
+	struct Writer;
+
+	void run(Writer *writer);
+	bool execute(Writer *writer, ATCWriteTask *task);
+	void recycle(std::vector<char> *buffer);
+
+	std::vector<Writer*> writers_;
+	Writer *current_;			// 書いている途中のファイルの担当
+	std::vector<std::vector<char> > free_buffers_;
+	size_t pending_length_;
+	bool threaded_;
+	bool failed_;
+	bool stopping_;
+	bool space_waiting_;		// 呼び出し側が acquire で待っている
+
+#ifdef ATC_USE_THREADS
+	mutable std::mutex mutex_;
+	std::condition_variable space_cond_;
+#endif
+};
@@ -0,0 +1,138 @@
+﻿/*
+
+Copyright (c) 2013 h2so5 <mail@h2so5.net>
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+
+*/
+
+#include "ATCZlibPool.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include "ATCCommon.h"
+
+using namespace std;
+
+namespace {
+#ifdef ATC_USE_THREADS
+	// 確保した大きさを先頭に記録する（アラインメントを保つため 16 バイト）
+	const size_t header_size = 16;
+
+	// deflate は 5 個、inflate は 2 個のブロックを確保する
+	const size_t max_cached_blocks = 16;
+
+	struct BlockCache
+	{
+		vector<void*> blocks;
+
+		~BlockCache();
+
+		void clear()
+		{
+			for (size_t i = 0; i < blocks.size(); ++i)
+			{
+				free(blocks[i]);
+			}
+			blocks.clear();
+		}
+	};
+
+	thread_local BlockCache cache;
+
+	// スレッドの終了後（静的オブジェクトの破棄など）に呼ばれた場合はキャッシュを使わない
+	thread_local bool cache_destroyed = false;
+
+	BlockCache::~BlockCache()
+	{
+		clear();
+		cache_destroyed = true;
+	}
+
+	voidpf zlibAlloc(voidpf, uInt items, uInt size)
+	{
+		const size_t length = static_cast<size_t>(items) * size;
+
+		// 同じ大きさのブロックがあればそれを使う
+		vector<void*>& blocks = cache.blocks;
+		for (size_t i = cache_destroyed ? 0 : blocks.size(); i-- > 0;)
+		{
+			if (*static_cast<size_t*>(blocks[i]) == length)
+			{
+				char *block = static_cast<char*>(blocks[i]);
+				blocks[i] = blocks.back();
+				blocks.pop_back();
+				return block + header_size;
+			}
+		}
+
+		char *block = static_cast<char*>(malloc(length + header_size));
+		if (!block)
+		{
+			return Z_NULL;
+		}
+		*reinterpret_cast<size_t*>(block) = length;
+		return block + header_size;
+	}
+
+	void zlibFree(voidpf, voidpf address)
+	{
+		// 別のスレッドで確保したブロックでも構わない
+		char *block = static_cast<char*>(address) - header_size;
+
+		if (!cache_destroyed && cache.blocks.size() < max_cached_blocks)
+		{
+			try
+			{
+				cache.blocks.push_back(block);
+				return;
+			}
+			catch (...)
+			{
+			}
+		}
+		free(block);
+	}
+#endif
+}
+
+void setZlibPool(z_stream *z)
+{
+#ifdef ATC_USE_THREADS
+	z->zalloc = zlibAlloc;
+	z->zfree  = zlibFree;
+#else
+	// C++/CLI ではスレッドごとの領域が使えないので zlib の既定の関数を使う
+	z->zalloc = Z_NULL;
+	z->zfree  = Z_NULL;
+#endif
+	z->opaque = Z_NULL;
+}
+
+void clearZlibPool()
+{
+#ifdef ATC_USE_THREADS
+	if (!cache_destroyed)
+	{
+		cache.clear();
+	}
+#endif
+}
@@ -925,7 +925,7 @@ char const* CRijndael::sm_szErrorMsg2 = "Data not multiple of Block Size";
 char const* CRijndael::sm_chain0 = "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0";
 
 //CONSTRUCTOR
-CRijndael::CRijndael() : m_bKeyInit(false)
+CRijndael::CRijndael() : m_bKeyInit(false), m_iAllowedKernels(~0), m_iKernel(TABLE)
 {
 }
 
@@ -981,6 +981,7 @@ void CRijndael::MakeKey(char const* key, char const* chain, int keylength, int b
 	int ROUND_KEY_COUNT = (m_iROUNDS + 1) * BC;
 	int KC = m_keylength/4;
 	//Copy user material bytes into temporary ints
+	int tk[MAX_KC];
 	int* pi = tk;
 	char const* pc = key;
 	for(i=0; i<KC; i++)
@@ -1039,18 +1040,80 @@ void CRijndael::MakeKey(char const* key, char const* chain, int keylength, int b
 				sm_U3[(tt >>  8) & 0xFF] ^
 				sm_U4[tt & 0xFF];
 		}
+	MakeHardwareKey();
 	m_bKeyInit = true;
 }
 
+//The fastest allowed kernel the processor supports for this block size
+int CRijndael::SelectKernel(int blockSize, int iAllowedKernels)
+{
+	if(MAX_BLOCK_SIZE != blockSize)
+		return TABLE;
+#ifdef RIJNDAEL_AESNI
+	if((iAllowedKernels & (1 << AESNI)) && HasAESNI())
+		return AESNI;
+#endif
+#ifdef RIJNDAEL_AVX2
+	if((iAllowedKernels & (1 << BITSLICE)) && HasAVX2())
+		return BITSLICE;
+#endif
+	return TABLE;
+}
+
+//Select the block kernel and lay out its round keys.
+//Each round key becomes 32 bytes in the same order as the state bytes (AES-NI),
+//and then eight bit planes of those bytes (bitsliced AVX2).
+void CRijndael::MakeHardwareKey()
+{
+	m_iKernel = TABLE;
+	int iKernel = SelectKernel(m_blockSize, m_iAllowedKernels);
+	if(TABLE == iKernel)
+		return;
+	for(int r=0; r<=m_iROUNDS; r++)
+		for(int j=0; j<MAX_BC; j++)
+			for(int k=0; k<4; k++)
+			{
+				m_KeBytes[r][4*j+k] = (unsigned char)(m_Ke[r][j] >> (24 - 8*k));
+				m_KdBytes[r][4*j+k] = (unsigned char)(m_Kd[r][j] >> (24 - 8*k));
+			}
+	if(BITSLICE == iKernel)
+	{
+		for(int r=0; r<=m_iROUNDS; r++)
+			for(int b=0; b<8; b++)
+				for(int p=0; p<MAX_BLOCK_SIZE; p++)
+				{
+					m_KeSlices[r][b][p] = ((m_KeBytes[r][p] >> b) & 1) ? 0xFF : 0;
+					m_KdSlices[r][b][p] = ((m_KdBytes[r][p] >> b) & 1) ? 0xFF : 0;
+				}
+	}
+	m_iKernel = iKernel;
+}
+
+//Allow or forbid the hardware kernels
+void CRijndael::SetHardwareAcceleration(bool bEnable)
+{
+	m_iAllowedKernels = bEnable ? ~0 : (1 << TABLE);
+	if(m_bKeyInit)
+		MakeHardwareKey();
+}
+
+//Allow one kernel only
+void CRijndael::SetKernel(int iKernel)
+{
+	m_iAllowedKernels = (1 << TABLE) | (1 << iKernel);
+	if(m_bKeyInit)
+		MakeHardwareKey();
+}
+
 //Convenience method to encrypt exactly one block of plaintext, assuming
 //Rijndael's default block size (128-bit).
 // in         - The plaintext
 // result     - The ciphertext generated from a plaintext using the key
-void CRijndael::DefEncryptBlock(char const* in, char* result)
+void CRijndael::DefEncryptBlock(char const* in, char* result) const
 {
 	if(false==m_bKeyInit)
 		throw runtime_error(sm_szErrorMsg1);
-	int* Ker = m_Ke[0];
+	const int* Ker = m_Ke[0];
 	int t0 = ((unsigned char)*(in++) << 24);
 	t0 |= ((unsigned char)*(in++) << 16);
 	t0 |= ((unsigned char)*(in++) << 8);
@@ -1121,11 +1184,11 @@ void CRijndael::DefEncryptBlock(char const* in, char* result)
 //Rijndael's default block size (128-bit).
 // in         - The ciphertext.
 // result     - The plaintext generated from a ciphertext using the session key.
-void CRijndael::DefDecryptBlock(char const* in, char* result)
+void CRijndael::DefDecryptBlock(char const* in, char* result) const
 {
 	if(false==m_bKeyInit)
 		throw runtime_error(sm_szErrorMsg1);
-	int* Kdr = m_Kd[0];
+	const int* Kdr = m_Kd[0];
 	int t0 = ((unsigned char)*(in++) << 24);
 	t0 = t0 | ((unsigned char)*(in++) << 16);
 	t0 |= ((unsigned char)*(in++) << 8);
@@ -1194,7 +1257,7 @@ void CRijndael::DefDecryptBlock(char const* in, char* result)
 //Encrypt exactly one block of plaintext.
 // in           - The plaintext.
 // result       - The ciphertext generated from a plaintext using the key.
-void CRijndael::EncryptBlock(char const* in, char* result)
+void CRijndael::EncryptBlock(char const* in, char* result) const
 {
 	if(false==m_bKeyInit)
 		throw runtime_error(sm_szErrorMsg1);
@@ -1203,12 +1266,28 @@ void CRijndael::EncryptBlock(char const* in, char* result)
 		DefEncryptBlock(in, result);
 		return;
 	}
+#ifdef RIJNDAEL_AESNI
+	if(AESNI == m_iKernel)
+	{
+		AESNIEncryptBlock256(m_KeBytes[0], m_iROUNDS, in, result);
+		return;
+	}
+#endif
+#ifdef RIJNDAEL_AVX2
+	if(BITSLICE == m_iKernel)
+	{
+		AVX2EncryptBlocks256(m_KeSlices[0][0], m_iROUNDS, in, result, 1);
+		return;
+	}
+#endif
 	int BC = m_blockSize / 4;
 	int SC = (BC == 4) ? 0 : (BC == 6 ? 1 : 2);
 	int s1 = sm_shifts[SC][1][0];
 	int s2 = sm_shifts[SC][2][0];
 	int s3 = sm_shifts[SC][3][0];
 	//Temporary Work Arrays
+	int t[MAX_BC];
+	int a[MAX_BC];
 	int i;
 	int tt;
 	int* pi = t;
@@ -1244,7 +1323,7 @@ void CRijndael::EncryptBlock(char const* in, char* result)
 //Decrypt exactly one block of ciphertext.
 // in         - The ciphertext.
 // result     - The plaintext generated from a ciphertext using the session key.
-void CRijndael::DecryptBlock(char const* in, char* result)
+void CRijndael::DecryptBlock(char const* in, char* result) const
 {
 	if(false==m_bKeyInit)
 		throw runtime_error(sm_szErrorMsg1);
@@ -1253,12 +1332,28 @@ void CRijndael::DecryptBlock(char const* in, char* result)
 		DefDecryptBlock(in, result);
 		return;
 	}
+#ifdef RIJNDAEL_AESNI
+	if(AESNI == m_iKernel)
+	{
+		AESNIDecryptBlock256(m_KdBytes[0], m_iROUNDS, in, result);
+		return;
+	}
+#endif
+#ifdef RIJNDAEL_AVX2
+	if(BITSLICE == m_iKernel)
+	{
+		AVX2DecryptBlocks256(m_KdSlices[0][0], m_iROUNDS, in, result, 1);
+		return;
+	}
+#endif
 	int BC = m_blockSize / 4;
 	int SC = BC == 4 ? 0 : (BC == 6 ? 1 : 2);
 	int s1 = sm_shifts[SC][1][1];
 	int s2 = sm_shifts[SC][2][1];
 	int s3 = sm_shifts[SC][3][1];
 	//Temporary Work Arrays
+	int t[MAX_BC];
+	int a[MAX_BC];
 	int i;
 	int tt;
 	int* pi = t;
@@ -1291,6 +1386,108 @@ void CRijndael::DecryptBlock(char const* in, char* result)
 	}
 }
 
+//Decrypt four consecutive blocks of ciphertext.
+// in         - The ciphertext, four blocks.
+// result     - The plaintext, four blocks.
+void CRijndael::DecryptBlocks4(char const* in, char* result) const
+{
+	int BC = m_blockSize / 4;
+	int SC = BC == 4 ? 0 : (BC == 6 ? 1 : 2);
+	int s1 = sm_shifts[SC][1][1];
+	int s2 = sm_shifts[SC][2][1];
+	int s3 = sm_shifts[SC][3][1];
+	//Temporary Work Arrays
+	int t[4][MAX_BC];
+	int a[4][MAX_BC];
+	int b, i;
+	int tt;
+	for(b=0; b<4; b++)
+	{
+		int* pi = t[b];
+		for(i=0; i<BC; i++)
+		{
+			*pi = ((unsigned char)*(in++) << 24);
+			*pi |= ((unsigned char)*(in++) << 16);
+			*pi |= ((unsigned char)*(in++) << 8);
+			(*(pi++) |= (unsigned char)*(in++)) ^= m_Kd[0][i];
+		}
+	}
+	//Apply Round Transforms
+	for(int r=1; r<m_iROUNDS; r++)
+	{
+		for(i=0; i<BC; i++)
+			for(b=0; b<4; b++)
+				a[b][i] = (sm_T5[(t[b][i] >> 24) & 0xFF] ^
+					sm_T6[(t[b][(i + s1) % BC] >> 16) & 0xFF] ^
+					sm_T7[(t[b][(i + s2) % BC] >>  8) & 0xFF] ^
+					sm_T8[ t[b][(i + s3) % BC] & 0xFF]) ^ m_Kd[r][i];
+		memcpy(t, a, sizeof(t));
+	}
+	int j;
+	//Last Round is Special
+	for(b=0,j=0; b<4; b++)
+		for(i=0; i<BC; i++)
+		{
+			tt = m_Kd[m_iROUNDS][i];
+			result[j++] = sm_Si[(t[b][i] >> 24) & 0xFF] ^ (tt >> 24);
+			result[j++] = sm_Si[(t[b][(i + s1) % BC] >> 16) & 0xFF] ^ (tt >> 16);
+			result[j++] = sm_Si[(t[b][(i + s2) % BC] >>  8) & 0xFF] ^ (tt >>  8);
+			result[j++] = sm_Si[ t[b][(i + s3) % BC] & 0xFF] ^ tt;
+		}
+}
+
+//Decrypt n bytes in CBC mode with a caller-owned chain block.
+// in         - The ciphertext.
+// result     - The plaintext, may be the same buffer as in.
+// chain      - The previous ciphertext block. On return, the last ciphertext block.
+void CRijndael::DecryptCBC(char const* in, char* result, size_t n, char* chain) const
+{
+	if(false==m_bKeyInit)
+		throw runtime_error(sm_szErrorMsg1);
+	//n should be a multiple of m_blockSize
+	if(n%m_blockSize!=0)
+		throw runtime_error(sm_szErrorMsg2);
+#ifdef RIJNDAEL_AESNI
+	if(AESNI == m_iKernel)
+	{
+		AESNIDecryptCBC256(m_KdBytes[0], m_iROUNDS, in, result, n/m_blockSize, chain);
+		return;
+	}
+#endif
+#ifdef RIJNDAEL_AVX2
+	if(BITSLICE == m_iKernel)
+	{
+		AVX2DecryptCBC256(m_KdSlices[0][0], m_iROUNDS, in, result, n/m_blockSize, chain);
+		return;
+	}
+#endif
+	char block[4][MAX_BLOCK_SIZE];
+	char next[MAX_BLOCK_SIZE];
+	size_t blocks = n/m_blockSize;
+	while(blocks > 0)
+	{
+		int count = (blocks < 4) ? (int)blocks : 4;
+		if(4 == count)
+			DecryptBlocks4(in, block[0]);
+		else
+			for(int k=0; k<count; k++)
+				DecryptBlock(in + k*m_blockSize, block[k]);
+		//Keep the ciphertext needed for chaining before result overwrites it
+		memcpy(next, in + (count-1)*m_blockSize, m_blockSize);
+		for(int k=count-1; k>=0; k--)
+		{
+			char const* prev = (0 == k) ? chain : in + (k-1)*m_blockSize;
+			char* presult = result + k*m_blockSize;
+			for(int i=0; i<m_blockSize; i++)
+				presult[i] = block[k][i] ^ prev[i];
+		}
+		memcpy(chain, next, m_blockSize);
+		in += count*m_blockSize;
+		result += count*m_blockSize;
+		blocks -= count;
+	}
+}
+
 void CRijndael::Encrypt(char const* in, char* result, size_t n, int iMode)
 {
 	if(false==m_bKeyInit)
@@ -11,6 +11,21 @@
 
 using namespace std;
 
+//The AES-NI kernel for 256-bit blocks (Rijndael_aesni.cpp) is built on x86/x64
+//targets. It is selected at run time by CPUID, the table code stays the fallback.
+#if !defined(RIJNDAEL_NO_AESNI) && !defined(USE_CLI) && \
+	(defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define RIJNDAEL_AESNI
+#endif
+
+//The bitsliced AVX2 kernel (Rijndael_avx2.cpp) is used on processors without AES-NI.
+//AVX2 intrinsics need Visual C++ 2013 or later.
+#if !defined(RIJNDAEL_NO_AVX2) && !defined(USE_CLI) && \
+	(!defined(_MSC_VER) || _MSC_VER >= 1800) && \
+	(defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define RIJNDAEL_AVX2
+#endif
+
 //Rijndael (pronounced Reindaal) is a block cipher, designed by Joan Daemen and Vincent Rijmen as a candidate algorithm for the AES.
 //The cipher has a variable block length and key length. The authors currently specify how to use keys with a length
 //of 128, 192, or 256 bits to encrypt blocks with al length of 128, 192 or 256 bits (all nine combinations of
@@ -22,8 +37,13 @@ using namespace std;
 //Java code authors: Raif S. Naffah, Paulo S. L. M. Barreto
 //This Implementation was tested against KAT test published by the authors of the method and the
 //results were identical.
+template <int KEY_SIZE, int BLOCK_SIZE> class CRijndaelFixed;
+
 class CRijndael
 {
+	//Shares the tables, the key schedule and the AES-NI kernels
+	template <int KEY_SIZE, int BLOCK_SIZE> friend class CRijndaelFixed;
+
 public:
 	//Operation Modes
 	//The Electronic Code Book (ECB), Cipher Block Chaining (CBC) and Cipher Feedback Block (CFB) modes
@@ -36,6 +56,12 @@ public:
 	//and xoring the resulting value with the plaintext.
 	enum { ECB=0, CBC=1, CFB=2 };
 
+	//Block Kernels
+	//TABLE is the portable table code. AESNI and BITSLICE (AVX2, constant time) handle
+	//256-bit blocks; MakeKey picks the first one the processor supports, in this order:
+	//AESNI, BITSLICE, TABLE.
+	enum { TABLE=0, AESNI=1, BITSLICE=2 };
+
 private:
 	enum { DEFAULT_BLOCK_SIZE=16 };
 	enum { MAX_BLOCK_SIZE=32, MAX_ROUNDS=14, MAX_KC=8, MAX_BC=8 };
@@ -76,7 +102,7 @@ public:
 
 private:
 	//Auxiliary Function
-	void Xor(char* buff, char const* chain)
+	void Xor(char* buff, char const* chain) const
 	{
 		if(false==m_bKeyInit)
 			throw runtime_error(sm_szErrorMsg1);
@@ -88,31 +114,68 @@ private:
 	//Rijndael's default block size (128-bit).
 	// in         - The plaintext
 	// result     - The ciphertext generated from a plaintext using the key
-	void DefEncryptBlock(char const* in, char* result);
+	void DefEncryptBlock(char const* in, char* result) const;
 
 	//Convenience method to decrypt exactly one block of plaintext, assuming
 	//Rijndael's default block size (128-bit).
 	// in         - The ciphertext.
 	// result     - The plaintext generated from a ciphertext using the session key.
-	void DefDecryptBlock(char const* in, char* result);
+	void DefDecryptBlock(char const* in, char* result) const;
+
+	//Decrypt four consecutive blocks of ciphertext.
+	//The rounds of the four blocks are interleaved to hide the latency of the table lookups.
+	void DecryptBlocks4(char const* in, char* result) const;
+
+	//AES-NI kernels for the 256-bit block size (Rijndael_aesni.cpp).
+	//The round keys are given as bytes in state order, 32 bytes per round.
+	static bool HasAESNI();
+	static void AESNIEncryptBlock256(unsigned char const* ks, int rounds, char const* in, char* result);
+	static void AESNIDecryptBlock256(unsigned char const* ks, int rounds, char const* in, char* result);
+	static void AESNIEncryptCBC256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks, char* chain);
+	static void AESNIDecryptCBC256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks, char* chain);
+	static void AESNIEncryptCBC256Lanes(unsigned char const* const ks[], int rounds, char const* const in[],
+		char* const result[], char* const chain[], int lanes, size_t blocks);
+
+	//Bitsliced AVX2 kernels for the 256-bit block size (Rijndael_avx2.cpp).
+	//Eight blocks are processed at once. The round keys are given as bit planes, 256 bytes
+	//per round: byte p of plane b is 0xFF when bit b of round key byte p is set.
+	static bool HasAVX2();
+	static void AVX2EncryptBlocks256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks);
+	static void AVX2DecryptBlocks256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks);
+	static void AVX2DecryptCBC256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks, char* chain);
+	static void AVX2EncryptCBC256Lanes(unsigned char const* const ks[], int rounds, char const* const in[],
+		char* const result[], char* const chain[], int lanes, size_t blocks);
+
+	//Select the block kernel and lay out its round keys
+	static int SelectKernel(int blockSize, int iAllowedKernels);
+	void MakeHardwareKey();
 
 public:
 	//Encrypt exactly one block of plaintext.
+	//The key schedule is not modified, so one CRijndael may be shared by several threads.
 	// in           - The plaintext.
     // result       - The ciphertext generated from a plaintext using the key.
-    void EncryptBlock(char const* in, char* result);
+    void EncryptBlock(char const* in, char* result) const;
 	
 	//Decrypt exactly one block of ciphertext.
+	//The key schedule is not modified, so one CRijndael may be shared by several threads.
 	// in         - The ciphertext.
 	// result     - The plaintext generated from a ciphertext using the session key.
-	void DecryptBlock(char const* in, char* result);
+	void DecryptBlock(char const* in, char* result) const;
 
 	void Encrypt(char const* in, char* result, size_t n, int iMode=ECB);
 	
 	void Decrypt(char const* in, char* result, size_t n, int iMode=ECB);
 
+	//Decrypt n bytes in CBC mode with a caller-owned chain block.
+	//Several blocks are decrypted at once; in and result may be the same buffer.
+	// in         - The ciphertext, n must be a multiple of the block size.
+	// result     - The plaintext.
+	// chain      - The previous ciphertext block. On return, the last ciphertext block.
+	void DecryptCBC(char const* in, char* result, size_t n, char* chain) const;
+
 	//Get Key Length
-	int GetKeyLength()
+	int GetKeyLength() const
 	{
 		if(false==m_bKeyInit)
 			throw runtime_error(sm_szErrorMsg1);
@@ -120,7 +183,7 @@ public:
 	}
 
 	//Block Size
-	int	GetBlockSize()
+	int	GetBlockSize() const
 	{
 		if(false==m_bKeyInit)
 			throw runtime_error(sm_szErrorMsg1);
@@ -128,7 +191,7 @@ public:
 	}
 	
 	//Number of Rounds
-	int GetRounds()
+	int GetRounds() const
 	{
 		if(false==m_bKeyInit)
 			throw runtime_error(sm_szErrorMsg1);
@@ -140,6 +203,25 @@ public:
 		memcpy(m_chain, m_chain0, m_blockSize);
 	}
 
+	//Allow or forbid the AESNI and BITSLICE kernels (allowed by default). They are only
+	//used for 256-bit blocks on processors that support them.
+	void SetHardwareAcceleration(bool bEnable);
+
+	//Restrict the choice to one kernel, falling back to TABLE when it is not available
+	void SetKernel(int iKernel);
+
+	//The kernel EncryptBlock/DecryptBlock currently run on
+	int GetKernel() const
+	{
+		return m_iKernel;
+	}
+
+	//Whether EncryptBlock/DecryptBlock currently run on AES-NI or AVX2
+	bool IsHardwareAccelerated() const
+	{
+		return TABLE != m_iKernel;
+	}
+
 public:
 	//Null chain
 	static char const* sm_chain0;
@@ -168,10 +250,19 @@ private:
 	static char const* sm_szErrorMsg2;
 	//Key Initialization Flag
 	bool m_bKeyInit;
+	//Allowed Kernels (one bit per kernel) and the selected one
+	int m_iAllowedKernels;
+	int m_iKernel;
 	//Encryption (m_Ke) round key
 	int m_Ke[MAX_ROUNDS+1][MAX_BC];
 	//Decryption (m_Kd) round key
     int m_Kd[MAX_ROUNDS+1][MAX_BC];
+	//Round keys of the AES-NI kernel, in byte order
+	unsigned char m_KeBytes[MAX_ROUNDS+1][MAX_BLOCK_SIZE];
+	unsigned char m_KdBytes[MAX_ROUNDS+1][MAX_BLOCK_SIZE];
+	//Round keys of the bitsliced kernel, as bit planes
+	unsigned char m_KeSlices[MAX_ROUNDS+1][8][MAX_BLOCK_SIZE];
+	unsigned char m_KdSlices[MAX_ROUNDS+1][8][MAX_BLOCK_SIZE];
 	//Key Length
 	int m_keylength;
 	//Block Size
@@ -181,10 +272,6 @@ private:
 	//Chain Block
 	char m_chain0[MAX_BLOCK_SIZE];
 	char m_chain[MAX_BLOCK_SIZE];
-	//Auxiliary private use buffers
-	int tk[MAX_KC];
-	int a[MAX_BC];
-	int t[MAX_BC];
 };
 
 #endif // __RIJNDAEL_H__
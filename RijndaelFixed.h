@@ -0,0 +1,416 @@
+//RijndaelFixed.h
+
+#ifndef __RIJNDAEL_FIXED_H__
+#define __RIJNDAEL_FIXED_H__
+
+#include <type_traits>
+
+#include "Rijndael.h"
+
+#if defined(_MSC_VER)
+#define RIJNDAEL_FORCEINLINE __forceinline
+#elif defined(__GNUC__)
+#define RIJNDAEL_FORCEINLINE inline __attribute__((always_inline))
+#else
+#define RIJNDAEL_FORCEINLINE inline
+#endif
+
+//Rijndael with the key length and the block size fixed at compile time.
+//CRijndael checks the key state, branches on the block size and computes the ShiftRows
+//offsets on every block. Here the number of rounds, the shift offsets and the loop bounds
+//are constants, so the rounds are unrolled and the (i + s) % BC indices fold away.
+//The key schedule, the tables and the kernels are shared with CRijndael; 256-bit blocks
+//run on AES-NI or bitsliced AVX2 when the processor supports them.
+//MakeKey() must be called before any other operation; nothing is checked at run time.
+template <int KEY_SIZE, int BLOCK_SIZE>
+class CRijndaelFixed
+{
+	static_assert(KEY_SIZE == 16 || KEY_SIZE == 24 || KEY_SIZE == 32, "Incorrect key length");
+	static_assert(BLOCK_SIZE == 16 || BLOCK_SIZE == 24 || BLOCK_SIZE == 32, "Incorrect block length");
+
+public:
+	enum {
+		KC = KEY_SIZE / 4,
+		BC = BLOCK_SIZE / 4,
+		ROUNDS = ((KC > BC) ? KC : BC) + 6
+	};
+
+private:
+	//ShiftRows offsets of rows 1-3 (encryption; decryption uses BC - offset)
+	enum {
+		S1 = 1,
+		S2 = (BC == 8) ? 3 : 2,
+		S3 = (BC == 8) ? 4 : 3
+	};
+
+	//Round index as a type, to unroll the rounds by overloading
+	template <int R>
+	struct Round : std::integral_constant<int, R> {};
+
+public:
+	//Directions of the session key (bit mask)
+	enum {
+		ENCRYPTION = 1,
+		DECRYPTION = 2
+	};
+
+	CRijndaelFixed() : m_iAllowedKernels(~0), m_iKernel(CRijndael::TABLE)
+	{
+	}
+
+	//Expand a user-supplied key material into a session key.
+	//Only the round keys of the requested directions are computed; using the other
+	//direction afterwards gives garbage.
+	// key        - KEY_SIZE bytes of key material.
+	// iDirections - ENCRYPTION, DECRYPTION or both.
+	void MakeKey(char const* key, int iDirections = ENCRYPTION | DECRYPTION)
+	{
+		//Copy user material bytes into the first words, then extrapolate using phi
+		int w[(ROUNDS+1)*BC];
+		int t;
+		for(t=0; t<KC && t<(ROUNDS+1)*BC; t++, key += 4)
+			w[t] = ((unsigned char)key[0] << 24) |
+				((unsigned char)key[1] << 16) |
+				((unsigned char)key[2] <<  8) |
+				(unsigned char)key[3];
+		for(; t<(ROUNDS+1)*BC; t++)
+		{
+			int tt = w[t-1];
+			if(0 == t % KC)
+				tt = SubWord((tt << 8) | ((tt >> 24) & 0xFF)) ^ ((CRijndael::sm_rcon[t/KC - 1] & 0xFF) << 24);
+			else if(8 == KC && 4 == t % KC)
+				tt = SubWord(tt);
+			w[t] = w[t-KC] ^ tt;
+		}
+		m_iKernel = CRijndael::SelectKernel(BLOCK_SIZE, m_iAllowedKernels);
+		if(iDirections & ENCRYPTION)
+		{
+			for(int r=0; r<=ROUNDS; r++)
+				for(int j=0; j<BC; j++)
+					m_Ke[r][j] = w[r*BC + j];
+			LayOut(m_Ke, m_KeBytes, m_KeSlices);
+		}
+		if(iDirections & DECRYPTION)
+		{
+			//Reverse order, Inverse MixColumn where needed
+			for(int r=0; r<=ROUNDS; r++)
+				for(int j=0; j<BC; j++)
+				{
+					const int tt = w[(ROUNDS - r)*BC + j];
+					m_Kd[r][j] = (0 == r || ROUNDS == r) ? tt :
+						CRijndael::sm_U1[(tt >> 24) & 0xFF] ^
+						CRijndael::sm_U2[(tt >> 16) & 0xFF] ^
+						CRijndael::sm_U3[(tt >>  8) & 0xFF] ^
+						CRijndael::sm_U4[tt & 0xFF];
+				}
+			LayOut(m_Kd, m_KdBytes, m_KdSlices);
+		}
+	}
+
+	//Encrypt exactly one block of plaintext.
+	// in           - The plaintext.
+	// result       - The ciphertext generated from a plaintext using the key.
+	void EncryptBlock(char const* in, char* result) const
+	{
+#ifdef RIJNDAEL_AESNI
+		if(BLOCK_SIZE == 32 && CRijndael::AESNI == m_iKernel)
+		{
+			CRijndael::AESNIEncryptBlock256(m_KeBytes[0], ROUNDS, in, result);
+			return;
+		}
+#endif
+#ifdef RIJNDAEL_AVX2
+		if(BLOCK_SIZE == 32 && CRijndael::BITSLICE == m_iKernel)
+		{
+			CRijndael::AVX2EncryptBlocks256(m_KeSlices[0][0], ROUNDS, in, result, 1);
+			return;
+		}
+#endif
+		int t[BC], u[BC];
+		Load(in, t, m_Ke[0]);
+		EncryptRounds(t, u, Round<1>());
+		Store(u, result, m_Ke[ROUNDS], CRijndael::sm_S, S1, S2, S3);
+	}
+
+	//Decrypt exactly one block of ciphertext.
+	// in         - The ciphertext.
+	// result     - The plaintext generated from a ciphertext using the session key.
+	void DecryptBlock(char const* in, char* result) const
+	{
+#ifdef RIJNDAEL_AESNI
+		if(BLOCK_SIZE == 32 && CRijndael::AESNI == m_iKernel)
+		{
+			CRijndael::AESNIDecryptBlock256(m_KdBytes[0], ROUNDS, in, result);
+			return;
+		}
+#endif
+#ifdef RIJNDAEL_AVX2
+		if(BLOCK_SIZE == 32 && CRijndael::BITSLICE == m_iKernel)
+		{
+			CRijndael::AVX2DecryptBlocks256(m_KdSlices[0][0], ROUNDS, in, result, 1);
+			return;
+		}
+#endif
+		int t[BC], u[BC];
+		Load(in, t, m_Kd[0]);
+		DecryptRounds(t, u, Round<1>());
+		Store(u, result, m_Kd[ROUNDS], CRijndael::sm_Si, BC - S1, BC - S2, BC - S3);
+	}
+
+	//Encrypt n bytes in CBC mode with a caller-owned chain block.
+	// in         - The plaintext, n must be a multiple of BLOCK_SIZE.
+	// result     - The ciphertext, may be the same buffer as in.
+	// chain      - The previous ciphertext block. On return, the last ciphertext block.
+	void EncryptCBC(char const* in, char* result, size_t n, char* chain) const
+	{
+#ifdef RIJNDAEL_AESNI
+		if(BLOCK_SIZE == 32 && CRijndael::AESNI == m_iKernel)
+		{
+			CRijndael::AESNIEncryptCBC256(m_KeBytes[0], ROUNDS, in, result, n / BLOCK_SIZE, chain);
+			return;
+		}
+#endif
+		for(size_t b=0; b<n/BLOCK_SIZE; b++, in += BLOCK_SIZE, result += BLOCK_SIZE)
+		{
+			for(int i=0; i<BLOCK_SIZE; i++)
+				chain[i] ^= in[i];
+			EncryptBlock(chain, chain);
+			memcpy(result, chain, BLOCK_SIZE);
+		}
+	}
+
+	//Decrypt n bytes in CBC mode with a caller-owned chain block.
+	// in         - The ciphertext, n must be a multiple of BLOCK_SIZE.
+	// result     - The plaintext, may be the same buffer as in.
+	// chain      - The previous ciphertext block. On return, the last ciphertext block.
+	void DecryptCBC(char const* in, char* result, size_t n, char* chain) const
+	{
+#ifdef RIJNDAEL_AESNI
+		if(BLOCK_SIZE == 32 && CRijndael::AESNI == m_iKernel)
+		{
+			CRijndael::AESNIDecryptCBC256(m_KdBytes[0], ROUNDS, in, result, n / BLOCK_SIZE, chain);
+			return;
+		}
+#endif
+#ifdef RIJNDAEL_AVX2
+		if(BLOCK_SIZE == 32 && CRijndael::BITSLICE == m_iKernel)
+		{
+			CRijndael::AVX2DecryptCBC256(m_KdSlices[0][0], ROUNDS, in, result, n / BLOCK_SIZE, chain);
+			return;
+		}
+#endif
+		char block[BLOCK_SIZE];
+		char next[BLOCK_SIZE];
+		for(size_t b=0; b<n/BLOCK_SIZE; b++, in += BLOCK_SIZE, result += BLOCK_SIZE)
+		{
+			//Keep the ciphertext needed for chaining before result overwrites it
+			memcpy(next, in, BLOCK_SIZE);
+			DecryptBlock(in, block);
+			for(int i=0; i<BLOCK_SIZE; i++)
+				result[i] = block[i] ^ chain[i];
+			memcpy(chain, next, BLOCK_SIZE);
+		}
+	}
+
+	//Encrypt independent streams in CBC mode, each with its own engine and chain block.
+	//A CBC stream cannot be encrypted faster than one block after the other, so the
+	//streams are advanced together on the lanes of the hardware kernels: four streams
+	//on AES-NI, eight on bitsliced AVX2. Streams of different lengths drop out as they end.
+	// engines    - The engine of each stream.
+	// in         - The plaintext of each stream.
+	// result     - The ciphertext of each stream, may be the same buffer as in.
+	// chains     - The chain block of each stream, updated on return.
+	// n          - The byte length of each stream, a multiple of BLOCK_SIZE.
+	// lanes      - The number of streams.
+	static void EncryptCBCLanes(CRijndaelFixed const* const engines[], char const* const in[], char* const result[],
+		char* const chains[], const size_t n[], size_t lanes)
+	{
+		enum { MAX_LANES = 8 };
+		for(size_t first=0; first<lanes; )
+		{
+			const int kernel = engines[first]->m_iKernel;
+			const size_t width = (CRijndael::AESNI == kernel) ? 4 : (CRijndael::BITSLICE == kernel) ? 8 : 1;
+			size_t count = (lanes - first < width) ? lanes - first : width;
+			for(size_t l=1; l<count; l++)
+				if(engines[first + l]->m_iKernel != kernel)
+					count = l;
+			if(BLOCK_SIZE != 32 || 1 == count)
+			{
+				engines[first]->EncryptCBC(in[first], result[first], n[first], chains[first]);
+				first++;
+				continue;
+			}
+
+			size_t done[MAX_LANES] = {0};
+			for(;;)
+			{
+				//Streams with data left and the number of blocks all of them have
+				unsigned char const* ks[MAX_LANES];
+				char const* pin[MAX_LANES];
+				char* presult[MAX_LANES];
+				char* pchain[MAX_LANES];
+				size_t index[MAX_LANES];
+				size_t active = 0;
+				size_t common = 0;
+				for(size_t l=0; l<count; l++)
+				{
+					const size_t rest = n[first + l] - done[l];
+					if(0 == rest)
+						continue;
+					common = (0 == active || rest < common) ? rest : common;
+					index[active++] = l;
+				}
+				if(0 == active)
+					break;
+				for(size_t a=0; a<active; a++)
+				{
+					const size_t l = index[a];
+					ks[a] = engines[first + l]->m_KeBytes[0];
+					pin[a] = in[first + l] + done[l];
+					presult[a] = result[first + l] + done[l];
+					pchain[a] = chains[first + l];
+					done[l] += common;
+				}
+				if(1 == active)
+					engines[first + index[0]]->EncryptCBC(pin[0], presult[0], common, pchain[0]);
+#ifdef RIJNDAEL_AESNI
+				else if(CRijndael::AESNI == kernel)
+					CRijndael::AESNIEncryptCBC256Lanes(ks, ROUNDS, pin, presult, pchain, static_cast<int>(active), common / BLOCK_SIZE);
+#endif
+#ifdef RIJNDAEL_AVX2
+				else if(CRijndael::BITSLICE == kernel)
+					CRijndael::AVX2EncryptCBC256Lanes(ks, ROUNDS, pin, presult, pchain, static_cast<int>(active), common / BLOCK_SIZE);
+#endif
+			}
+			first += count;
+		}
+	}
+
+	//Allow or forbid the hardware kernels; takes effect at the next MakeKey()
+	void SetHardwareAcceleration(bool bEnable)
+	{
+		m_iAllowedKernels = bEnable ? ~0 : (1 << CRijndael::TABLE);
+	}
+
+	//Restrict the choice to one kernel; takes effect at the next MakeKey()
+	void SetKernel(int iKernel)
+	{
+		m_iAllowedKernels = (1 << CRijndael::TABLE) | (1 << iKernel);
+	}
+
+	int GetKernel() const
+	{
+		return m_iKernel;
+	}
+
+	bool IsHardwareAccelerated() const
+	{
+		return CRijndael::TABLE != m_iKernel;
+	}
+
+private:
+	//S-box applied to each byte of a word
+	static int SubWord(int tt)
+	{
+		return (CRijndael::sm_S[(tt >> 24) & 0xFF] & 0xFF) << 24 ^
+			(CRijndael::sm_S[(tt >> 16) & 0xFF] & 0xFF) << 16 ^
+			(CRijndael::sm_S[(tt >>  8) & 0xFF] & 0xFF) <<  8 ^
+			(CRijndael::sm_S[ tt & 0xFF] & 0xFF);
+	}
+
+	//Round keys of the selected kernel: bytes for AES-NI, bit planes of the bytes for AVX2
+	void LayOut(const int (&k)[ROUNDS+1][BC], unsigned char (&bytes)[ROUNDS+1][BLOCK_SIZE],
+		unsigned char (&slices)[ROUNDS+1][8][BLOCK_SIZE]) const
+	{
+		if(CRijndael::TABLE == m_iKernel)
+			return;
+		for(int r=0; r<=ROUNDS; r++)
+			for(int j=0; j<BC; j++)
+				for(int i=0; i<4; i++)
+					bytes[r][4*j+i] = (unsigned char)(k[r][j] >> (24 - 8*i));
+		if(CRijndael::BITSLICE != m_iKernel)
+			return;
+		for(int r=0; r<=ROUNDS; r++)
+			for(int b=0; b<8; b++)
+				for(int p=0; p<BLOCK_SIZE; p++)
+					slices[r][b][p] = ((bytes[r][p] >> b) & 1) ? 0xFF : 0;
+	}
+
+	//Read the block into words and add the first round key
+	static void Load(char const* in, int (&t)[BC], const int* k)
+	{
+		for(int i=0; i<BC; i++, in += 4)
+			t[i] = (((unsigned char)in[0] << 24) |
+				((unsigned char)in[1] << 16) |
+				((unsigned char)in[2] <<  8) |
+				(unsigned char)in[3]) ^ k[i];
+	}
+
+	//Last Round is Special
+	static void Store(const int (&t)[BC], char* result, const int* k, char const* box, int s1, int s2, int s3)
+	{
+		for(int i=0; i<BC; i++)
+		{
+			const int tt = k[i];
+			*(result++) = box[(t[i] >> 24) & 0xFF] ^ (tt >> 24);
+			*(result++) = box[(t[(i + s1) % BC] >> 16) & 0xFF] ^ (tt >> 16);
+			*(result++) = box[(t[(i + s2) % BC] >>  8) & 0xFF] ^ (tt >>  8);
+			*(result++) = box[ t[(i + s3) % BC] & 0xFF] ^ tt;
+		}
+	}
+
+	//Apply round R and the following ones, the last round excluded.
+	//Each round is a separate instantiation, so the rounds are unrolled.
+	template <int R>
+	RIJNDAEL_FORCEINLINE void EncryptRounds(const int (&t)[BC], int (&result)[BC], Round<R>) const
+	{
+		int a[BC];
+		for(int i=0; i<BC; i++)
+			a[i] = (CRijndael::sm_T1[(t[i] >> 24) & 0xFF] ^
+				CRijndael::sm_T2[(t[(i + S1) % BC] >> 16) & 0xFF] ^
+				CRijndael::sm_T3[(t[(i + S2) % BC] >>  8) & 0xFF] ^
+				CRijndael::sm_T4[ t[(i + S3) % BC] & 0xFF]) ^ m_Ke[R][i];
+		EncryptRounds(a, result, Round<R + 1>());
+	}
+
+	RIJNDAEL_FORCEINLINE void EncryptRounds(const int (&t)[BC], int (&result)[BC], Round<ROUNDS>) const
+	{
+		memcpy(result, t, sizeof(result));
+	}
+
+	template <int R>
+	RIJNDAEL_FORCEINLINE void DecryptRounds(const int (&t)[BC], int (&result)[BC], Round<R>) const
+	{
+		int a[BC];
+		for(int i=0; i<BC; i++)
+			a[i] = (CRijndael::sm_T5[(t[i] >> 24) & 0xFF] ^
+				CRijndael::sm_T6[(t[(i + BC - S1) % BC] >> 16) & 0xFF] ^
+				CRijndael::sm_T7[(t[(i + BC - S2) % BC] >>  8) & 0xFF] ^
+				CRijndael::sm_T8[ t[(i + BC - S3) % BC] & 0xFF]) ^ m_Kd[R][i];
+		DecryptRounds(a, result, Round<R + 1>());
+	}
+
+	RIJNDAEL_FORCEINLINE void DecryptRounds(const int (&t)[BC], int (&result)[BC], Round<ROUNDS>) const
+	{
+		memcpy(result, t, sizeof(result));
+	}
+
+private:
+	//Encryption (m_Ke) and decryption (m_Kd) round keys
+	int m_Ke[ROUNDS+1][BC];
+	int m_Kd[ROUNDS+1][BC];
+	//Round keys of the AES-NI kernel, in byte order
+	unsigned char m_KeBytes[ROUNDS+1][BLOCK_SIZE];
+	unsigned char m_KdBytes[ROUNDS+1][BLOCK_SIZE];
+	//Round keys of the bitsliced kernel, as bit planes
+	unsigned char m_KeSlices[ROUNDS+1][8][BLOCK_SIZE];
+	unsigned char m_KdSlices[ROUNDS+1][8][BLOCK_SIZE];
+	//Allowed Kernels (one bit per kernel) and the selected one
+	int m_iAllowedKernels;
+	int m_iKernel;
+};
+
+//The geometry of AttacheCase archives: 256-bit keys and 256-bit blocks
+typedef CRijndaelFixed<32, 32> CRijndael256;
+
+#endif // __RIJNDAEL_FIXED_H__
@@ -0,0 +1,325 @@
+
+//Rijndael_aesni.cpp
+
+//Rijndael with 256-bit blocks on AES-NI.
+//A 256-bit state is kept as two 128-bit halves (columns 0-3 and 4-7). AESENC and
+//AESDEC apply the AES ShiftRows (row offsets 0, 1, 2, 3 within 4 columns), so before
+//each round the bytes are exchanged between the halves with BLENDV and reordered with
+//PSHUFB such that the AES ShiftRows yields the Rijndael-256 one (offsets 0, 1, 3, 4).
+//SubBytes, MixColumns and AddRoundKey work column by column and need no adjustment.
+//Decryption uses the equivalent inverse cipher, as the table code does with m_Kd.
+
+#include "Rijndael.h"
+
+#ifdef RIJNDAEL_AESNI
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RIJNDAEL_TARGET_AESNI
+#else
+#include <cpuid.h>
+#define RIJNDAEL_TARGET_AESNI __attribute__((target("aes,sse4.1")))
+#endif
+
+#include <wmmintrin.h>
+#include <smmintrin.h>
+
+namespace {
+
+	//Bytes taken from the other half before the round (high bit set)
+	RIJNDAEL_TARGET_AESNI inline __m128i EncryptBlendMask()
+	{
+		return _mm_setr_epi8(0, -128, -128, -128, 0, 0, -128, -128, 0, 0, -128, -128, 0, 0, 0, -128);
+	}
+
+	//Byte order expected by AESENC after the blend
+	RIJNDAEL_TARGET_AESNI inline __m128i EncryptShuffleMask()
+	{
+		return _mm_setr_epi8(0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, 3);
+	}
+
+	RIJNDAEL_TARGET_AESNI inline __m128i DecryptBlendMask()
+	{
+		return _mm_setr_epi8(0, 0, 0, -128, 0, 0, -128, -128, 0, 0, -128, -128, 0, -128, -128, -128);
+	}
+
+	RIJNDAEL_TARGET_AESNI inline __m128i DecryptShuffleMask()
+	{
+		return _mm_setr_epi8(0, 1, 14, 15, 4, 5, 2, 3, 8, 9, 6, 7, 12, 13, 10, 11);
+	}
+
+	RIJNDAEL_TARGET_AESNI inline __m128i Load(void const* p)
+	{
+		return _mm_loadu_si128(static_cast<__m128i const*>(p));
+	}
+
+	RIJNDAEL_TARGET_AESNI inline void Store(void* p, __m128i v)
+	{
+		_mm_storeu_si128(static_cast<__m128i*>(p), v);
+	}
+
+	//Move the bytes of both halves to the positions the next AES round expects
+	RIJNDAEL_TARGET_AESNI inline void Exchange(__m128i& s0, __m128i& s1, __m128i blend, __m128i shuffle)
+	{
+		__m128i t0 = _mm_blendv_epi8(s0, s1, blend);
+		__m128i t1 = _mm_blendv_epi8(s1, s0, blend);
+		s0 = _mm_shuffle_epi8(t0, shuffle);
+		s1 = _mm_shuffle_epi8(t1, shuffle);
+	}
+
+}; // anonymous namespace
+
+bool CRijndael::HasAESNI()
+{
+	static const bool bAvailable = []() -> bool
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		unsigned int ecx = static_cast<unsigned int>(info[2]);
+#else
+		unsigned int eax, ebx, ecx, edx;
+		if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return false;
+#endif
+		//SSSE3 (PSHUFB), SSE4.1 (PBLENDVB) and AES-NI
+		return (ecx & (1u << 9)) && (ecx & (1u << 19)) && (ecx & (1u << 25));
+	}();
+	return bAvailable;
+}
+
+//Encrypt exactly one 256-bit block.
+// ks         - The encryption round keys (m_KeBytes).
+// rounds     - The number of rounds.
+RIJNDAEL_TARGET_AESNI
+void CRijndael::AESNIEncryptBlock256(unsigned char const* ks, int rounds, char const* in, char* result)
+{
+	const __m128i blend = EncryptBlendMask();
+	const __m128i shuffle = EncryptShuffleMask();
+	__m128i s0 = _mm_xor_si128(Load(in), Load(ks));
+	__m128i s1 = _mm_xor_si128(Load(in + 16), Load(ks + 16));
+	for(int r=1; r<rounds; r++)
+	{
+		ks += 32;
+		Exchange(s0, s1, blend, shuffle);
+		s0 = _mm_aesenc_si128(s0, Load(ks));
+		s1 = _mm_aesenc_si128(s1, Load(ks + 16));
+	}
+	//Last Round is Special
+	ks += 32;
+	Exchange(s0, s1, blend, shuffle);
+	Store(result, _mm_aesenclast_si128(s0, Load(ks)));
+	Store(result + 16, _mm_aesenclast_si128(s1, Load(ks + 16)));
+}
+
+//Decrypt exactly one 256-bit block.
+// ks         - The decryption round keys (m_KdBytes).
+// rounds     - The number of rounds.
+RIJNDAEL_TARGET_AESNI
+void CRijndael::AESNIDecryptBlock256(unsigned char const* ks, int rounds, char const* in, char* result)
+{
+	const __m128i blend = DecryptBlendMask();
+	const __m128i shuffle = DecryptShuffleMask();
+	__m128i s0 = _mm_xor_si128(Load(in), Load(ks));
+	__m128i s1 = _mm_xor_si128(Load(in + 16), Load(ks + 16));
+	for(int r=1; r<rounds; r++)
+	{
+		ks += 32;
+		Exchange(s0, s1, blend, shuffle);
+		s0 = _mm_aesdec_si128(s0, Load(ks));
+		s1 = _mm_aesdec_si128(s1, Load(ks + 16));
+	}
+	//Last Round is Special
+	ks += 32;
+	Exchange(s0, s1, blend, shuffle);
+	Store(result, _mm_aesdeclast_si128(s0, Load(ks)));
+	Store(result + 16, _mm_aesdeclast_si128(s1, Load(ks + 16)));
+}
+
+//Encrypt blocks in CBC mode.
+//The chain block stays in registers between blocks.
+// ks         - The encryption round keys (m_KeBytes).
+// rounds     - The number of rounds.
+// blocks     - The number of 256-bit blocks.
+// chain      - The previous ciphertext block. On return, the last ciphertext block.
+RIJNDAEL_TARGET_AESNI
+void CRijndael::AESNIEncryptCBC256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks, char* chain)
+{
+	const __m128i blend = EncryptBlendMask();
+	const __m128i shuffle = EncryptShuffleMask();
+	__m128i s0 = Load(chain);
+	__m128i s1 = Load(chain + 16);
+	for(; blocks > 0; blocks--, in += 32, result += 32)
+	{
+		unsigned char const* k = ks;
+		s0 = _mm_xor_si128(_mm_xor_si128(s0, Load(in)), Load(k));
+		s1 = _mm_xor_si128(_mm_xor_si128(s1, Load(in + 16)), Load(k + 16));
+		for(int r=1; r<rounds; r++)
+		{
+			k += 32;
+			Exchange(s0, s1, blend, shuffle);
+			s0 = _mm_aesenc_si128(s0, Load(k));
+			s1 = _mm_aesenc_si128(s1, Load(k + 16));
+		}
+		//Last Round is Special
+		k += 32;
+		Exchange(s0, s1, blend, shuffle);
+		s0 = _mm_aesenclast_si128(s0, Load(k));
+		s1 = _mm_aesenclast_si128(s1, Load(k + 16));
+		Store(result, s0);
+		Store(result + 16, s1);
+	}
+	Store(chain, s0);
+	Store(chain + 16, s1);
+}
+
+namespace {
+
+	//CBC encryption of L independent streams; the AESENC chains of the lanes are interleaved
+	template <int L>
+	RIJNDAEL_TARGET_AESNI void EncryptCBCLanes(unsigned char const* const ks[], int rounds,
+		char const* const in[], char* const result[], char* const chain[], size_t blocks)
+	{
+		const __m128i blend = EncryptBlendMask();
+		const __m128i shuffle = EncryptShuffleMask();
+		__m128i s[2*L];
+		for(int l=0; l<L; l++)
+		{
+			s[2*l] = Load(chain[l]);
+			s[2*l+1] = Load(chain[l] + 16);
+		}
+		for(size_t b=0; b<blocks; b++)
+		{
+			for(int l=0; l<L; l++)
+			{
+				s[2*l] = _mm_xor_si128(_mm_xor_si128(s[2*l], Load(in[l] + 32*b)), Load(ks[l]));
+				s[2*l+1] = _mm_xor_si128(_mm_xor_si128(s[2*l+1], Load(in[l] + 32*b + 16)), Load(ks[l] + 16));
+			}
+			for(int r=1; r<rounds; r++)
+				for(int l=0; l<L; l++)
+				{
+					Exchange(s[2*l], s[2*l+1], blend, shuffle);
+					s[2*l] = _mm_aesenc_si128(s[2*l], Load(ks[l] + 32*r));
+					s[2*l+1] = _mm_aesenc_si128(s[2*l+1], Load(ks[l] + 32*r + 16));
+				}
+			//Last Round is Special
+			for(int l=0; l<L; l++)
+			{
+				Exchange(s[2*l], s[2*l+1], blend, shuffle);
+				s[2*l] = _mm_aesenclast_si128(s[2*l], Load(ks[l] + 32*rounds));
+				s[2*l+1] = _mm_aesenclast_si128(s[2*l+1], Load(ks[l] + 32*rounds + 16));
+				Store(result[l] + 32*b, s[2*l]);
+				Store(result[l] + 32*b + 16, s[2*l+1]);
+			}
+		}
+		for(int l=0; l<L; l++)
+		{
+			Store(chain[l], s[2*l]);
+			Store(chain[l] + 16, s[2*l+1]);
+		}
+	}
+
+}; // anonymous namespace
+
+//Encrypt up to four independent streams in CBC mode, in lockstep.
+//A single CBC stream waits for each block before starting the next one; with several
+//streams the rounds of one block per stream are interleaved instead.
+// ks         - The encryption round keys of each stream (m_KeBytes).
+// rounds     - The number of rounds.
+// blocks     - The number of 256-bit blocks, the same for all streams.
+// chain      - The chain block of each stream, updated on return.
+// lanes      - The number of streams, 1 to 4.
+void CRijndael::AESNIEncryptCBC256Lanes(unsigned char const* const ks[], int rounds, char const* const in[],
+	char* const result[], char* const chain[], int lanes, size_t blocks)
+{
+	switch(lanes)
+	{
+	case 1:
+		EncryptCBCLanes<1>(ks, rounds, in, result, chain, blocks);
+		break;
+	case 2:
+		EncryptCBCLanes<2>(ks, rounds, in, result, chain, blocks);
+		break;
+	case 3:
+		EncryptCBCLanes<3>(ks, rounds, in, result, chain, blocks);
+		break;
+	default:
+		EncryptCBCLanes<4>(ks, rounds, in, result, chain, blocks);
+		break;
+	}
+}
+
+//Decrypt blocks in CBC mode, four blocks at a time.
+//CBC decryption has no dependency between blocks, so the AESDEC chains of four
+//blocks are interleaved to keep the AES unit busy.
+// ks         - The decryption round keys (m_KdBytes).
+// rounds     - The number of rounds.
+// blocks     - The number of 256-bit blocks.
+// chain      - The previous ciphertext block. On return, the last ciphertext block.
+RIJNDAEL_TARGET_AESNI
+void CRijndael::AESNIDecryptCBC256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks, char* chain)
+{
+	const __m128i blend = DecryptBlendMask();
+	const __m128i shuffle = DecryptShuffleMask();
+	__m128i iv0 = Load(chain);
+	__m128i iv1 = Load(chain + 16);
+	for(; blocks >= 4; blocks -= 4, in += 128, result += 128)
+	{
+		__m128i c[8], s[8];
+		unsigned char const* k = ks;
+		for(int i=0; i<8; i++)
+		{
+			c[i] = Load(in + 16*i);
+			s[i] = _mm_xor_si128(c[i], Load(k + 16*(i & 1)));
+		}
+		for(int r=1; r<rounds; r++)
+		{
+			k += 32;
+			const __m128i k0 = Load(k);
+			const __m128i k1 = Load(k + 16);
+			for(int i=0; i<8; i+=2)
+			{
+				Exchange(s[i], s[i+1], blend, shuffle);
+				s[i] = _mm_aesdec_si128(s[i], k0);
+				s[i+1] = _mm_aesdec_si128(s[i+1], k1);
+			}
+		}
+		//Last Round is Special
+		k += 32;
+		const __m128i k0 = Load(k);
+		const __m128i k1 = Load(k + 16);
+		for(int i=0; i<8; i+=2)
+		{
+			Exchange(s[i], s[i+1], blend, shuffle);
+			s[i] = _mm_aesdeclast_si128(s[i], k0);
+			s[i+1] = _mm_aesdeclast_si128(s[i+1], k1);
+		}
+		Store(result, _mm_xor_si128(s[0], iv0));
+		Store(result + 16, _mm_xor_si128(s[1], iv1));
+		for(int i=2; i<8; i++)
+			Store(result + 16*i, _mm_xor_si128(s[i], c[i-2]));
+		iv0 = c[6];
+		iv1 = c[7];
+	}
+	for(; blocks > 0; blocks--, in += 32, result += 32)
+	{
+		const __m128i c0 = Load(in);
+		const __m128i c1 = Load(in + 16);
+		AESNIDecryptBlock256(ks, rounds, in, result);
+		Store(result, _mm_xor_si128(Load(result), iv0));
+		Store(result + 16, _mm_xor_si128(Load(result + 16), iv1));
+		iv0 = c0;
+		iv1 = c1;
+	}
+	Store(chain, iv0);
+	Store(chain + 16, iv1);
+}
+
+#else
+
+bool CRijndael::HasAESNI()
+{
+	return false;
+}
+
+#endif // RIJNDAEL_AESNI
@@ -0,0 +1,511 @@
+
+//Rijndael_avx2.cpp
+
+//Bitsliced Rijndael with 256-bit blocks on AVX2.
+//Eight blocks are processed at once. The state is kept as eight 256-bit planes: plane b
+//holds bit b of every state byte, byte p of a plane belongs to state byte p and bit k of
+//that byte to block k. Blocks and planes are converted with an 8x8 bit transposition in
+//every byte position, which is its own inverse.
+//SubBytes is evaluated as a Boolean circuit (Boyar and Peralta), ShiftRows and the row
+//rotations of MixColumns are byte shuffles. No table is read and nothing branches on the
+//data, so the running time does not depend on the key or the blocks.
+//Decryption uses the equivalent inverse cipher, as the table code does with m_Kd.
+
+#include "Rijndael.h"
+
+#ifdef RIJNDAEL_AVX2
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RIJNDAEL_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define RIJNDAEL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#include <immintrin.h>
+
+namespace {
+
+	typedef __m256i Planes[8];
+
+	RIJNDAEL_TARGET_AVX2 inline __m256i Xor256(__m256i a, __m256i b)
+	{
+		return _mm256_xor_si256(a, b);
+	}
+
+	RIJNDAEL_TARGET_AVX2 inline __m256i And256(__m256i a, __m256i b)
+	{
+		return _mm256_and_si256(a, b);
+	}
+
+	//The same byte shuffle in both 128-bit lanes
+	RIJNDAEL_TARGET_AVX2 inline __m256i LaneMask(char b0, char b1, char b2, char b3, char b4, char b5, char b6, char b7,
+		char b8, char b9, char b10, char b11, char b12, char b13, char b14, char b15)
+	{
+		return _mm256_broadcastsi128_si256(_mm_setr_epi8(b0, b1, b2, b3, b4, b5, b6, b7,
+			b8, b9, b10, b11, b12, b13, b14, b15));
+	}
+
+	template <int N>
+	RIJNDAEL_TARGET_AVX2 inline void SwapMove(__m256i& a, __m256i& b, __m256i mask)
+	{
+		const __m256i t = And256(Xor256(_mm256_srli_epi64(a, N), b), mask);
+		b = Xor256(b, t);
+		a = Xor256(a, _mm256_slli_epi64(t, N));
+	}
+
+	//Bit j of byte p in x[i] <-> bit i of byte p in x[j]
+	RIJNDAEL_TARGET_AVX2 inline void Transpose(Planes x)
+	{
+		const __m256i m1 = _mm256_set1_epi8(0x55);
+		const __m256i m2 = _mm256_set1_epi8(0x33);
+		const __m256i m4 = _mm256_set1_epi8(0x0F);
+		SwapMove<1>(x[0], x[1], m1);
+		SwapMove<1>(x[2], x[3], m1);
+		SwapMove<1>(x[4], x[5], m1);
+		SwapMove<1>(x[6], x[7], m1);
+		SwapMove<2>(x[0], x[2], m2);
+		SwapMove<2>(x[1], x[3], m2);
+		SwapMove<2>(x[4], x[6], m2);
+		SwapMove<2>(x[5], x[7], m2);
+		SwapMove<4>(x[0], x[4], m4);
+		SwapMove<4>(x[1], x[5], m4);
+		SwapMove<4>(x[2], x[6], m4);
+		SwapMove<4>(x[3], x[7], m4);
+	}
+
+	//Read up to eight blocks into planes; missing blocks are zero
+	RIJNDAEL_TARGET_AVX2 inline void LoadBlocks(char const* in, size_t blocks, Planes x)
+	{
+		for(size_t k=0; k<8; k++)
+			x[k] = (k < blocks) ? _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in + 32*k)) : _mm256_setzero_si256();
+		Transpose(x);
+	}
+
+	RIJNDAEL_TARGET_AVX2 inline void AddRoundKey(Planes x, unsigned char const* ks)
+	{
+		for(int b=0; b<8; b++)
+			x[b] = Xor256(x[b], _mm256_loadu_si256(reinterpret_cast<__m256i const*>(ks + 32*b)));
+	}
+
+	//S-box circuit by Joan Boyar and René Peralta, x0 is the most significant bit
+	RIJNDAEL_TARGET_AVX2 inline void SubBytes(Planes q)
+	{
+		const __m256i ones = _mm256_set1_epi8(-1);
+		const __m256i x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+		const __m256i x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+		//Top linear transformation
+		const __m256i y14 = Xor256(x3, x5);
+		const __m256i y13 = Xor256(x0, x6);
+		const __m256i y9 = Xor256(x0, x3);
+		const __m256i y8 = Xor256(x0, x5);
+		const __m256i t0 = Xor256(x1, x2);
+		const __m256i y1 = Xor256(t0, x7);
+		const __m256i y4 = Xor256(y1, x3);
+		const __m256i y12 = Xor256(y13, y14);
+		const __m256i y2 = Xor256(y1, x0);
+		const __m256i y5 = Xor256(y1, x6);
+		const __m256i y3 = Xor256(y5, y8);
+		const __m256i t1 = Xor256(x4, y12);
+		const __m256i y15 = Xor256(t1, x5);
+		const __m256i y20 = Xor256(t1, x1);
+		const __m256i y6 = Xor256(y15, x7);
+		const __m256i y10 = Xor256(y15, t0);
+		const __m256i y11 = Xor256(y20, y9);
+		const __m256i y7 = Xor256(x7, y11);
+		const __m256i y17 = Xor256(y10, y11);
+		const __m256i y19 = Xor256(y10, y8);
+		const __m256i y16 = Xor256(t0, y11);
+		const __m256i y21 = Xor256(y13, y16);
+		const __m256i y18 = Xor256(x0, y16);
+
+		//Non-linear section
+		const __m256i t2 = And256(y12, y15);
+		const __m256i t3 = And256(y3, y6);
+		const __m256i t4 = Xor256(t3, t2);
+		const __m256i t5 = And256(y4, x7);
+		const __m256i t6 = Xor256(t5, t2);
+		const __m256i t7 = And256(y13, y16);
+		const __m256i t8 = And256(y5, y1);
+		const __m256i t9 = Xor256(t8, t7);
+		const __m256i t10 = And256(y2, y7);
+		const __m256i t11 = Xor256(t10, t7);
+		const __m256i t12 = And256(y9, y11);
+		const __m256i t13 = And256(y14, y17);
+		const __m256i t14 = Xor256(t13, t12);
+		const __m256i t15 = And256(y8, y10);
+		const __m256i t16 = Xor256(t15, t12);
+		const __m256i t17 = Xor256(t4, t14);
+		const __m256i t18 = Xor256(t6, t16);
+		const __m256i t19 = Xor256(t9, t14);
+		const __m256i t20 = Xor256(t11, t16);
+		const __m256i t21 = Xor256(t17, y20);
+		const __m256i t22 = Xor256(t18, y19);
+		const __m256i t23 = Xor256(t19, y21);
+		const __m256i t24 = Xor256(t20, y18);
+
+		const __m256i t25 = Xor256(t21, t22);
+		const __m256i t26 = And256(t21, t23);
+		const __m256i t27 = Xor256(t24, t26);
+		const __m256i t28 = And256(t25, t27);
+		const __m256i t29 = Xor256(t28, t22);
+		const __m256i t30 = Xor256(t23, t24);
+		const __m256i t31 = Xor256(t22, t26);
+		const __m256i t32 = And256(t31, t30);
+		const __m256i t33 = Xor256(t32, t24);
+		const __m256i t34 = Xor256(t23, t33);
+		const __m256i t35 = Xor256(t27, t33);
+		const __m256i t36 = And256(t24, t35);
+		const __m256i t37 = Xor256(t36, t34);
+		const __m256i t38 = Xor256(t27, t36);
+		const __m256i t39 = And256(t29, t38);
+		const __m256i t40 = Xor256(t25, t39);
+
+		const __m256i t41 = Xor256(t40, t37);
+		const __m256i t42 = Xor256(t29, t33);
+		const __m256i t43 = Xor256(t29, t40);
+		const __m256i t44 = Xor256(t33, t37);
+		const __m256i t45 = Xor256(t42, t41);
+		const __m256i z0 = And256(t44, y15);
+		const __m256i z1 = And256(t37, y6);
+		const __m256i z2 = And256(t33, x7);
+		const __m256i z3 = And256(t43, y16);
+		const __m256i z4 = And256(t40, y1);
+		const __m256i z5 = And256(t29, y7);
+		const __m256i z6 = And256(t42, y11);
+		const __m256i z7 = And256(t45, y17);
+		const __m256i z8 = And256(t41, y10);
+		const __m256i z9 = And256(t44, y12);
+		const __m256i z10 = And256(t37, y3);
+		const __m256i z11 = And256(t33, y4);
+		const __m256i z12 = And256(t43, y13);
+		const __m256i z13 = And256(t40, y5);
+		const __m256i z14 = And256(t29, y2);
+		const __m256i z15 = And256(t42, y9);
+		const __m256i z16 = And256(t45, y14);
+		const __m256i z17 = And256(t41, y8);
+
+		//Bottom linear transformation
+		const __m256i t46 = Xor256(z15, z16);
+		const __m256i t47 = Xor256(z10, z11);
+		const __m256i t48 = Xor256(z5, z13);
+		const __m256i t49 = Xor256(z9, z10);
+		const __m256i t50 = Xor256(z2, z12);
+		const __m256i t51 = Xor256(z2, z5);
+		const __m256i t52 = Xor256(z7, z8);
+		const __m256i t53 = Xor256(z0, z3);
+		const __m256i t54 = Xor256(z6, z7);
+		const __m256i t55 = Xor256(z16, z17);
+		const __m256i t56 = Xor256(z12, t48);
+		const __m256i t57 = Xor256(t50, t53);
+		const __m256i t58 = Xor256(z4, t46);
+		const __m256i t59 = Xor256(z3, t54);
+		const __m256i t60 = Xor256(t46, t57);
+		const __m256i t61 = Xor256(z14, t57);
+		const __m256i t62 = Xor256(t52, t58);
+		const __m256i t63 = Xor256(t49, t58);
+		const __m256i t64 = Xor256(z4, t59);
+		const __m256i t65 = Xor256(t61, t62);
+		const __m256i t66 = Xor256(z1, t63);
+		const __m256i s0 = Xor256(t59, t63);
+		const __m256i s6 = Xor256(Xor256(t56, t62), ones);
+		const __m256i s7 = Xor256(Xor256(t48, t60), ones);
+		const __m256i t67 = Xor256(t64, t65);
+		const __m256i s3 = Xor256(t53, t66);
+		const __m256i s4 = Xor256(t51, t66);
+		const __m256i s5 = Xor256(t47, t65);
+		const __m256i s1 = Xor256(Xor256(t64, s3), ones);
+		const __m256i s2 = Xor256(Xor256(t55, t67), ones);
+
+		q[7] = s0;
+		q[6] = s1;
+		q[5] = s2;
+		q[4] = s3;
+		q[3] = s4;
+		q[2] = s5;
+		q[1] = s6;
+		q[0] = s7;
+	}
+
+	//Inverse of the affine transformation of the S-box
+	RIJNDAEL_TARGET_AVX2 inline void InvAffine(Planes q)
+	{
+		const __m256i ones = _mm256_set1_epi8(-1);
+		Planes y;
+		for(int b=0; b<8; b++)
+			y[b] = q[b];
+		for(int b=0; b<8; b++)
+			q[b] = Xor256(Xor256(y[(b + 2) % 8], y[(b + 5) % 8]), y[(b + 7) % 8]);
+		//Constant 0x05
+		q[0] = Xor256(q[0], ones);
+		q[2] = Xor256(q[2], ones);
+	}
+
+	//Si = A^-1 o S o A^-1, the inversion in GF(2^8) being an involution
+	RIJNDAEL_TARGET_AVX2 inline void InvSubBytes(Planes q)
+	{
+		InvAffine(q);
+		SubBytes(q);
+		InvAffine(q);
+	}
+
+	//Byte permutation across the lanes: the bytes staying in their lane and the bytes
+	//coming from the other lane are shuffled separately
+	RIJNDAEL_TARGET_AVX2 inline void ShiftRows(Planes x, __m256i same, __m256i other)
+	{
+		for(int b=0; b<8; b++)
+		{
+			const __m256i swapped = _mm256_permute4x64_epi64(x[b], 0x4E);
+			x[b] = _mm256_or_si256(_mm256_shuffle_epi8(x[b], same), _mm256_shuffle_epi8(swapped, other));
+		}
+	}
+
+	//Multiply every byte by 2 in GF(2^8)
+	RIJNDAEL_TARGET_AVX2 inline void Xtime(Planes t)
+	{
+		const __m256i hi = t[7];
+		t[7] = t[6];
+		t[6] = t[5];
+		t[5] = t[4];
+		t[4] = Xor256(t[3], hi);
+		t[3] = Xor256(t[2], hi);
+		t[2] = t[1];
+		t[1] = Xor256(t[0], hi);
+		t[0] = hi;
+	}
+
+	//b'[r] = 2 b[r] ^ 3 b[r+1] ^ b[r+2] ^ b[r+3]
+	//      = 2 (b[r] ^ b[r+1]) ^ b[r+1] ^ (b[r+2] ^ b[r+3])
+	RIJNDAEL_TARGET_AVX2 inline void MixColumns(Planes x)
+	{
+		const __m256i rot1 = LaneMask(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+		const __m256i rot2 = LaneMask(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+		Planes r, t;
+		for(int b=0; b<8; b++)
+		{
+			r[b] = _mm256_shuffle_epi8(x[b], rot1);
+			t[b] = Xor256(x[b], r[b]);
+			x[b] = Xor256(r[b], _mm256_shuffle_epi8(t[b], rot2));
+		}
+		Xtime(t);
+		for(int b=0; b<8; b++)
+			x[b] = Xor256(x[b], t[b]);
+	}
+
+	//InvMixColumns = MixColumns o (b'[r] = b[r] ^ 4 (b[r] ^ b[r+2]))
+	RIJNDAEL_TARGET_AVX2 inline void InvMixColumns(Planes x)
+	{
+		const __m256i rot2 = LaneMask(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+		Planes u;
+		for(int b=0; b<8; b++)
+			u[b] = Xor256(x[b], _mm256_shuffle_epi8(x[b], rot2));
+		Xtime(u);
+		Xtime(u);
+		for(int b=0; b<8; b++)
+			x[b] = Xor256(x[b], u[b]);
+		MixColumns(x);
+	}
+
+	RIJNDAEL_TARGET_AVX2 void EncryptPlanes(unsigned char const* ks, int rounds, Planes x)
+	{
+		//Row offsets 0, 1, 3, 4
+		const __m256i same = LaneMask(0, 5, 14, -128, 4, 9, -128, -128, 8, 13, -128, -128, 12, -128, -128, -128);
+		const __m256i other = LaneMask(-128, -128, -128, 3, -128, -128, 2, 7, -128, -128, 6, 11, -128, 1, 10, 15);
+		AddRoundKey(x, ks);
+		for(int r=1; r<rounds; r++)
+		{
+			ks += 256;
+			SubBytes(x);
+			ShiftRows(x, same, other);
+			MixColumns(x);
+			AddRoundKey(x, ks);
+		}
+		//Last Round is Special
+		ks += 256;
+		SubBytes(x);
+		ShiftRows(x, same, other);
+		AddRoundKey(x, ks);
+	}
+
+	RIJNDAEL_TARGET_AVX2 void DecryptPlanes(unsigned char const* ks, int rounds, Planes x)
+	{
+		//Row offsets 0, 7, 5, 4
+		const __m256i same = LaneMask(0, -128, -128, -128, 4, 1, -128, -128, 8, 5, -128, -128, 12, 9, 2, -128);
+		const __m256i other = LaneMask(-128, 13, 6, 3, -128, -128, 10, 7, -128, -128, 14, 11, -128, -128, -128, 15);
+		AddRoundKey(x, ks);
+		for(int r=1; r<rounds; r++)
+		{
+			ks += 256;
+			InvSubBytes(x);
+			ShiftRows(x, same, other);
+			InvMixColumns(x);
+			AddRoundKey(x, ks);
+		}
+		//Last Round is Special
+		ks += 256;
+		InvSubBytes(x);
+		ShiftRows(x, same, other);
+		AddRoundKey(x, ks);
+	}
+
+}; // anonymous namespace
+
+bool CRijndael::HasAVX2()
+{
+	static const bool bAvailable = []() -> bool
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if(info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		//The operating system saves the YMM registers (OSXSAVE, XCR0)
+		if(!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		unsigned int ebx = static_cast<unsigned int>(info[1]);
+#else
+		unsigned int eax, ebx, ecx, edx;
+		if(__get_cpuid_max(0, 0) < 7 || !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return false;
+		//The operating system saves the YMM registers (OSXSAVE, XCR0)
+		if(!(ecx & (1u << 27)))
+			return false;
+		unsigned int xcr0, xcr0_hi;
+		__asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+		if((xcr0 & 6) != 6)
+			return false;
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+#endif
+		return (ebx & (1u << 5)) != 0;
+	}();
+	return bAvailable;
+}
+
+//Encrypt 256-bit blocks independently, eight at a time.
+// ks         - The encryption round keys as bit planes (m_KeSlices).
+// rounds     - The number of rounds.
+// blocks     - The number of blocks; in and result may be the same buffer.
+RIJNDAEL_TARGET_AVX2
+void CRijndael::AVX2EncryptBlocks256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks)
+{
+	while(blocks > 0)
+	{
+		const size_t count = (blocks < 8) ? blocks : 8;
+		Planes x;
+		LoadBlocks(in, count, x);
+		EncryptPlanes(ks, rounds, x);
+		Transpose(x);
+		for(size_t k=0; k<count; k++)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(result + 32*k), x[k]);
+		in += 32*count;
+		result += 32*count;
+		blocks -= count;
+	}
+}
+
+//Decrypt 256-bit blocks independently, eight at a time.
+// ks         - The decryption round keys as bit planes (m_KdSlices).
+// rounds     - The number of rounds.
+// blocks     - The number of blocks; in and result may be the same buffer.
+RIJNDAEL_TARGET_AVX2
+void CRijndael::AVX2DecryptBlocks256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks)
+{
+	while(blocks > 0)
+	{
+		const size_t count = (blocks < 8) ? blocks : 8;
+		Planes x;
+		LoadBlocks(in, count, x);
+		DecryptPlanes(ks, rounds, x);
+		Transpose(x);
+		for(size_t k=0; k<count; k++)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(result + 32*k), x[k]);
+		in += 32*count;
+		result += 32*count;
+		blocks -= count;
+	}
+}
+
+//Decrypt blocks in CBC mode, eight blocks at a time.
+// ks         - The decryption round keys as bit planes (m_KdSlices).
+// rounds     - The number of rounds.
+// blocks     - The number of 256-bit blocks.
+// chain      - The previous ciphertext block. On return, the last ciphertext block.
+RIJNDAEL_TARGET_AVX2
+void CRijndael::AVX2DecryptCBC256(unsigned char const* ks, int rounds, char const* in, char* result, size_t blocks, char* chain)
+{
+	__m256i iv = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(chain));
+	while(blocks > 0)
+	{
+		const size_t count = (blocks < 8) ? blocks : 8;
+		Planes x;
+		LoadBlocks(in, count, x);
+		DecryptPlanes(ks, rounds, x);
+		Transpose(x);
+		//Read the chaining ciphertext before result overwrites it
+		__m256i prev[8];
+		prev[0] = iv;
+		for(size_t k=1; k<count; k++)
+			prev[k] = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in + 32*(k-1)));
+		iv = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in + 32*(count-1)));
+		for(size_t k=0; k<count; k++)
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(result + 32*k), Xor256(x[k], prev[k]));
+		in += 32*count;
+		result += 32*count;
+		blocks -= count;
+	}
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(chain), iv);
+}
+
+//Encrypt up to eight independent streams in CBC mode, one stream per bit of each plane
+//byte. The streams may use different keys: their round keys are transposed into bit
+//planes like the blocks.
+// ks         - The encryption round keys of each stream (m_KeBytes).
+// rounds     - The number of rounds.
+// blocks     - The number of 256-bit blocks, the same for all streams.
+// chain      - The chain block of each stream, updated on return.
+// lanes      - The number of streams, 1 to 8.
+RIJNDAEL_TARGET_AVX2
+void CRijndael::AVX2EncryptCBC256Lanes(unsigned char const* const ks[], int rounds, char const* const in[],
+	char* const result[], char* const chain[], int lanes, size_t blocks)
+{
+	__m256i planes[(MAX_ROUNDS+1)*8];
+	for(int r=0; r<=rounds; r++)
+	{
+		__m256i* x = planes + 8*r;
+		for(int l=0; l<8; l++)
+			x[l] = (l < lanes) ? _mm256_loadu_si256(reinterpret_cast<__m256i const*>(ks[l] + 32*r)) : _mm256_setzero_si256();
+		Transpose(x);
+	}
+	Planes c;
+	for(int l=0; l<8; l++)
+		c[l] = (l < lanes) ? _mm256_loadu_si256(reinterpret_cast<__m256i const*>(chain[l])) : _mm256_setzero_si256();
+	for(size_t b=0; b<blocks; b++)
+	{
+		Planes x;
+		for(int l=0; l<8; l++)
+			x[l] = (l < lanes) ? Xor256(c[l], _mm256_loadu_si256(reinterpret_cast<__m256i const*>(in[l] + 32*b))) : c[l];
+		Transpose(x);
+		EncryptPlanes(reinterpret_cast<unsigned char const*>(planes), rounds, x);
+		Transpose(x);
+		for(int l=0; l<lanes; l++)
+		{
+			c[l] = x[l];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(result[l] + 32*b), x[l]);
+		}
+	}
+	for(int l=0; l<lanes; l++)
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(chain[l]), c[l]);
+}
+
+#else
+
+bool CRijndael::HasAVX2()
+{
+	return false;
+}
+
+#endif // RIJNDAEL_AVX2
@@ -227,21 +227,6 @@ namespace {
         }
     };
         
-    unsigned long GCD(unsigned long larger, unsigned long smaller)
-    {
-        unsigned long gcd = smaller;
-        unsigned long gcd_prev = larger;
-        unsigned long gcd_next;
-        
-        while ((gcd_next = gcd_prev % gcd) != 0)
-        {
-            gcd_prev = gcd;
-            gcd = gcd_next;
-        }
-        
-        return gcd;
-    }
-    
     size_t PKCS5PaddingLength(const std::string& data) {
         if (data.empty()) return 0;
         char length = data[data.size() - 1];
@@ -274,29 +259,17 @@ void Blowfish::SetKey(const char* key, size_t byte_length)
     static const int pary_length = sizeof(pary_) / sizeof(uint32_t);
     static const int sbox_length = sizeof(sbox_) / sizeof(uint32_t);
     
+    // Key words are read straight from the cyclic key, no buffer needed
+    for (int i = 0; i < pary_length; ++i)
     {
-        unsigned long buffer_length = byte_length / GCD(byte_length, sizeof(uint32_t));
-        uint32_t *key_buffer = new uint32_t[buffer_length];
+        Converter32 converter;
         
-        for (unsigned long i = 0; i < buffer_length; ++i)
-        {
-            Converter32 converter;
-            
-            converter.bit_8.byte0 = key[(i * 4) % byte_length];
-            converter.bit_8.byte1 = key[(i * 4 + 1) % byte_length];
-            converter.bit_8.byte2 = key[(i * 4 + 2) % byte_length];
-            converter.bit_8.byte3 = key[(i * 4 + 3) % byte_length];
-            
-            key_buffer[i] = converter.bit_32;
-        }
-        
-        for (int i = 0; i < pary_length; ++i)
-        {
-            uint32_t key_uint32 = key_buffer[i % buffer_length];
-            pary_[i] ^= key_uint32;
-        }
+        converter.bit_8.byte0 = key[(i * 4) % byte_length];
+        converter.bit_8.byte1 = key[(i * 4 + 1) % byte_length];
+        converter.bit_8.byte2 = key[(i * 4 + 2) % byte_length];
+        converter.bit_8.byte3 = key[(i * 4 + 3) % byte_length];
         
-        delete[] key_buffer;
+        pary_[i] ^= converter.bit_32;
     }
     
     uint32_t left  = 0x00000000;
@@ -366,7 +339,15 @@ void Blowfish::Decrypt(char* dst, const char* src, size_t byte_length) const
         memcpy(dst, src, byte_length);
     }
     
-    for (int i = 0; i < byte_length / sizeof(uint64_t); ++i)
+    // ECB blocks are independent: four at a time, the rounds interleaved
+    const size_t blocks = byte_length / sizeof(uint64_t);
+    size_t i = 0;
+    for (; i + 4 <= blocks; i += 4)
+    {
+        DecryptBlocks4(&reinterpret_cast<uint32_t*>(dst)[i * 2]);
+    }
+    
+    for (; i < blocks; ++i)
     {
         uint32_t* left  = &reinterpret_cast<uint32_t*>(dst)[i * 2];
         uint32_t* right = &reinterpret_cast<uint32_t*>(dst)[i * 2 + 1];
@@ -404,15 +385,35 @@ void Blowfish::DecryptBlock(uint32_t *left, uint32_t *right) const
     *left  ^= pary_[0];
 }
 
-uint32_t Blowfish::Feistel(uint32_t value) const
+// Four blocks of (left, right) pairs, in place
+void Blowfish::DecryptBlocks4(uint32_t *data) const
 {
-    Converter32 converter;
-    converter.bit_32 = value;
+    uint32_t l0 = data[0], r0 = data[1];
+    uint32_t l1 = data[2], r1 = data[3];
+    uint32_t l2 = data[4], r2 = data[5];
+    uint32_t l3 = data[6], r3 = data[7];
     
-    uint8_t a = converter.bit_8.byte0;
-    uint8_t b = converter.bit_8.byte1;
-    uint8_t c = converter.bit_8.byte2;
-    uint8_t d = converter.bit_8.byte3;
+    for (int i = 0; i < 16; i += 2)
+    {
+        const uint32_t p0 = pary_[17 - i];
+        const uint32_t p1 = pary_[16 - i];
+        
+        // Two rounds without the swaps
+        l0 ^= p0; l1 ^= p0; l2 ^= p0; l3 ^= p0;
+        r0 ^= Feistel(l0); r1 ^= Feistel(l1); r2 ^= Feistel(l2); r3 ^= Feistel(l3);
+        r0 ^= p1; r1 ^= p1; r2 ^= p1; r3 ^= p1;
+        l0 ^= Feistel(r0); l1 ^= Feistel(r1); l2 ^= Feistel(r2); l3 ^= Feistel(r3);
+    }
     
-    return ((sbox_[0][a] + sbox_[1][b]) ^ sbox_[2][c]) + sbox_[3][d];
+    data[0] = r0 ^ pary_[0]; data[1] = l0 ^ pary_[1];
+    data[2] = r1 ^ pary_[0]; data[3] = l1 ^ pary_[1];
+    data[4] = r2 ^ pary_[0]; data[5] = l2 ^ pary_[1];
+    data[6] = r3 ^ pary_[0]; data[7] = l3 ^ pary_[1];
+}
+
+uint32_t Blowfish::Feistel(uint32_t value) const
+{
+    // The most significant byte indexes the first S-box
+    return ((sbox_[0][value >> 24] + sbox_[1][(value >> 16) & 0xFF]) ^
+        sbox_[2][(value >> 8) & 0xFF]) + sbox_[3][value & 0xFF];
 }
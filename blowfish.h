@@ -32,6 +32,7 @@ public:
 private:
     void EncryptBlock(uint32_t *left, uint32_t *right) const;
     void DecryptBlock(uint32_t *left, uint32_t *right) const;
+    void DecryptBlocks4(uint32_t *data) const;
     uint32_t Feistel(uint32_t value) const;
     
 private:
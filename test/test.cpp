@@ -28,9 +28,26 @@ freely, subject to the following restrictions:
 #include <sstream>
 #include <ctime>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+
+#include <zlib.h>
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "../ATCUnlocker.h"
 #include "../ATCLocker.h"
+#include "../ATCBatch.h"
+#include "../ATCDirectory.h"
+#include "../RijndaelFixed.h"
+#include "../blowfish.h"
 
 extern "C"
 {
@@ -87,6 +104,31 @@ bool Decryption_For_v2_8_2_5();
 bool Decryption_For_v2_8_2_5_Executable();
 bool Decryption_For_v2_8_2_7_Destructed();
 bool Decryption_For_Unencrypted_File();
+bool Rijndael_Hardware_Kernel();
+bool Rijndael_CBC_Decryption();
+bool Rijndael_Fixed_Geometry();
+bool Rijndael_Bitsliced_Kernel();
+bool Rijndael_CBC_Lanes();
+bool Multi_Buffer_Encryption();
+bool Parallel_Decryption();
+bool Blowfish_Bulk_Decryption();
+bool Legacy_Key_Sharing();
+bool Shared_Key_Object();
+bool Chunked_Encryption();
+bool Parallel_Compression();
+bool Adaptive_Compression();
+bool Stored_Compression();
+bool Streaming_Extraction();
+bool Extraction_To_Sink_And_Buffer();
+bool Skip_Entries();
+bool Checkpoint_Index();
+bool Reused_Streams();
+bool Buffer_Lock_And_Unlock();
+bool Pipelined_Compression();
+bool Read_Ahead_Extraction();
+bool Batch_Lock_And_Unlock();
+bool Directory_Lock();
+bool Directory_Extraction();
 
 int main()
 {
@@ -109,6 +151,31 @@ int main()
 	TEST(Decryption_For_v2_8_2_5_Executable);
 	TEST(Decryption_For_v2_8_2_7_Destructed);
 	TEST(Decryption_For_Unencrypted_File);
+	TEST(Rijndael_Hardware_Kernel);
+	TEST(Rijndael_CBC_Decryption);
+	TEST(Rijndael_Fixed_Geometry);
+	TEST(Rijndael_Bitsliced_Kernel);
+	TEST(Rijndael_CBC_Lanes);
+	TEST(Multi_Buffer_Encryption);
+	TEST(Parallel_Decryption);
+	TEST(Blowfish_Bulk_Decryption);
+	TEST(Legacy_Key_Sharing);
+	TEST(Shared_Key_Object);
+	TEST(Chunked_Encryption);
+	TEST(Parallel_Compression);
+	TEST(Adaptive_Compression);
+	TEST(Stored_Compression);
+	TEST(Streaming_Extraction);
+	TEST(Extraction_To_Sink_And_Buffer);
+	TEST(Skip_Entries);
+	TEST(Checkpoint_Index);
+	TEST(Reused_Streams);
+	TEST(Buffer_Lock_And_Unlock);
+	TEST(Pipelined_Compression);
+	TEST(Read_Ahead_Extraction);
+	TEST(Batch_Lock_And_Unlock);
+	TEST(Directory_Lock);
+	TEST(Directory_Extraction);
 
 	cout << "---------------------" << endl;
 	cout << "Result: " << succeeded << "/" << total << endl;
@@ -336,5 +403,2030 @@ bool Decryption_For_Unencrypted_File()
 	return Unencrypted_File_Test("cosmos.jpg");
 }
 
+bool Rijndael_Hardware_Kernel()
+{
+	CRijndael hardware, software;
+
+	for (int n = 0; n < 64; ++n)
+	{
+		char key[ATC_KEY_SIZE];
+		char plain[ATC_BUF_SIZE];
+
+		for (int i = 0; i < ATC_KEY_SIZE; ++i) key[i] = static_cast<char>(rand());
+		for (int i = 0; i < ATC_BUF_SIZE; ++i) plain[i] = static_cast<char>(rand());
+
+		hardware.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		software.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		software.SetHardwareAcceleration(false);
+		ASSERT(!software.IsHardwareAccelerated());
+
+		char hardware_out[ATC_BUF_SIZE], software_out[ATC_BUF_SIZE];
+
+		hardware.EncryptBlock(plain, hardware_out);
+		software.EncryptBlock(plain, software_out);
+		ASSERT(memcmp(hardware_out, software_out, ATC_BUF_SIZE) == 0);
+
+		hardware.DecryptBlock(hardware_out, hardware_out);
+		software.DecryptBlock(software_out, software_out);
+		ASSERT(memcmp(hardware_out, plain, ATC_BUF_SIZE) == 0);
+		ASSERT(memcmp(software_out, plain, ATC_BUF_SIZE) == 0);
+	}
+
+	return true;
+}
+
+bool Rijndael_CBC_Decryption()
+{
+	static const int blocks = 11;
+
+	char key[ATC_KEY_SIZE];
+	char iv[ATC_BUF_SIZE];
+	char plain[ATC_BUF_SIZE * blocks];
+	char cipher[ATC_BUF_SIZE * blocks];
+
+	for (int i = 0; i < ATC_KEY_SIZE; ++i) key[i] = static_cast<char>(rand());
+	for (int i = 0; i < ATC_BUF_SIZE; ++i) iv[i] = static_cast<char>(rand());
+	for (int i = 0; i < ATC_BUF_SIZE * blocks; ++i) plain[i] = static_cast<char>(rand());
+
+	CRijndael encryptor;
+	encryptor.MakeKey(key, iv, ATC_KEY_SIZE, ATC_BUF_SIZE);
+	encryptor.Encrypt(plain, cipher, sizeof(cipher), CRijndael::CBC);
+
+	for (int hardware = 0; hardware < 2; ++hardware)
+	{
+		CRijndael decryptor;
+		decryptor.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		decryptor.SetHardwareAcceleration(hardware != 0);
+
+		// Split into calls of 5 and 6 blocks, in place
+		char buffer[ATC_BUF_SIZE * blocks];
+		char chain[ATC_BUF_SIZE];
+		memcpy(buffer, cipher, sizeof(buffer));
+		memcpy(chain, iv, sizeof(chain));
+
+		decryptor.DecryptCBC(buffer, buffer, ATC_BUF_SIZE * 5, chain);
+		ASSERT(memcmp(chain, cipher + ATC_BUF_SIZE * 4, ATC_BUF_SIZE) == 0);
+		decryptor.DecryptCBC(buffer + ATC_BUF_SIZE * 5, buffer + ATC_BUF_SIZE * 5, ATC_BUF_SIZE * 6, chain);
+
+		ASSERT(memcmp(buffer, plain, sizeof(plain)) == 0);
+		ASSERT(memcmp(chain, cipher + ATC_BUF_SIZE * (blocks - 1), ATC_BUF_SIZE) == 0);
+	}
+
+	return true;
+}
+
+template <int KEY_SIZE, int BLOCK_SIZE>
+bool Rijndael_Fixed_Test(int kernel)
+{
+	static const int blocks = 9;
+
+	char key[KEY_SIZE];
+	char iv[BLOCK_SIZE];
+	char plain[BLOCK_SIZE * blocks];
+	char expected[BLOCK_SIZE * blocks];
+
+	for (int i = 0; i < KEY_SIZE; ++i) key[i] = static_cast<char>(rand());
+	for (int i = 0; i < BLOCK_SIZE; ++i) iv[i] = static_cast<char>(rand());
+	for (int i = 0; i < BLOCK_SIZE * blocks; ++i) plain[i] = static_cast<char>(rand());
+
+	CRijndael reference;
+	reference.MakeKey(key, iv, KEY_SIZE, BLOCK_SIZE);
+	reference.Encrypt(plain, expected, sizeof(expected), CRijndael::CBC);
+
+	CRijndaelFixed<KEY_SIZE, BLOCK_SIZE> fixed;
+	fixed.SetKernel(kernel);
+	fixed.MakeKey(key);
+
+	char block[BLOCK_SIZE];
+	reference.EncryptBlock(plain, block);
+	fixed.DecryptBlock(block, block);
+	ASSERT(memcmp(block, plain, BLOCK_SIZE) == 0);
+	fixed.EncryptBlock(plain, block);
+	reference.DecryptBlock(block, block);
+	ASSERT(memcmp(block, plain, BLOCK_SIZE) == 0);
+
+	char buffer[BLOCK_SIZE * blocks];
+	char chain[BLOCK_SIZE];
+	memcpy(chain, iv, sizeof(chain));
+	fixed.EncryptCBC(plain, buffer, sizeof(buffer), chain);
+	ASSERT(memcmp(buffer, expected, sizeof(buffer)) == 0);
+	ASSERT(memcmp(chain, expected + BLOCK_SIZE * (blocks - 1), BLOCK_SIZE) == 0);
+
+	memcpy(chain, iv, sizeof(chain));
+	fixed.DecryptCBC(buffer, buffer, sizeof(buffer), chain);
+	ASSERT(memcmp(buffer, plain, sizeof(buffer)) == 0);
+
+	// 片方向だけのキー
+	CRijndaelFixed<KEY_SIZE, BLOCK_SIZE> encryptor, decryptor;
+	encryptor.SetKernel(kernel);
+	encryptor.MakeKey(key, CRijndaelFixed<KEY_SIZE, BLOCK_SIZE>::ENCRYPTION);
+	decryptor.SetKernel(kernel);
+	decryptor.MakeKey(key, CRijndaelFixed<KEY_SIZE, BLOCK_SIZE>::DECRYPTION);
+
+	memcpy(chain, iv, sizeof(chain));
+	encryptor.EncryptCBC(plain, buffer, sizeof(buffer), chain);
+	ASSERT(memcmp(buffer, expected, sizeof(buffer)) == 0);
+
+	memcpy(chain, iv, sizeof(chain));
+	decryptor.DecryptCBC(buffer, buffer, sizeof(buffer), chain);
+	ASSERT(memcmp(buffer, plain, sizeof(buffer)) == 0);
+
+	return true;
+}
+
+bool Rijndael_Fixed_Geometry()
+{
+	const int kernels[] = { CRijndael::TABLE, CRijndael::AESNI, CRijndael::BITSLICE };
+
+	for (int i = 0; i < 3; ++i)
+	{
+		ASSERT((Rijndael_Fixed_Test<32, 32>(kernels[i])));
+		ASSERT((Rijndael_Fixed_Test<16, 16>(kernels[i])));
+		ASSERT((Rijndael_Fixed_Test<24, 32>(kernels[i])));
+		ASSERT((Rijndael_Fixed_Test<32, 24>(kernels[i])));
+	}
+
+	return true;
+}
+
+bool Rijndael_Bitsliced_Kernel()
+{
+	// 8 + 8 + 3 blocks
+	static const int blocks = 19;
+
+	CRijndael bitsliced, table;
+	bitsliced.SetKernel(CRijndael::BITSLICE);
+	table.SetHardwareAcceleration(false);
+
+	for (int n = 0; n < 16; ++n)
+	{
+		char key[ATC_KEY_SIZE];
+		char iv[ATC_BUF_SIZE];
+		char plain[ATC_BUF_SIZE * blocks];
+
+		for (int i = 0; i < ATC_KEY_SIZE; ++i) key[i] = static_cast<char>(rand());
+		for (int i = 0; i < ATC_BUF_SIZE; ++i) iv[i] = static_cast<char>(rand());
+		for (int i = 0; i < ATC_BUF_SIZE * blocks; ++i) plain[i] = static_cast<char>(rand());
+
+		bitsliced.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		table.MakeKey(key, CRijndael::sm_chain0, ATC_KEY_SIZE, ATC_BUF_SIZE);
+		if (bitsliced.GetKernel() != CRijndael::BITSLICE)
+		{
+			// No AVX2 on this processor
+			return true;
+		}
+
+		char bitsliced_out[ATC_BUF_SIZE], table_out[ATC_BUF_SIZE];
+
+		bitsliced.EncryptBlock(plain, bitsliced_out);
+		table.EncryptBlock(plain, table_out);
+		ASSERT(memcmp(bitsliced_out, table_out, ATC_BUF_SIZE) == 0);
+
+		bitsliced.DecryptBlock(bitsliced_out, bitsliced_out);
+		ASSERT(memcmp(bitsliced_out, plain, ATC_BUF_SIZE) == 0);
+
+		char cipher[ATC_BUF_SIZE * blocks];
+		char chain[ATC_BUF_SIZE];
+		memcpy(chain, iv, sizeof(chain));
+		for (int k = 0; k < blocks; ++k)
+		{
+			for (int i = 0; i < ATC_BUF_SIZE; ++i) chain[i] ^= plain[ATC_BUF_SIZE * k + i];
+			table.EncryptBlock(chain, chain);
+			memcpy(cipher + ATC_BUF_SIZE * k, chain, ATC_BUF_SIZE);
+		}
+
+		memcpy(chain, iv, sizeof(chain));
+		bitsliced.DecryptCBC(cipher, cipher, sizeof(cipher), chain);
+		ASSERT(memcmp(cipher, plain, sizeof(plain)) == 0);
+	}
+
+	return true;
+}
+
+bool Rijndael_CBC_Lanes()
+{
+	// More streams than lanes, of different lengths
+	static const int lanes = 11;
+	static const int max_blocks = 13;
+
+	const int kernels[] = { CRijndael::TABLE, CRijndael::AESNI, CRijndael::BITSLICE };
+
+	for (int k = 0; k < 3; ++k)
+	{
+		CRijndael256 engines[lanes];
+		const CRijndael256 *pengines[lanes];
+		char plain[lanes][ATC_BUF_SIZE * max_blocks];
+		char cipher[lanes][ATC_BUF_SIZE * max_blocks];
+		char iv[lanes][ATC_BUF_SIZE];
+		char chains[lanes][ATC_BUF_SIZE];
+		const char *pin[lanes];
+		char *presult[lanes], *pchains[lanes];
+		size_t n[lanes];
+
+		for (int l = 0; l < lanes; ++l)
+		{
+			char key[ATC_KEY_SIZE];
+			for (int i = 0; i < ATC_KEY_SIZE; ++i) key[i] = static_cast<char>(rand());
+			for (int i = 0; i < ATC_BUF_SIZE; ++i) iv[l][i] = chains[l][i] = static_cast<char>(rand());
+			for (int i = 0; i < ATC_BUF_SIZE * max_blocks; ++i) plain[l][i] = static_cast<char>(rand());
+
+			engines[l].SetKernel(kernels[k]);
+			engines[l].MakeKey(key);
+			pengines[l] = &engines[l];
+			pin[l] = plain[l];
+			presult[l] = cipher[l];
+			pchains[l] = chains[l];
+			n[l] = ATC_BUF_SIZE * ((l * 5) % max_blocks);
+		}
+
+		CRijndael256::EncryptCBCLanes(pengines, pin, presult, pchains, n, lanes);
+
+		for (int l = 0; l < lanes; ++l)
+		{
+			char expected[ATC_BUF_SIZE * max_blocks];
+			engines[l].EncryptCBC(plain[l], expected, n[l], iv[l]);
+			ASSERT(memcmp(cipher[l], expected, n[l]) == 0);
+			ASSERT(memcmp(chains[l], iv[l], ATC_BUF_SIZE) == 0);
+		}
+	}
+
+	return true;
+}
+
+bool Multi_Buffer_Encryption()
+{
+	static const int archives = 6;
+
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// Empty, short, compressible and incompressible entries, over several chunks
+	string data[archives][2];
+	for (int a = 0; a < archives; ++a)
+	{
+		for (int e = 0; e < 2; ++e)
+		{
+			const size_t length = (a * 2 + e) * 23456 % 150001;
+			for (size_t i = 0; i < length; ++i)
+			{
+				data[a][e] += (a % 2) ? static_cast<char>(rand()) : static_cast<char>('a' + i % 7);
+			}
+		}
+	}
+
+	ATCLocker lockers[archives];
+	stringstream archive_data[archives];
+	ATCLocker *plockers[archives];
+	ostream *dsts[archives];
+
+	for (int a = 0; a < archives; ++a)
+	{
+		plockers[a] = &lockers[a];
+		dsts[a] = &archive_data[a];
+
+		ASSERT(lockers[a].open(&archive_data[a], key) == ATC_OK);
+		for (int e = 0; e < 2; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data[a][e].size();
+				entry.name_sjis = e ? "test2.txt" : "test.txt";
+				entry.name_utf8 = e ? "test2.txt" : "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				ASSERT(lockers[a].addFileEntry(entry) == ATC_OK);
+		}
+		ASSERT(lockers[a].writeEncryptedHeader(&archive_data[a]) == ATC_OK);
+	}
+
+	for (int e = 0; e < 2; ++e)
+	{
+		stringstream sources[archives];
+		istream *srcs[archives];
+		size_t lengths[archives];
+		for (int a = 0; a < archives; ++a)
+		{
+			sources[a].str(data[a][e]);
+			srcs[a] = &sources[a];
+			lengths[a] = data[a][e].size();
+		}
+		ASSERT(ATCLocker::writeFileDataMulti(plockers, dsts, srcs, lengths, archives) == ATC_OK);
+	}
+
+	for (int a = 0; a < archives; ++a)
+	{
+		ASSERT(lockers[a].close() == ATC_OK);
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive_data[a], key) == ATC_OK);
+		ASSERT(unlocker.getEntryLength() == 2);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			ATCFileEntry entry;
+			ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &archive_data[a], entry.size) == ATC_OK);
+			ASSERT(out.str() == data[a][e]);
+		}
+	}
+
+	return true;
+}
+
+bool Parallel_Decryption()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// Incompressible, so that the archive spans several slabs of ranges
+	string data(ATC_PARALLEL_RANGE_SIZE * 7 + 12345, '\0');
+	for (size_t i = 0; i < data.size(); ++i)
+	{
+		data[i] = static_cast<char>(rand());
+	}
+
+	stringstream archive;
+
+	{
+		ATCLocker locker;
+		ASSERT(locker.open(&archive, key) == ATC_OK);
+
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data.size();
+			entry.name_sjis = "test.bin";
+			entry.name_utf8 = "test.bin";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+
+		ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+		stringstream src(data);
+		ASSERT(locker.writeFileData(&archive, &src, data.size()) == ATC_OK);
+		ASSERT(locker.close() == ATC_OK);
+	}
+
+	const int thread_counts[] = { 1, 2, 3, 0 };
+
+	for (int t = 0; t < 4; ++t)
+	{
+		ATCUnlocker unlocker;
+		unlocker.set_thread_count(thread_counts[t]);
+		ASSERT(unlocker.thread_count() >= 1);
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		ATCFileEntry entry;
+		ASSERT(unlocker.getEntry(&entry, 0) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+		ASSERT(out.str() == data);
+		ASSERT(unlocker.close() == ATC_OK);
+	}
+
+	return true;
+}
+
+bool Blowfish_Bulk_Decryption()
+{
+	Blowfish blowfish;
+	blowfish.SetKey("This is a pen.");
+
+	// 4 ブロックずつの経路と 1 ブロックずつの経路の両方を通る長さ
+	const size_t length = 8 * 37;
+	char plain[length], encrypted[length], bulk[length], single[length];
+	for (size_t i = 0; i < length; ++i)
+	{
+		plain[i] = static_cast<char>(rand());
+	}
+
+	blowfish.Encrypt(encrypted, plain, length);
+	blowfish.Decrypt(bulk, encrypted, length);
+	ASSERT(memcmp(bulk, plain, length) == 0);
+
+	for (size_t i = 0; i < length; i += 8)
+	{
+		blowfish.Decrypt(single + i, encrypted + i, 8);
+	}
+	ASSERT(memcmp(single, plain, length) == 0);
+
+	// v1.x の書庫も複数スレッド設定で復号できる
+	char key[ATC_KEY_SIZE] = "cosmos";
+	ifstream ifs(test_path + "cosmos_v1.46.atc.tester", ifstream::binary);
+	ASSERT(ifs);
+
+	ATCUnlocker unlocker;
+	unlocker.set_thread_count(2);
+	ASSERT(unlocker.open(&ifs, key) == ATC_OK);
+
+	ATCFileEntry entry;
+	ASSERT(unlocker.getEntry(&entry, 0) == ATC_OK);
+
+	stringstream out;
+	ASSERT(unlocker.extractFileData(&out, &ifs, entry.size) == ATC_OK);
+	ASSERT(out.str().size() == entry.size);
+
+	// 元の画像と同じ CRC になる
+	ifstream jpg(test_path + "cosmos.jpg", ifstream::binary);
+	ASSERT(jpg);
+	stringstream original;
+	original << jpg.rdbuf();
+
+	crcInit();
+	ASSERT(crcFast(reinterpret_cast<const unsigned char*>(out.str().data()), out.str().size()) ==
+		crcFast(reinterpret_cast<const unsigned char*>(original.str().data()), original.str().size()));
+
+	return true;
+}
+
+bool Legacy_Key_Sharing()
+{
+	char key[ATC_KEY_SIZE] = "cosmos";
+
+	const ATCLegacyKey legacy_key = ATCLegacyKey::cached(key);
+	ASSERT(!legacy_key.empty());
+	ASSERT(!ATCLegacyKey::cached(key).empty());
+	ASSERT(ATCLegacyKey().empty());
+
+	// 展開済みのキーと文字列のキーで同じ結果になる
+	const char *filenames[] = {
+		"cosmos_v1.46.atc.tester",
+		"cosmos_v1.46.exe.tester",
+		"cosmos_v2.8.2.5.atc.tester"
+	};
+
+	// どの書庫も元の画像と同じ CRC になる
+	ifstream jpg(test_path + "cosmos.jpg", ifstream::binary);
+	ASSERT(jpg);
+	stringstream original;
+	original << jpg.rdbuf();
+
+	crcInit();
+	const unsigned short test_crc =
+		crcFast(reinterpret_cast<const unsigned char*>(original.str().data()), original.str().size());
+
+	for (int f = 0; f < 3; ++f)
+	{
+		string extracted[2];
+
+		for (int k = 0; k < 2; ++k)
+		{
+			ifstream ifs(test_path + filenames[f], ifstream::binary);
+			ASSERT(ifs);
+
+			ATCUnlocker unlocker;
+			if (k == 0)
+			{
+				ASSERT(unlocker.open(&ifs, legacy_key) == ATC_OK);
+			}
+			else
+			{
+				ASSERT(unlocker.open(&ifs, key) == ATC_OK);
+			}
+
+			ATCFileEntry entry;
+			ASSERT(unlocker.getEntry(&entry, 0) == ATC_OK);
+
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &ifs, entry.size) == ATC_OK);
+			extracted[k] = out.str();
+		}
+
+		ASSERT(crcFast(reinterpret_cast<const unsigned char*>(extracted[0].data()), extracted[0].size()) == test_crc);
+		ASSERT(extracted[0] == extracted[1]);
+	}
+
+	ATCLegacyKey::clearCache();
+
+	return true;
+}
+
+bool Shared_Key_Object()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	const ATCKey encryption_key(key, ATC_KEY_ENCRYPTION);
+	const ATCKey decryption_key(key, ATC_KEY_DECRYPTION);
+	ASSERT(!encryption_key.empty());
+	ASSERT(ATCKey().empty());
+
+	// 一つのキーで複数の書庫を作って開く
+	for (int a = 0; a < 3; ++a)
+	{
+		const string data(1000 * (a + 1), static_cast<char>('a' + a));
+		stringstream archive;
+
+		ATCLocker locker;
+		ASSERT(locker.open(&archive, decryption_key) == ATC_ERR_WRONG_KEY_USAGE);
+		ASSERT(locker.open(&archive, encryption_key) == ATC_OK);
+
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data.size();
+			entry.name_sjis = "test.txt";
+			entry.name_utf8 = "test.txt";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+
+		ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+		stringstream src(data);
+		ASSERT(locker.writeFileData(&archive, &src, data.size()) == ATC_OK);
+		ASSERT(locker.close() == ATC_OK);
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive, encryption_key) == ATC_ERR_WRONG_KEY_USAGE);
+		ASSERT(unlocker.open(&archive, decryption_key) == ATC_OK);
+		ASSERT(unlocker.getEntry(&entry, 0) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+		ASSERT(out.str() == data);
+	}
+
+	// v1.x の書庫はキーの文字列から開く
+	char cosmos[ATC_KEY_SIZE] = "cosmos";
+	const ATCKey cosmos_key(cosmos, ATC_KEY_DECRYPTION);
+
+	const char *filenames[] = {
+		"cosmos_v1.46.atc.tester",
+		"cosmos_v2.8.2.5.atc.tester"
+	};
+
+	ifstream jpg(test_path + "cosmos.jpg", ifstream::binary);
+	ASSERT(jpg);
+	stringstream original;
+	original << jpg.rdbuf();
+
+	crcInit();
+	const unsigned short test_crc =
+		crcFast(reinterpret_cast<const unsigned char*>(original.str().data()), original.str().size());
+
+	for (int f = 0; f < 2; ++f)
+	{
+		ifstream ifs(test_path + filenames[f], ifstream::binary);
+		ASSERT(ifs);
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&ifs, cosmos_key) == ATC_OK);
+
+		ATCFileEntry entry;
+		ASSERT(unlocker.getEntry(&entry, 0) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &ifs, entry.size) == ATC_OK);
+		ASSERT(crcFast(reinterpret_cast<const unsigned char*>(out.str().data()), out.str().size()) == test_crc);
+	}
+
+	return true;
+}
+
+bool Chunked_Encryption()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	string data[2];
+	for (size_t i = 0; i < 300000; ++i)
+	{
+		data[0] += static_cast<char>('a' + (i * 7 + i / 13) % 26);
+	}
+	for (size_t i = 0; i < 100000; ++i)
+	{
+		data[1] += static_cast<char>(rand());
+	}
+
+	// チャンクの大きさが違っても同じ長さの書庫になり、復号すると同じ CRC になる
+	// IV は毎回変わるので書庫そのものは比べられない
+	const size_t chunk_sizes[] = { ATC_BUF_SIZE, 1000, ATC_LOCK_CHUNK_SIZE };
+	size_t archive_size = 0;
+	unsigned short test_crc[2];
+
+	crcInit();
+	for (int e = 0; e < 2; ++e)
+	{
+		test_crc[e] = crcFast(reinterpret_cast<const unsigned char*>(data[e].data()), data[e].size());
+	}
+
+	for (int c = 0; c < 3; ++c)
+	{
+		stringstream archive;
+
+		ATCLocker locker;
+		locker.set_chunk_size(chunk_sizes[c]);
+		ASSERT(locker.chunk_size() % ATC_BUF_SIZE == 0);
+		ASSERT(locker.chunk_size() >= chunk_sizes[c]);
+		ASSERT(locker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data[e].size();
+				entry.name_sjis = "test.txt";
+				entry.name_utf8 = "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				ASSERT(locker.addFileEntry(entry) == ATC_OK);
+		}
+
+		ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			stringstream src(data[e]);
+			ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+		}
+		ASSERT(locker.close() == ATC_OK);
+
+		if (c == 0)
+		{
+			archive_size = archive.str().size();
+		}
+		ASSERT(archive.str().size() == archive_size);
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			ATCFileEntry entry;
+			ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+			ASSERT(crcFast(reinterpret_cast<const unsigned char*>(out.str().data()), out.str().size()) == test_crc[e]);
+			ASSERT(out.str() == data[e]);
+		}
+	}
+
+	return true;
+}
+
+bool Parallel_Compression()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// ブロックの境界をまたぐ長さ。最後はサイズ 0 のエントリ
+	string data[4];
+	for (size_t i = 0; i < ATC_DEFLATE_BLOCK_SIZE * 5 + 777; ++i)
+	{
+		data[0] += static_cast<char>('a' + (i * 7 + i / 13) % 26);
+	}
+	for (size_t i = 0; i < ATC_DEFLATE_BLOCK_SIZE + 100; ++i)
+	{
+		data[1] += static_cast<char>(rand());
+	}
+	data[2] = "small";
+
+	const int levels[] = { 0, 1, -1, 9 };
+
+	for (int l = 0; l < 4; ++l)
+	{
+		stringstream archive;
+
+		ATCLocker locker;
+		locker.set_thread_count(3);
+		locker.set_compression_level(levels[l]);
+		ASSERT(locker.thread_count() == 3);
+		ASSERT(locker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 4; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data[e].size();
+				entry.name_sjis = "test.txt";
+				entry.name_utf8 = "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				ASSERT(locker.addFileEntry(entry) == ATC_OK);
+		}
+
+		ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			stringstream src(data[e]);
+			ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+		}
+
+		// ストリームはもう閉じているので、一バイトも書き足さない
+		const string written = archive.str();
+		stringstream empty;
+		ASSERT(locker.writeFileData(&archive, &empty, 0) == ATC_OK);
+		ASSERT(archive.str() == written);
+		ASSERT(locker.close() == ATC_OK);
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 4; ++e)
+		{
+			ATCFileEntry entry;
+			ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+			ASSERT(out.str() == data[e]);
+		}
+	}
+
+	return true;
+}
+
+bool Adaptive_Compression()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// テキスト、JPEG、テキスト、同じバイトの連続、0 に近い値、偏った乱数
+	string data[6];
+	for (size_t i = 0; i < 100000; ++i)
+	{
+		data[0] += static_cast<char>('a' + (i * 7 + i / 13) % 26);
+	}
+	{
+		ifstream ifs(test_path + "cosmos.jpg", ifstream::binary);
+		stringstream buffer;
+		buffer << ifs.rdbuf();
+		data[1] = buffer.str();
+	}
+	data[2] = data[0].substr(0, 5000);
+	for (size_t i = 0; i < 100000; ++i)
+	{
+		data[3] += static_cast<char>(i / 64 % 4);
+		data[4] += static_cast<char>(rand() % 9 - 4);
+		data[5] += static_cast<char>(rand() % 160);
+	}
+
+	stringstream archive;
+
+	ATCLocker locker;
+	locker.set_compression_level(9);
+	locker.set_adaptive_compression(true);
+	ASSERT(locker.adaptive_compression());
+	ASSERT(locker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 6; ++e)
+	{
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data[e].size();
+			entry.name_sjis = "test.txt";
+			entry.name_utf8 = "test.txt";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+	}
+
+	ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+	for (int e = 0; e < 6; ++e)
+	{
+		stringstream src(data[e]);
+		ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+	}
+	ASSERT(locker.close() == ATC_OK);
+
+	const vector<ATCCompressionDecision>& decisions = locker.compression_decisions();
+	ASSERT(decisions.size() == 6);
+	ASSERT(decisions[0].level == 9 && decisions[0].strategy == Z_DEFAULT_STRATEGY);
+	ASSERT(decisions[1].level == 0);
+	ASSERT(decisions[2].level == 9 && decisions[2].strategy == Z_DEFAULT_STRATEGY);
+	ASSERT(decisions[3].level == 9 && decisions[3].strategy == Z_RLE);
+	ASSERT(decisions[4].level == 9 && decisions[4].strategy == Z_FILTERED);
+	ASSERT(decisions[5].level == 1 && decisions[5].strategy == Z_HUFFMAN_ONLY);
+	ASSERT(decisions[1].size == static_cast<int64_t>(data[1].size()));
+
+	ATCUnlocker unlocker;
+	ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 6; ++e)
+	{
+		ATCFileEntry entry;
+		ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+		ASSERT(out.str() == data[e]);
+	}
+
+	return true;
+}
+
+bool Stored_Compression()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// 空、小さい、stored ブロックとチャンクをまたぐエントリ、末尾に空のエントリ
+	string data[4];
+	data[1] = "stored";
+	for (size_t i = 0; i < 200000; ++i)
+	{
+		data[2] += static_cast<char>(i * 31 + i / 251);
+	}
+
+	stringstream archive;
+
+	ATCLocker locker;
+	locker.set_compression_level(0);
+	locker.set_chunk_size(100000);
+	ASSERT(locker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 4; ++e)
+	{
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data[e].size();
+			entry.name_sjis = "test.txt";
+			entry.name_utf8 = "test.txt";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+	}
+
+	ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+	for (int e = 0; e < 2; ++e)
+	{
+		stringstream src(data[e]);
+		ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+	}
+
+	// 最後のエントリは二回に分けて書く
+	stringstream src(data[2]);
+	ASSERT(locker.writeFileData(&archive, &src, 70000) == ATC_OK);
+	ASSERT(locker.writeFileData(&archive, &src, data[2].size() - 70000) == ATC_OK);
+
+	// adler32 と詰め物はもう書いてあるので、一バイトも書き足さない
+	const string written = archive.str();
+	stringstream empty;
+	ASSERT(locker.writeFileData(&archive, &empty, 0) == ATC_OK);
+	ASSERT(archive.str() == written);
+	ASSERT(locker.close() == ATC_OK);
+
+	ATCUnlocker unlocker;
+	ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 4; ++e)
+	{
+		ATCFileEntry entry;
+		ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+		ASSERT(out.str() == data[e]);
+	}
+
+	return true;
+}
+
+// 一度に書き込まれた最大の長さを記録するストリームバッファ
+class MaxWriteBuf : public streambuf
+{
+public:
+	MaxWriteBuf() : max_write(0), total(0) {}
+
+	streamsize max_write;
+	streamsize total;
+	string tail;
+
+protected:
+	virtual streamsize xsputn(const char *s, streamsize n)
+	{
+		max_write = (n > max_write) ? n : max_write;
+		total += n;
+		tail.append(s, static_cast<size_t>(n));
+		if (tail.size() > 1024)
+		{
+			tail.erase(0, tail.size() - 1024);
+		}
+		return n;
+	}
+};
+
+bool Streaming_Extraction()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// よく圧縮される大きなエントリと、その直後の小さなエントリ
+	const size_t large_size = 20 * 1000 * 1000 + 7;
+	const string small_data = "entry after a large one";
+
+	stringstream archive;
+
+	ATCLocker locker;
+	locker.set_compression_level(9);
+	ASSERT(locker.open(&archive, key) == ATC_OK);
+
+	ATCFileEntry entry;
+	entry.attribute = 0;
+	entry.name_sjis = "test.txt";
+	entry.name_utf8 = "test.txt";
+	entry.change_unix_time = time_stamp;
+	entry.create_unix_time = time_stamp;
+
+	entry.size = large_size;
+	ASSERT(locker.addFileEntry(entry) == ATC_OK);
+	entry.size = small_data.size();
+	ASSERT(locker.addFileEntry(entry) == ATC_OK);
+
+	ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+	{
+		const string block(1000 * 1000, 'z');
+		for (int i = 0; i < 20; ++i)
+		{
+			stringstream src(block);
+			ASSERT(locker.writeFileData(&archive, &src, block.size()) == ATC_OK);
+		}
+		stringstream src("1234567");
+		ASSERT(locker.writeFileData(&archive, &src, 7) == ATC_OK);
+	}
+	{
+		stringstream src(small_data);
+		ASSERT(locker.writeFileData(&archive, &src, small_data.size()) == ATC_OK);
+	}
+	ASSERT(locker.close() == ATC_OK);
+
+	ATCUnlocker unlocker;
+	ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+	// 大きなエントリも固定長の単位で書き出される
+	MaxWriteBuf buf;
+	ostream out(&buf);
+	ASSERT(unlocker.getEntry(&entry, 0) == ATC_OK);
+	ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+	ASSERT(buf.total == static_cast<streamsize>(large_size));
+	ASSERT(buf.max_write <= ATC_CHUNK_SIZE);
+	ASSERT(buf.tail == string(1017, 'z') + "1234567");
+
+	// エントリの境界をまたいだ分は次のエントリに持ち越される
+	stringstream small_out;
+	ASSERT(unlocker.getEntry(&entry, 1) == ATC_OK);
+	ASSERT(unlocker.extractFileData(&small_out, &archive, entry.size) == ATC_OK);
+	ASSERT(small_out.str() == small_data);
+
+	return true;
+}
+
+bool Extraction_To_Sink_And_Buffer()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// テキスト、JPEG、テキスト
+	string data[3];
+	for (size_t i = 0; i < 300000; ++i)
+	{
+		data[0] += static_cast<char>('a' + (i * 7 + i / 13) % 26);
+	}
+	{
+		ifstream ifs(test_path + "cosmos.jpg", ifstream::binary);
+		stringstream buffer;
+		buffer << ifs.rdbuf();
+		data[1] = buffer.str();
+	}
+	data[2] = data[0].substr(0, 5000);
+
+	stringstream archive;
+
+	ATCLocker locker;
+	ASSERT(locker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 3; ++e)
+	{
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data[e].size();
+			entry.name_sjis = "test.txt";
+			entry.name_utf8 = "test.txt";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+	}
+
+	ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+	for (int e = 0; e < 3; ++e)
+	{
+		stringstream src(data[e]);
+		ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+	}
+	ASSERT(locker.close() == ATC_OK);
+
+	ATCUnlocker unlocker;
+	ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+	// 呼び出し側のバッファに展開
+	vector<char> buffer(data[0].size());
+	ASSERT(unlocker.extractFileData(&buffer[0], &archive, buffer.size()) == ATC_OK);
+	ASSERT(string(buffer.begin(), buffer.end()) == data[0]);
+
+	// sink に渡す
+	string out;
+	size_t calls = 0;
+	ASSERT(unlocker.extractFileData([&](const char *data, size_t length) {
+		out.append(data, length);
+		++calls;
+		return true;
+	}, &archive, data[1].size()) == ATC_OK);
+	ASSERT(out == data[1]);
+	ASSERT(calls > 1);
+
+	// sink が false を返すと中止する
+	ASSERT(unlocker.extractFileData([](const char *, size_t) {
+		return false;
+	}, &archive, data[2].size()) == ATC_ERR_SINK_ABORTED);
+
+	// ストリームの残りより長いバッファは埋められない
+	{
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			vector<char> buffer(data[e].size());
+			ASSERT(unlocker.extractFileData(&buffer[0], &archive, buffer.size()) == ATC_OK);
+			ASSERT(string(buffer.begin(), buffer.end()) == data[e]);
+		}
+
+		vector<char> buffer(data[2].size() + 100);
+		ASSERT(unlocker.extractFileData(&buffer[0], &archive, buffer.size()) == ATC_ERR_ZLIB_ERROR);
+	}
+
+	// 途中で切れた書庫
+	{
+		stringstream truncated(archive.str().substr(0, archive.str().size() / 2));
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&truncated, key) == ATC_OK);
+
+		vector<char> buffer(data[0].size());
+		ASSERT(unlocker.extractFileData(&buffer[0], &truncated, buffer.size()) == ATC_OK);
+		ASSERT(string(buffer.begin(), buffer.end()) == data[0]);
+
+		buffer.resize(data[1].size());
+		ASSERT(unlocker.extractFileData(&buffer[0], &truncated, buffer.size()) == ATC_ERR_ZLIB_ERROR);
+	}
+
+	return true;
+}
+
+bool Skip_Entries()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	string data[4];
+	for (int e = 0; e < 4; ++e)
+	{
+		for (size_t i = 0; i < 100000 * (e + 1) + 123; ++i)
+		{
+			data[e] += static_cast<char>('a' + (i * (e + 3) + i / 17) % 26);
+		}
+	}
+
+	stringstream archive;
+
+	ATCLocker locker;
+	ASSERT(locker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 4; ++e)
+	{
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data[e].size();
+			entry.name_sjis = "test.txt";
+			entry.name_utf8 = "test.txt";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+	}
+
+	ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+	for (int e = 0; e < 4; ++e)
+	{
+		stringstream src(data[e]);
+		ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+	}
+	ASSERT(locker.close() == ATC_OK);
+
+	ATCUnlocker unlocker;
+	ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+	// 途中まで展開してから、残りを読み飛ばす
+	stringstream out;
+	ASSERT(unlocker.extractFileData(&out, &archive, 1000) == ATC_OK);
+	ASSERT(out.str() == data[0].substr(0, 1000));
+	ASSERT(unlocker.skipFileData(&archive, data[0].size() - 1000) == ATC_OK);
+
+	stringstream out1;
+	ASSERT(unlocker.extractFileData(&out1, &archive, data[1].size()) == ATC_OK);
+	ASSERT(out1.str() == data[1]);
+
+	// 最後のエントリまで読み飛ばす
+	ASSERT(unlocker.skipToEntry(&archive, 3) == ATC_OK);
+	stringstream out3;
+	ASSERT(unlocker.extractFileData(&out3, &archive, data[3].size()) == ATC_OK);
+	ASSERT(out3.str() == data[3]);
+
+	// 戻ることはできない
+	ASSERT(unlocker.skipToEntry(&archive, 1) == ATC_ERR_INVARID_INDEX);
+	ASSERT(unlocker.skipToEntry(&archive, 4) == ATC_ERR_INVARID_INDEX);
+
+	return true;
+}
+
+bool Checkpoint_Index()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// 圧縮しにくいエントリを並べる
+	string data[8];
+	uint32_t x = 1;
+	for (int e = 0; e < 8; ++e)
+	{
+		for (size_t i = 0; i < 200000 + e; ++i)
+		{
+			x = x * 1103515245 + 12345;
+			data[e] += static_cast<char>('a' + (x >> 16) % 20);
+		}
+	}
+
+	stringstream archive;
+
+	ATCLocker locker;
+	ASSERT(locker.open(&archive, key) == ATC_OK);
+
+	for (int e = 0; e < 8; ++e)
+	{
+		ATCFileEntry entry;
+			entry.attribute = 0;
+			entry.size = data[e].size();
+			entry.name_sjis = "test.txt";
+			entry.name_utf8 = "test.txt";
+			entry.change_unix_time = time_stamp;
+			entry.create_unix_time = time_stamp;
+			ASSERT(locker.addFileEntry(entry) == ATC_OK);
+	}
+
+	ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+	for (int e = 0; e < 8; ++e)
+	{
+		stringstream src(data[e]);
+		ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+	}
+	ASSERT(locker.close() == ATC_OK);
+
+	stringstream index;
+	{
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+		ASSERT(unlocker.buildIndex(&archive, &index, 100000) == ATC_OK);
+
+		// 作成後は最初のエントリから読める
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, data[0].size()) == ATC_OK);
+		ASSERT(out.str() == data[0]);
+	}
+
+	// チェックポイントより手前を壊しても、その先のエントリは読める
+	string broken = archive.str();
+	broken[broken.size() / 4] ^= 0x55;
+	stringstream broken_archive(broken);
+
+	ATCUnlocker unlocker;
+	ASSERT(unlocker.open(&broken_archive, key) == ATC_OK);
+	ASSERT(unlocker.loadIndex(&broken_archive, &index) == ATC_OK);
+
+	const int order[] = {7, 5, 6, 3};
+	for (int i = 0; i < 4; ++i)
+	{
+		const int e = order[i];
+		ASSERT(unlocker.seekToEntry(&broken_archive, e) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &broken_archive, data[e].size()) == ATC_OK);
+		ASSERT(out.str() == data[e]);
+	}
+
+	// 別の鍵やアーカイブのインデックスは受け付けない
+	string broken_index = index.str();
+	broken_index[20] ^= 1;
+	stringstream broken_index_stream(broken_index);
+	ASSERT(unlocker.loadIndex(&broken_archive, &broken_index_stream) == ATC_ERR_BROKEN_INDEX);
+
+	// 暗号文のビットを反転して末尾の CRC32 を合わせる改ざんも受け付けない
+	string forged = index.str();
+	const size_t body_size = forged.size() - sizeof(uint32_t);
+	string delta(body_size, '\0');
+	const string zeros(body_size, '\0');
+	delta[body_size / 2] = 1;
+	forged[body_size / 2] ^= 1;
+	const uint32_t crc_delta =
+		static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(delta.data()), static_cast<uInt>(body_size)) ^
+		crc32(0, reinterpret_cast<const Bytef*>(zeros.data()), static_cast<uInt>(body_size)));
+	for (int i = 0; i < 4; ++i)
+	{
+		forged[body_size + i] ^= static_cast<char>(crc_delta >> (i * 8));
+	}
+	stringstream forged_stream(forged);
+	ASSERT(unlocker.loadIndex(&broken_archive, &forged_stream) == ATC_ERR_BROKEN_INDEX);
+
+	// v1.x の書庫にも作れる
+	{
+		char cosmos[ATC_KEY_SIZE] = "cosmos";
+		ifstream ifs(test_path + "cosmos_v1.46.atc.tester", ifstream::binary);
+		ASSERT(ifs);
+
+		ATCUnlocker legacy;
+		ASSERT(legacy.open(&ifs, cosmos) == ATC_OK);
+
+		stringstream legacy_index;
+		ASSERT(legacy.buildIndex(&ifs, &legacy_index, 1000) == ATC_OK);
+
+		stringstream loaded(legacy_index.str());
+		ASSERT(legacy.loadIndex(&ifs, &loaded) == ATC_OK);
+
+		string tampered = legacy_index.str();
+		tampered[tampered.size() / 2] ^= 1;
+		stringstream tampered_stream(tampered);
+		ASSERT(legacy.loadIndex(&ifs, &tampered_stream) == ATC_ERR_BROKEN_INDEX);
+	}
+
+	return true;
+}
+
+bool Reused_Streams()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	string data;
+	for (size_t i = 0; i < 300000; ++i)
+	{
+		data += static_cast<char>('a' + (i * 7 + i / 13) % 26);
+	}
+
+	// 一つのロッカーで圧縮レベルを変えながら続けてアーカイブを作る
+	const int32_t levels[] = {6, 1, 0, 9};
+	stringstream archives[4];
+
+	ATCLocker locker;
+	for (int a = 0; a < 4; ++a)
+	{
+		locker.set_compression_level(levels[a]);
+		ASSERT(locker.open(&archives[a], key) == ATC_OK);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data.size();
+				entry.name_sjis = "test.txt";
+				entry.name_utf8 = "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				ASSERT(locker.addFileEntry(entry) == ATC_OK);
+		}
+
+		ASSERT(locker.writeEncryptedHeader(&archives[a]) == ATC_OK);
+		for (int e = 0; e < 2; ++e)
+		{
+			stringstream src(data);
+			ASSERT(locker.writeFileData(&archives[a], &src, data.size()) == ATC_OK);
+		}
+		ASSERT(locker.close() == ATC_OK);
+	}
+
+	// 一つのアンロッカーで続けて開く。チェックポイントから展開した後でも開き直せる
+	ATCUnlocker unlocker;
+	for (int a = 0; a < 4; ++a)
+	{
+		ASSERT(unlocker.open(&archives[a], key) == ATC_OK);
+		ASSERT(unlocker.getEntryLength() == 2);
+
+		stringstream index;
+		ASSERT(unlocker.buildIndex(&archives[a], &index, 100000) == ATC_OK);
+		ASSERT(unlocker.seekToEntry(&archives[a], 1) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archives[a], data.size()) == ATC_OK);
+		ASSERT(out.str() == data);
+		ASSERT(unlocker.close() == ATC_OK);
+	}
+
+	return true;
+}
+
+bool Buffer_Lock_And_Unlock()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// 小さいアーカイブ（空のエントリを含む）と、大きいアーカイブ
+	string data[2][3];
+	data[0][0] = "small entry";
+	data[0][2] = string(20000, 'x');
+	for (size_t i = 0; i < 300000; ++i)
+	{
+		data[1][i % 3] += static_cast<char>('a' + (i * 7 + i / 13) % 26);
+	}
+
+	for (int a = 0; a < 2; ++a)
+	{
+		vector<ATCFileEntry> entries;
+		const char *spans[3];
+		for (int e = 0; e < 3; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data[a][e].size();
+				entry.name_sjis = "test.txt";
+				entry.name_utf8 = "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				entries.push_back(entry);
+			spans[e] = data[a][e].data();
+		}
+
+		string archive;
+		ATCLocker locker;
+		ASSERT(locker.lockToBuffer(&archive, key, entries, spans) == ATC_OK);
+
+		// メモリ上のまま開く
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.openBuffer(archive.data(), archive.size(), key) == ATC_OK);
+		ASSERT(unlocker.getEntryLength() == 3);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			ATCFileEntry entry;
+			ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+			vector<char> out(static_cast<size_t>(entry.size) + 1);
+			ASSERT(unlocker.extractFileData(&out[0], nullptr, static_cast<size_t>(entry.size)) == ATC_OK);
+			ASSERT(string(&out[0], static_cast<size_t>(entry.size)) == data[a][e]);
+		}
+
+		// ストリームからも読める
+		stringstream archive_stream(archive);
+		ATCUnlocker stream_unlocker;
+		ASSERT(stream_unlocker.open(&archive_stream, key) == ATC_OK);
+		for (int e = 0; e < 3; ++e)
+		{
+			stringstream out;
+			ASSERT(stream_unlocker.extractFileData(&out, &archive_stream, data[a][e].size()) == ATC_OK);
+			ASSERT(out.str() == data[a][e]);
+		}
+	}
+
+	return true;
+}
+
+bool Pipelined_Compression()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// 空、小さい、多くのチャンクにまたがるエントリ
+	string data[3];
+	data[1] = "pipelined";
+	for (size_t i = 0; i < 300000; ++i)
+	{
+		data[2] += static_cast<char>((i % 1000 < 500) ? 'a' + i % 13 : i * 31 + i / 251);
+	}
+
+	for (int adaptive = 0; adaptive < 2; ++adaptive)
+	{
+		stringstream archive;
+
+		ATCLocker locker;
+		locker.set_chunk_size(4096);
+		locker.set_adaptive_compression(adaptive != 0);
+		locker.set_pipelined(true);
+		ASSERT(locker.pipelined());
+		ASSERT(locker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data[e].size();
+				entry.name_sjis = "test.txt";
+				entry.name_utf8 = "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				ASSERT(locker.addFileEntry(entry) == ATC_OK);
+		}
+
+		ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+		for (int e = 0; e < 2; ++e)
+		{
+			stringstream src(data[e]);
+			ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+		}
+
+		// 最後のエントリは二回に分けて書く
+		stringstream src(data[2]);
+		ASSERT(locker.writeFileData(&archive, &src, 100000) == ATC_OK);
+		ASSERT(locker.writeFileData(&archive, &src, data[2].size() - 100000) == ATC_OK);
+		ASSERT(locker.close() == ATC_OK);
+
+		ATCUnlocker unlocker;
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			ATCFileEntry entry;
+			ASSERT(unlocker.getEntry(&entry, e) == ATC_OK);
+
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK);
+			ASSERT(out.str() == data[e]);
+		}
+	}
+
+	return true;
+}
+
+bool Read_Ahead_Extraction()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	// 展開すると 64 KiB のチャンクをいくつもまたぐエントリ
+	string data[3];
+	for (int e = 0; e < 3; ++e)
+	{
+		for (size_t i = 0; i < 400000; ++i)
+		{
+			data[e] += static_cast<char>((i % 700 < 300) ? 'a' + (i + e) % 17 : i * 31 + i / 251 + e);
+		}
+	}
+
+	stringstream archive;
+	{
+		ATCLocker locker;
+		ASSERT(locker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			ATCFileEntry entry;
+				entry.attribute = 0;
+				entry.size = data[e].size();
+				entry.name_sjis = "test.txt";
+				entry.name_utf8 = "test.txt";
+				entry.change_unix_time = time_stamp;
+				entry.create_unix_time = time_stamp;
+				ASSERT(locker.addFileEntry(entry) == ATC_OK);
+		}
+
+		ASSERT(locker.writeEncryptedHeader(&archive) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			stringstream src(data[e]);
+			ASSERT(locker.writeFileData(&archive, &src, data[e].size()) == ATC_OK);
+		}
+		ASSERT(locker.close() == ATC_OK);
+	}
+
+	// 一つのスレッドと複数スレッドでの復号
+	for (int threads = 1; threads <= 2; ++threads)
+	{
+		ATCUnlocker unlocker;
+		unlocker.set_thread_count(threads);
+		unlocker.set_read_ahead(true);
+		ASSERT(unlocker.read_ahead());
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &archive, data[e].size()) == ATC_OK);
+			ASSERT(out.str() == data[e]);
+		}
+		ASSERT(unlocker.close() == ATC_OK);
+	}
+
+	// 展開の途中でインデックスを読み込んでも、先読みしたチャンクから続ける
+	stringstream index;
+	{
+		ATCUnlocker unlocker;
+		unlocker.set_read_ahead(true);
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+		ASSERT(unlocker.buildIndex(&archive, &index, 100000) == ATC_OK);
+
+		ASSERT(unlocker.seekToEntry(&archive, 2) == ATC_OK);
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, data[2].size()) == ATC_OK);
+		ASSERT(out.str() == data[2]);
+	}
+	{
+		ATCUnlocker unlocker;
+		unlocker.set_read_ahead(true);
+		ASSERT(unlocker.open(&archive, key) == ATC_OK);
+
+		stringstream out;
+		ASSERT(unlocker.extractFileData(&out, &archive, data[0].size()) == ATC_OK);
+		ASSERT(out.str() == data[0]);
+
+		index.clear();
+		index.seekg(0);
+		ASSERT(unlocker.loadIndex(&archive, &index) == ATC_OK);
+
+		for (int e = 1; e < 3; ++e)
+		{
+			stringstream out;
+			ASSERT(unlocker.extractFileData(&out, &archive, data[e].size()) == ATC_OK);
+			ASSERT(out.str() == data[e]);
+		}
+	}
+
+	// openBuffer で開いたアーカイブ
+	{
+		const string buffer = archive.str();
+		ATCUnlocker unlocker;
+		unlocker.set_read_ahead(true);
+		ASSERT(unlocker.openBuffer(buffer.data(), buffer.size(), key) == ATC_OK);
+
+		for (int e = 0; e < 3; ++e)
+		{
+			vector<char> out(data[e].size());
+			ASSERT(unlocker.extractFileData(&out[0], nullptr, out.size()) == ATC_OK);
+			ASSERT(string(out.begin(), out.end()) == data[e]);
+		}
+	}
+
+	return true;
+}
+
+bool Batch_Lock_And_Unlock()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	const ATCKey lock_key(key, ATC_KEY_ENCRYPTION);
+	const ATCKey unlock_key(key, ATC_KEY_DECRYPTION);
+	time_t time_stamp = time(NULL);
+
+	const int count = 24;
+	vector<string> data(count);
+	for (int a = 0; a < count; ++a)
+	{
+		for (size_t i = 0; i < static_cast<size_t>(a) * 7919; ++i)
+		{
+			data[a] += static_cast<char>((i % 300 < 100) ? 'a' + (i + a) % 19 : i * 31 + i / 251 + a);
+		}
+	}
+
+	ATCFileEntry entry;
+		entry.attribute = 0;
+		entry.name_sjis = "test.txt";
+		entry.name_utf8 = "test.txt";
+		entry.change_unix_time = time_stamp;
+		entry.create_unix_time = time_stamp;
+
+	// メモリ上のデータと、ファイルからファイルへのロック
+	const string src_path = test_path + "test_batch_.txt";
+	const string atc_path = test_path + "test_batch_.atc";
+	{
+		ofstream src(src_path.c_str(), ios::binary);
+		src.write(data[count - 1].data(), data[count - 1].size());
+	}
+
+	vector<string> archives(count);
+	atomic<int> callbacks(0);
+	{
+		ATCBatch batch;
+		batch.set_thread_count(3);
+
+		for (int a = 0; a < count; ++a)
+		{
+			ATCBatchJob job;
+			job.type = ATC_BATCH_LOCK;
+			job.key = lock_key;
+			entry.size = data[a].size();
+			job.entries.push_back(entry);
+			job.src_buffers.push_back(data[a].data());
+			job.dst_buffer = &archives[a];
+			job.callback = [&callbacks](ATCResult) { ++callbacks; };
+			batch.submit(job);
+		}
+
+		ATCBatchJob job;
+		job.type = ATC_BATCH_LOCK;
+		job.key = lock_key;
+		entry.size = data[count - 1].size();
+		job.entries.push_back(entry);
+		job.src_paths.push_back(src_path);
+		job.dst_path = atc_path;
+		const size_t file_job = batch.submit(job);
+
+		batch.wait();
+		ASSERT(callbacks == count);
+		for (int a = 0; a < count; ++a)
+		{
+			ASSERT(batch.result(a) == ATC_OK);
+		}
+		ASSERT(batch.result(file_job) == ATC_OK);
+	}
+
+	// アンロックしてもとのデータと比べる
+	{
+		ATCBatch batch;
+		batch.set_thread_count(3);
+
+		vector<vector<string> > contents(count + 1);
+		vector<vector<ATCFileEntry> > entries(count + 1);
+		for (int a = 0; a <= count; ++a)
+		{
+			ATCBatchJob job;
+			job.type = ATC_BATCH_UNLOCK;
+			job.key = unlock_key;
+			if (a < count)
+			{
+				job.src_buffer = archives[a].data();
+				job.src_length = archives[a].size();
+			} else {
+				job.src_path = atc_path;
+			}
+			job.dst_entries = &entries[a];
+			job.dst_buffers = &contents[a];
+			batch.submit(job);
+		}
+
+		batch.wait();
+		for (int a = 0; a <= count; ++a)
+		{
+			ASSERT(batch.result(a) == ATC_OK);
+			ASSERT(entries[a].size() == 1 && contents[a].size() == 1);
+			ASSERT(contents[a][0] == data[a < count ? a : count - 1]);
+		}
+
+		// 存在しないファイル。コールバックの中でも結果が読める
+		ATCResult callback_result = ATC_OK;
+		ATCBatchJob job;
+		job.type = ATC_BATCH_UNLOCK;
+		job.key = unlock_key;
+		job.src_path = test_path + "no_such_file_.atc";
+		job.callback = [&batch, &callback_result, count](ATCResult)
+		{
+			callback_result = batch.result(count + 1);
+		};
+		const size_t missing_job = batch.submit(job);
+		batch.wait();
+		ASSERT(missing_job == static_cast<size_t>(count + 1));
+		ASSERT(batch.result(missing_job) == ATC_ERR_ISTREAM_FAILURE);
+		ASSERT(callback_result == ATC_ERR_ISTREAM_FAILURE);
+	}
+
+	remove(src_path.c_str());
+	remove(atc_path.c_str());
+
+	// 一つのワーカーでは、優先度が高いもの、小さいものの順に実行される
+	{
+		ATCBatch batch;
+		batch.set_thread_count(1);
+
+		atomic<bool> submitted(false);
+		vector<int> order;
+		ATCResult running_result = ATC_OK;
+		ATCResult queued_result = ATC_OK;
+
+		for (int a = count - 1; a >= 0; --a)
+		{
+			ATCBatchJob job;
+			job.type = ATC_BATCH_LOCK;
+			job.key = lock_key;
+			job.priority = (a == count - 1) ? 2 : (a == count - 2) ? 1 : 0;
+			entry.size = data[a].size();
+			job.entries.push_back(entry);
+			job.src_buffers.push_back(data[a].data());
+			job.dst_buffer = &archives[a];
+
+			// 最初のジョブはすべて追加し終わるまで終わらない
+			job.callback = [&batch, &submitted, &order, &running_result, &queued_result, a, count](ATCResult)
+			{
+				while (a == count - 1 && !submitted)
+				{
+					this_thread::yield();
+				}
+				if (a == count - 1)
+				{
+					// 最初のジョブの番号は 0、まだ実行していないジョブは ATC_ERR_PENDING
+					running_result = batch.result(0);
+					queued_result = batch.result(1);
+				}
+				order.push_back(a);
+			};
+			batch.submit(job);
+		}
+		submitted = true;
+		batch.wait();
+
+		ASSERT(order.size() == static_cast<size_t>(count));
+		ASSERT(order[0] == count - 1 && order[1] == count - 2);
+		ASSERT(running_result == ATC_OK && queued_result == ATC_ERR_PENDING);
+		for (int i = 2; i < count; ++i)
+		{
+			ASSERT(order[i] == i - 2);
+		}
+	}
+
+	return true;
+}
+
+bool Directory_Lock()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	time_t time_stamp = time(NULL);
+
+	const string root = test_path + "test_dir_";
+	const char* const directories[] = { "", "/empty_dir", "/sub", "/sub/deeper" };
+	const char* const files[] = { "/a.txt", "/sub/b.bin", "/sub/deeper/c.txt", "/sub/empty.txt" };
+
+	vector<string> data(4);
+	for (size_t i = 0; i < 300000; ++i)
+	{
+		data[0] += static_cast<char>('a' + i % 23);
+		data[1] += static_cast<char>(i * 31 + i / 251);
+	}
+	data[2] = "Hello, world!";
+
+	for (int d = 0; d < 4; ++d)
+	{
+#ifdef WIN32
+		_mkdir((root + directories[d]).c_str());
+#else
+		mkdir((root + directories[d]).c_str(), 0755);
+#endif
+	}
+	for (int f = 0; f < 4; ++f)
+	{
+		ofstream ofs((root + files[f]).c_str(), ios::binary);
+		ofs.write(data[f].data(), data[f].size());
+	}
+
+#ifndef WIN32
+	// 祖先を指すシンボリックリンク。既定ではたどらない
+	const char* const links[] = { "/sub/loop", "/sub/deeper/loop" };
+	symlink("..", (root + links[0]).c_str());
+	symlink("../..", (root + links[1]).c_str());
+#endif
+
+	// ディレクトリの直後にその中身が名前の順に並ぶ
+	const char* const names[] = {
+		"test_dir_\\", "test_dir_\\a.txt", "test_dir_\\empty_dir\\", "test_dir_\\sub\\",
+		"test_dir_\\sub\\b.bin", "test_dir_\\sub\\deeper\\", "test_dir_\\sub\\deeper\\c.txt", "test_dir_\\sub\\empty.txt"
+	};
+	const int contents[] = { -1, 0, -1, -1, 1, -1, 2, 3 };
+
+	stringstream archive;
+	{
+		ATCDirectoryOptions options;
+		options.stat_threads = 3;
+		options.readahead_files = 2;
+
+		ATCLocker locker;
+		ASSERT(locker.lockDirectory(&archive, key, root, options) == ATC_OK);
+	}
+
+	bool ok = true;
+	{
+		ATCUnlocker unlocker;
+		ok = ok && unlocker.open(&archive, key) == ATC_OK;
+		ok = ok && unlocker.getEntryLength() == 8;
+
+		for (size_t i = 0; ok && i < 8; ++i)
+		{
+			ATCFileEntry entry;
+			ok = ok && unlocker.getEntry(&entry, i) == ATC_OK;
+			ok = ok && entry.name_utf8 == names[i] && entry.name_sjis == names[i];
+
+			if (contents[i] < 0)
+			{
+				ok = ok && entry.size == -1 && (entry.attribute & 16) != 0;
+				continue;
+			}
+
+			ok = ok && entry.size == static_cast<int64_t>(data[contents[i]].size()) && (entry.attribute & 16) == 0;
+			ok = ok && entry.change_unix_time >= time_stamp - 2 && entry.change_unix_time <= time(NULL) + 2;
+
+			stringstream out;
+			ok = ok && unlocker.extractFileData(&out, &archive, entry.size) == ATC_OK;
+			ok = ok && out.str() == data[contents[i]];
+		}
+	}
+
+	// root を入れない場合と、存在しない root
+	{
+		ATCDirectoryOptions options;
+		options.include_root = false;
+
+		stringstream without_root;
+		ATCLocker locker;
+		ok = ok && locker.lockDirectory(&without_root, key, root, options) == ATC_OK;
+
+		ATCUnlocker unlocker;
+		ATCFileEntry entry;
+		ok = ok && unlocker.open(&without_root, key) == ATC_OK;
+		ok = ok && unlocker.getEntryLength() == 7;
+		ok = ok && unlocker.getEntry(&entry, 0) == ATC_OK && entry.name_utf8 == "a.txt";
+
+		stringstream missing;
+		ok = ok && locker.lockDirectory(&missing, key, root + "/no_such_dir") == ATC_ERR_ISTREAM_FAILURE;
+	}
+
+#ifndef WIN32
+	// シンボリックリンクをたどっても、読んだディレクトリには戻らない
+	{
+		ATCDirectoryOptions options;
+		options.follow_symlinks = true;
+
+		stringstream followed;
+		ATCLocker locker;
+		ok = ok && locker.lockDirectory(&followed, key, root, options) == ATC_OK;
+
+		ATCUnlocker unlocker;
+		ok = ok && unlocker.open(&followed, key) == ATC_OK;
+		ok = ok && unlocker.getEntryLength() == 8;
+		for (size_t i = 0; ok && i < 8; ++i)
+		{
+			ATCFileEntry entry;
+			ok = ok && unlocker.getEntry(&entry, i) == ATC_OK && entry.name_utf8 == names[i];
+		}
+	}
+
+	for (int l = 0; l < 2; ++l)
+	{
+		remove((root + links[l]).c_str());
+	}
+#endif
+
+	for (int f = 0; f < 4; ++f)
+	{
+		remove((root + files[f]).c_str());
+	}
+	for (int d = 3; d >= 0; --d)
+	{
+#ifdef WIN32
+		_rmdir((root + directories[d]).c_str());
+#else
+		rmdir((root + directories[d]).c_str());
+#endif
+	}
+
+	ASSERT(ok);
+	return true;
+}
+
+bool Directory_Extraction()
+{
+	char key[ATC_KEY_SIZE] = "This is a pen.";
+	const time_t time_stamp = 1300000000;
+
+	// out\\deep\\ と out\\表示\\ はヘッダに無いが、親として作られる
+	// 表示 は Shift_JIS で 95 5C 8E A6 で、2 バイト目が \ と同じ
+	const char* const names[] = {
+		"out\\", "out\\a.txt", "out\\sub\\", "out\\sub\\big.bin", "out\\sub\\empty.txt", "out\\deep\\c.txt",
+		"out\\\xE8\xA1\xA8\xE7\xA4\xBA\\b.txt"
+	};
+	const char* const names_sjis[] = {
+		"out\\", "out\\a.txt", "out\\sub\\", "out\\sub\\big.bin", "out\\sub\\empty.txt", "out\\deep\\c.txt",
+		"out\\\x95\x5C\x8E\xA6\\b.txt"
+	};
+#ifdef WIN32
+	const char* const sjis_directory = "/out/\x95\x5C\x8E\xA6";
+	const char* const paths[] = { "/out", "/out/a.txt", "/out/sub", "/out/sub/big.bin", "/out/sub/empty.txt", "/out/deep/c.txt",
+		"/out/\x95\x5C\x8E\xA6/b.txt" };
+#else
+	const char* const sjis_directory = "/out/\xE8\xA1\xA8\xE7\xA4\xBA";
+	const char* const paths[] = { "/out", "/out/a.txt", "/out/sub", "/out/sub/big.bin", "/out/sub/empty.txt", "/out/deep/c.txt",
+		"/out/\xE8\xA1\xA8\xE7\xA4\xBA/b.txt" };
+#endif
+	const int count = 7;
+
+	vector<string> data(count);
+	data[1] = "Hello, world!";
+	for (size_t i = 0; i < 1000000; ++i)
+	{
+		data[3] += static_cast<char>(i * 31 + i / 251);
+	}
+	data[5] = "deep";
+	data[6] = "sjis";
+
+	vector<ATCFileEntry> entries(count);
+	vector<const char*> buffers(count);
+	for (int i = 0; i < count; ++i)
+	{
+		const bool directory = names[i][strlen(names[i]) - 1] == '\\';
+		entries[i].name_sjis = names_sjis[i];
+		entries[i].name_utf8 = names[i];
+		entries[i].size = directory ? -1 : static_cast<int64_t>(data[i].size());
+		entries[i].attribute = directory ? 16 : 0;
+		entries[i].change_unix_time = time_stamp + i * 3600;
+		entries[i].create_unix_time = time_stamp;
+		buffers[i] = data[i].data();
+	}
+
+	string archive;
+	{
+		ATCLocker locker;
+		ASSERT(locker.lockToBuffer(&archive, key, entries, &buffers[0]) == ATC_OK);
+	}
+
+	const string root = test_path + "test_extract_";
+	bool ok = true;
+	{
+		ATCUnlocker unlocker;
+		unlocker.set_writer_count(3);
+		ok = ok && unlocker.openBuffer(archive.data(), archive.size(), key) == ATC_OK;
+		ok = ok && unlocker.extractToDirectory(nullptr, root) == ATC_OK;
+	}
+
+	for (int i = 0; ok && i < count; ++i)
+	{
+		const string path = root + paths[i];
+
+#ifdef WIN32
+		struct __stat64 st;
+		ok = ok && _stat64(path.c_str(), &st) == 0;
+#else
+		struct stat st;
+		ok = ok && stat(path.c_str(), &st) == 0;
+#endif
+		if (entries[i].size < 0)
+		{
+			ok = ok && (st.st_mode & S_IFDIR) != 0;
+			continue;
+		}
+
+		ifstream ifs(path.c_str(), ios::binary);
+		stringstream content;
+		content << ifs.rdbuf();
+		ok = ok && content.str() == data[i];
+		ok = ok && st.st_mtime >= entries[i].change_unix_time - 2 && st.st_mtime <= entries[i].change_unix_time + 2;
+	}
+
+	// root の外を指す名前は展開しない
+	{
+		vector<ATCFileEntry> evil(1, entries[1]);
+		evil[0].name_sjis = evil[0].name_utf8 = "out\\..\\..\\evil.txt";
+
+		string evil_archive;
+		ATCLocker locker;
+		ok = ok && locker.lockToBuffer(&evil_archive, key, evil, &buffers[1]) == ATC_OK;
+
+		ATCUnlocker unlocker;
+		ok = ok && unlocker.openBuffer(evil_archive.data(), evil_archive.size(), key) == ATC_OK;
+		ok = ok && unlocker.extractToDirectory(nullptr, root) == ATC_ERR_INVARID_FILE_ENTRY;
+		ok = ok && !ifstream((test_path + "evil.txt").c_str());
+	}
+
+	// v1.x のように Shift_JIS の名前しか無い場合も、2 バイト目の 0x5C では区切らない
+	{
+		string path, parent;
+		ok = ok && nativePath("r", "\x95\x5C\x8E\xA6\\\x83\x5C.txt", true, &path, &parent);
+#ifdef WIN32
+		ok = ok && path == "r\\\x95\x5C\x8E\xA6\\\x83\x5C.txt" && parent == "r\\\x95\x5C\x8E\xA6";
+#else
+		ok = ok && path == "r/\x95\x5C\x8E\xA6/\x83\x5C.txt" && parent == "r/\x95\x5C\x8E\xA6";
+#endif
+	}
+
+	for (int i = count - 1; i >= 0; --i)
+	{
+		if (entries[i].size >= 0)
+		{
+			remove((root + paths[i]).c_str());
+		}
+	}
+	const char* const directories[] = { sjis_directory, "/out/deep", "/out/sub", "/out", "" };
+	for (int d = 0; d < 5; ++d)
+	{
+#ifdef WIN32
+		_rmdir((root + directories[d]).c_str());
+#else
+		rmdir((root + directories[d]).c_str());
+#endif
+	}
+
+	ASSERT(ok);
+	return true;
+}
+
 #undef ASSERT
 #undef TEST
\ No newline at end of file